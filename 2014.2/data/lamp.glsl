@@ -1,10 +1,27 @@
 #version 150
-uniform mat4 modelview;
-uniform mat4 projection;
+layout(std140) uniform Frame
+{
+	mat4 projection;
+	mat4 view;
+	vec3 light_direction;
+	float light_intensity;
+	vec3 sky_direction;
+	float ambient_intensity;
+};
+#ifdef INSTANCED
+in mat4 in_model;
+#define model in_model
+#else
+layout(std140) uniform Draw
+{
+	mat4 model;
+};
+#endif
 in vec4 in_position;
+invariant gl_Position;
 void main()
 {
-	gl_Position = projection*modelview*in_position;
+	gl_Position = projection*(view*(model*in_position));
 }
 ---
 #version 150
@@ -1,23 +1,47 @@
 #version 150
-uniform mat4 modelview;
-uniform mat4 projection;
+layout(std140) uniform Frame
+{
+	mat4 projection;
+	mat4 view;
+	vec3 light_direction;
+	float light_intensity;
+	vec3 sky_direction;
+	float ambient_intensity;
+};
+#ifdef INSTANCED
+in mat4 in_model;
+#define model in_model
+#else
+layout(std140) uniform Draw
+{
+	mat4 model;
+};
+#endif
 in vec4 in_position;
 in vec3 in_normal;
 out vec3 v_normal;
 out vec3 v_incident;
+invariant gl_Position;
 void main()
 {
-	vec4 eye_vertex = modelview*in_position;
+	vec4 eye_vertex = view*(model*in_position);
 	gl_Position = projection*eye_vertex;
-	v_normal = mat3(modelview)*in_normal;
+#ifndef DEPTH_ONLY
+	v_normal = mat3(view)*(mat3(model)*in_normal);
 	v_incident = eye_vertex.xyz;
+#endif
 }
 ---
 #version 150
-uniform vec3 light_direction;
-uniform float light_intensity;
-uniform float ambient_intensity;
-uniform vec3 sky_direction;
+layout(std140) uniform Frame
+{
+	mat4 projection;
+	mat4 view;
+	vec3 light_direction;
+	float light_intensity;
+	vec3 sky_direction;
+	float ambient_intensity;
+};
 uniform vec4 color;
 in vec3 v_normal;
 in vec3 v_incident;
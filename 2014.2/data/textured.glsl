@@ -1,22 +1,47 @@
 #version 150
-uniform mat4 modelview;
-uniform mat4 projection;
+layout(std140) uniform Frame
+{
+	mat4 projection;
+	mat4 view;
+	vec3 light_direction;
+	float light_intensity;
+	vec3 sky_direction;
+	float ambient_intensity;
+};
+#ifdef INSTANCED
+in mat4 in_model;
+#define model in_model
+#else
+layout(std140) uniform Draw
+{
+	mat4 model;
+};
+#endif
 in vec4 in_position;
 in vec3 in_normal;
 in vec2 in_texcoord;
 out vec3 v_normal;
 out vec2 v_texcoord;
+invariant gl_Position;
 void main()
 {
-	gl_Position = projection*modelview*in_position;
-	v_normal = mat3(modelview)*in_normal;
+	gl_Position = projection*(view*(model*in_position));
+#ifndef DEPTH_ONLY
+	v_normal = mat3(view)*(mat3(model)*in_normal);
 	v_texcoord = in_texcoord;
+#endif
 }
 ---
 #version 150
-uniform vec3 light_direction;
-uniform float light_intensity;
-uniform float ambient_intensity;
+layout(std140) uniform Frame
+{
+	mat4 projection;
+	mat4 view;
+	vec3 light_direction;
+	float light_intensity;
+	vec3 sky_direction;
+	float ambient_intensity;
+};
 uniform sampler2D texture;
 in vec3 v_normal;
 in vec2 v_texcoord;
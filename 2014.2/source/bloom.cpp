@@ -58,6 +58,7 @@ Bloom::Bloom(unsigned w, unsigned h):
 	blur_shader.set_source(vshader, blur_fshader);
 	blur_shader.bind();
 	blur_shader.set_uniform("source", 0);
+	delta_uniform = blur_shader.get_uniform("delta");
 	combine_shader.set_source(vshader, combine_fshader);
 	combine_shader.bind();
 	combine_shader.set_uniform("source", 0);
@@ -75,7 +76,8 @@ Bloom::Bloom(unsigned w, unsigned h):
 		indices.push_back(i);
 	}
 	object.set_data(vertices, indices);
-	object.set_material(&material);
+	blur_material.set_shader(&blur_shader);
+	combine_material.set_shader(&combine_shader);
 
 	// Set some default parameters
 	set_radius(5);
@@ -122,30 +124,40 @@ void Bloom::render_effect(Framebuffer *target)
 {
 	// Horizontal blur
 	blur_shader.bind();
-	blur_shader.set_uniform("delta", scaling/width, 0.0f);
-	material.set_shader(&blur_shader);
-	material.set_texture(&scene_fbo.get_color_buffer());
+	blur_shader.set_uniform(delta_uniform, scaling/width, 0.0f);
+	object.set_material(&blur_material);
+	blur_material.set_texture(&scene_fbo.get_color_buffer());
 	hblur_fbo.bind();
-	// We need a dummy RenderState for the object
-	RenderState state;
-	object.render(state);
+	render_object();
 
 	// Vertical blur
-	blur_shader.set_uniform("delta", 0.0f, scaling/height);
-	material.set_texture(&hblur_fbo.get_color_buffer());
+	blur_shader.set_uniform(delta_uniform, 0.0f, scaling/height);
+	blur_material.set_texture(&hblur_fbo.get_color_buffer());
 	vblur_fbo.bind();
-	object.render(state);
+	render_object();
 
 	// Combine the blurred image with the original
-	material.set_shader(&combine_shader);
-	material.set_texture(&scene_fbo.get_color_buffer());
+	object.set_material(&combine_material);
+	combine_material.set_texture(&scene_fbo.get_color_buffer());
 	vblur_fbo.get_color_buffer().bind(1);
 	if(target)
 		target->bind();
 	else
 		Framebuffer::unbind();
-	object.render(state);
+	render_object();
 	Texture::unbind(1);
 }
 
+void Bloom::render_object()
+{
+	// The queue keeps its memory between passes
+	queue.clear();
+	object.collect(queue, WorldTransform());
+	queue.sort();
+
+	// We need a dummy RenderState for the object
+	RenderState state;
+	queue.render(state);
+}
+
 } // namespace SkrolliGL
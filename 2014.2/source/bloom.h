@@ -5,12 +5,16 @@
 #include "material.h"
 #include "object.h"
 #include "postprocessor.h"
+#include "renderqueue.h"
 #include "shader.h"
 
 namespace SkrolliGL {
 
 /*
 Renders a bloom effect, spreading out very bright spots in the image.
+
+Everything needed for rendering is set up beforehand, so rendering the effect
+doesn't allocate memory or look up uniforms by name.
 */
 class Bloom: public Postprocessor
 {
@@ -22,9 +26,12 @@ private:
 	Framebuffer hblur_fbo;
 	Framebuffer vblur_fbo;
 	Shader blur_shader;
+	UniformHandle delta_uniform;
 	Shader combine_shader;
-	Material material;
+	Material blur_material;
+	Material combine_material;
 	Object object;
+	RenderQueue queue;
 
 public:
 	Bloom(unsigned, unsigned);
@@ -42,6 +49,8 @@ public:
 
 	virtual Framebuffer &get_render_target() { return scene_fbo; }
 	virtual void render_effect(Framebuffer *);
+private:
+	void render_object();
 };
 
 } // namespace SkrolliGL
@@ -0,0 +1,499 @@
+#include <algorithm>
+#include <cfloat>
+#include "boundstree.h"
+
+using namespace std;
+
+namespace SkrolliGL {
+
+// Marks a missing node or item
+const unsigned none = 0xFFFFFFFF;
+
+// Split positions are evaluated at the boundaries of this many bins
+const unsigned n_bins = 16;
+
+/* Nodes deeper than this are split at the median, which keeps the depth of the
+tree bounded even for unfortunate distributions. */
+const unsigned max_sah_depth = 48;
+
+/* Below max_sah_depth, each split halves the number of items, so no leaf is
+deeper than this.  Queries keep at most one node per level on their stacks,
+plus the root. */
+const unsigned max_depth = max_sah_depth+32;
+
+/* A box accumulated from the items falling into one bin.  This is cheaper than
+Bounds, which also maintains a sphere. */
+struct BinBox
+{
+	Vector low;
+	Vector high;
+	unsigned count;
+
+	BinBox();
+
+	void add(const Bounds &);
+	void add(const BinBox &);
+	float area() const;
+};
+
+/* Orders items by the centers of their boxes along an axis. */
+struct CenterLess
+{
+	const vector<Vector> &centers;
+	unsigned axis;
+
+	CenterLess(const vector<Vector> &c, unsigned a): centers(c), axis(a) { }
+
+	bool operator()(unsigned, unsigned) const;
+};
+
+/* Computes which bin the center of an item's box falls into. */
+struct CenterBin
+{
+	const vector<Vector> &centers;
+	unsigned axis;
+	float low;
+	float scale;
+
+	CenterBin(const vector<Vector> &c, unsigned a, float l, float s): centers(c), axis(a), low(l), scale(s) { }
+
+	unsigned operator()(unsigned) const;
+};
+
+/* Tells whether an item belongs to the left side of a split between bins. */
+struct LeftOfSplit
+{
+	const CenterBin &bin;
+	unsigned split;
+
+	LeftOfSplit(const CenterBin &b, unsigned s): bin(b), split(s) { }
+
+	bool operator()(unsigned i) const { return bin(i)<split; }
+};
+
+static float get_component(const Vector &, unsigned);
+static float surface_area(const Vector &, const Vector &);
+static float surface_area(const Bounds &);
+static bool intersects_sphere(const Bounds &, const Vector &, float);
+static bool intersects_ray(const Bounds &, const Vector &, const Vector &, float);
+
+BoundsTree::BoundsTree():
+	needs_rebuild(false),
+	area_sum(0),
+	built_cost(0),
+	rebuild_threshold(1.5f),
+	n_builds(0)
+{ }
+
+void BoundsTree::build(const vector<const Renderable *> &r)
+{
+	renderables = r;
+	items.clear();
+	nodes.clear();
+	unbounded.clear();
+	item_lookup.clear();
+	changed_items.clear();
+	needs_rebuild = false;
+	area_sum = 0;
+
+	vector<Bounds> item_bounds;
+	vector<Vector> centers;
+	vector<unsigned> order;
+	for(vector<const Renderable *>::const_iterator i=renderables.begin(); i!=renderables.end(); ++i)
+	{
+		Bounds bounds = (*i)->get_bounds();
+		if(bounds.is_infinite())
+		{
+			unbounded.push_back(*i);
+			continue;
+		}
+
+		Item item;
+		item.renderable = *i;
+		item.leaf = none;
+		item_lookup.insert(make_pair(*i, items.size()));
+		order.push_back(items.size());
+		items.push_back(item);
+		item_bounds.push_back(bounds);
+		centers.push_back((bounds.get_minimum()+bounds.get_maximum())*0.5f);
+	}
+
+	if(!order.empty())
+	{
+		nodes.reserve(order.size()*2-1);
+		build_node(order, 0, order.size(), item_bounds, centers, none, 0);
+	}
+	node_dirty.assign(nodes.size(), false);
+
+	built_cost = get_cost();
+	++n_builds;
+}
+
+unsigned BoundsTree::build_node(vector<unsigned> &order, unsigned begin, unsigned end, const vector<Bounds> &item_bounds, const vector<Vector> &centers, unsigned parent, unsigned depth)
+{
+	unsigned index = nodes.size();
+	nodes.push_back(Node());
+	nodes[index].parent = parent;
+	nodes[index].left = none;
+	nodes[index].right = none;
+	nodes[index].item = none;
+
+	if(end-begin==1)
+	{
+		unsigned item = order[begin];
+		nodes[index].item = item;
+		nodes[index].bounds = item_bounds[item];
+		items[item].leaf = index;
+		return index;
+	}
+
+	// Split along the axis where the centers are spread the most
+	Vector low(FLT_MAX, FLT_MAX, FLT_MAX);
+	Vector high(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for(unsigned i=begin; i<end; ++i)
+	{
+		const Vector &center = centers[order[i]];
+		low = Vector(min(low.x, center.x), min(low.y, center.y), min(low.z, center.z));
+		high = Vector(max(high.x, center.x), max(high.y, center.y), max(high.z, center.z));
+	}
+
+	Vector extent = high-low;
+	unsigned axis = (extent.x>=extent.y && extent.x>=extent.z ? 0 : extent.y>=extent.z ? 1 : 2);
+	float axis_extent = get_component(extent, axis);
+
+	// If all centers are at the same point, any split is as good as another
+	unsigned mid = (begin+end)/2;
+	if(axis_extent>0 && depth>=max_sah_depth)
+		nth_element(order.begin()+begin, order.begin()+mid, order.begin()+end, CenterLess(centers, axis));
+	else if(axis_extent>0)
+	{
+		CenterBin bin(centers, axis, get_component(low, axis), n_bins/axis_extent);
+		BinBox bins[n_bins];
+		for(unsigned i=begin; i<end; ++i)
+			bins[bin(order[i])].add(item_bounds[order[i]]);
+
+		/* The cost of a split is the surface area of each side times the
+		number of items on it.  The first and last bins always have items, so
+		both sides of every split are non-empty. */
+		float right_costs[n_bins];
+		BinBox right;
+		for(unsigned i=n_bins; --i>0; )
+		{
+			right.add(bins[i]);
+			right_costs[i] = right.area()*right.count;
+		}
+
+		BinBox left;
+		float best_cost = FLT_MAX;
+		unsigned best_split = 1;
+		for(unsigned i=1; i<n_bins; ++i)
+		{
+			left.add(bins[i-1]);
+			float cost = left.area()*left.count+right_costs[i];
+			if(cost<best_cost)
+			{
+				best_cost = cost;
+				best_split = i;
+			}
+		}
+
+		mid = partition(order.begin()+begin, order.begin()+end, LeftOfSplit(bin, best_split))-order.begin();
+	}
+
+	unsigned left = build_node(order, begin, mid, item_bounds, centers, index, depth+1);
+	unsigned right = build_node(order, mid, end, item_bounds, centers, index, depth+1);
+
+	// The vector may have been reallocated by the recursive calls
+	Node &node = nodes[index];
+	node.left = left;
+	node.right = right;
+	node.bounds = nodes[left].bounds;
+	node.bounds.extend(nodes[right].bounds);
+	area_sum += surface_area(node.bounds);
+
+	return index;
+}
+
+void BoundsTree::mark_changed(const Renderable &renderable)
+{
+	typedef multimap<const Renderable *, unsigned>::const_iterator Iter;
+	pair<Iter, Iter> range = item_lookup.equal_range(&renderable);
+	if(range.first==range.second)
+	{
+		// Unbounded Renderables may have become bounded
+		if(find(unbounded.begin(), unbounded.end(), &renderable)!=unbounded.end())
+			needs_rebuild = true;
+		return;
+	}
+
+	for(Iter i=range.first; i!=range.second; ++i)
+		changed_items.push_back(i->second);
+}
+
+void BoundsTree::update()
+{
+	/* Update the leaves first and collect the nodes above them.  Many leaves
+	share ancestors, and each of those only needs to be refitted once. */
+	dirty_nodes.clear();
+	for(vector<unsigned>::const_iterator i=changed_items.begin(); (!needs_rebuild && i!=changed_items.end()); ++i)
+	{
+		const Item &item = items[*i];
+		Bounds bounds = item.renderable->get_bounds();
+		if(bounds.is_infinite())
+		{
+			needs_rebuild = true;
+			break;
+		}
+
+		nodes[item.leaf].bounds = bounds;
+		for(unsigned j=nodes[item.leaf].parent; (j!=none && !node_dirty[j]); j=nodes[j].parent)
+		{
+			node_dirty[j] = true;
+			dirty_nodes.push_back(j);
+		}
+	}
+
+	bool refitted = !changed_items.empty();
+	changed_items.clear();
+
+	// Children come after their parent in the node array
+	sort(dirty_nodes.begin(), dirty_nodes.end());
+	for(vector<unsigned>::const_reverse_iterator i=dirty_nodes.rbegin(); i!=dirty_nodes.rend(); ++i)
+	{
+		Node &node = nodes[*i];
+		area_sum -= surface_area(node.bounds);
+		node.bounds = nodes[node.left].bounds;
+		node.bounds.extend(nodes[node.right].bounds);
+		area_sum += surface_area(node.bounds);
+		node_dirty[*i] = false;
+	}
+
+	if(needs_rebuild || (refitted && get_cost()>built_cost*rebuild_threshold))
+		build(renderables);
+}
+
+void BoundsTree::set_rebuild_threshold(float t)
+{
+	rebuild_threshold = t;
+}
+
+float BoundsTree::get_cost() const
+{
+	if(nodes.empty())
+		return 0;
+
+	float root_area = surface_area(nodes.front().bounds);
+	return (root_area>0 ? area_sum/root_area : 0);
+}
+
+void BoundsTree::query(const Frustum &frustum, vector<const Renderable *> &result, CullingStats &stats) const
+{
+	result.insert(result.end(), unbounded.begin(), unbounded.end());
+	if(nodes.empty())
+		return;
+
+	unsigned stack[max_depth+1];
+	unsigned stack_size = 1;
+	stack[0] = 0;
+	while(stack_size)
+	{
+		const Node &node = nodes[stack[--stack_size]];
+
+		++stats.tested;
+		if(!frustum.intersects(node.bounds))
+		{
+			++stats.culled;
+			continue;
+		}
+
+		// Everything below a node which is fully inside is visible as well
+		if(node.item!=none)
+			result.push_back(items[node.item].renderable);
+		else if(frustum.contains(node.bounds))
+		{
+			add_subtree(node.left, result);
+			add_subtree(node.right, result);
+		}
+		else
+		{
+			stack[stack_size++] = node.right;
+			stack[stack_size++] = node.left;
+		}
+	}
+}
+
+void BoundsTree::query(const Vector &center, float radius, vector<const Renderable *> &result) const
+{
+	result.insert(result.end(), unbounded.begin(), unbounded.end());
+	if(nodes.empty())
+		return;
+
+	unsigned stack[max_depth+1];
+	unsigned stack_size = 1;
+	stack[0] = 0;
+	while(stack_size)
+	{
+		const Node &node = nodes[stack[--stack_size]];
+
+		if(!intersects_sphere(node.bounds, center, radius))
+			continue;
+
+		if(node.item!=none)
+			result.push_back(items[node.item].renderable);
+		else
+		{
+			stack[stack_size++] = node.right;
+			stack[stack_size++] = node.left;
+		}
+	}
+}
+
+void BoundsTree::query_ray(const Vector &origin, const Vector &direction, float length, vector<const Renderable *> &result) const
+{
+	result.insert(result.end(), unbounded.begin(), unbounded.end());
+	if(nodes.empty())
+		return;
+
+	unsigned stack[max_depth+1];
+	unsigned stack_size = 1;
+	stack[0] = 0;
+	while(stack_size)
+	{
+		const Node &node = nodes[stack[--stack_size]];
+
+		if(!intersects_ray(node.bounds, origin, direction, length))
+			continue;
+
+		if(node.item!=none)
+			result.push_back(items[node.item].renderable);
+		else
+		{
+			stack[stack_size++] = node.right;
+			stack[stack_size++] = node.left;
+		}
+	}
+}
+
+void BoundsTree::add_subtree(unsigned index, vector<const Renderable *> &result) const
+{
+	const Node &node = nodes[index];
+	if(node.item!=none)
+		result.push_back(items[node.item].renderable);
+	else
+	{
+		add_subtree(node.left, result);
+		add_subtree(node.right, result);
+	}
+}
+
+
+BinBox::BinBox():
+	low(FLT_MAX, FLT_MAX, FLT_MAX),
+	high(-FLT_MAX, -FLT_MAX, -FLT_MAX),
+	count(0)
+{ }
+
+void BinBox::add(const Bounds &bounds)
+{
+	++count;
+	if(bounds.is_empty())
+		return;
+
+	const Vector &l = bounds.get_minimum();
+	const Vector &h = bounds.get_maximum();
+	low = Vector(min(low.x, l.x), min(low.y, l.y), min(low.z, l.z));
+	high = Vector(max(high.x, h.x), max(high.y, h.y), max(high.z, h.z));
+}
+
+void BinBox::add(const BinBox &other)
+{
+	count += other.count;
+	low = Vector(min(low.x, other.low.x), min(low.y, other.low.y), min(low.z, other.low.z));
+	high = Vector(max(high.x, other.high.x), max(high.y, other.high.y), max(high.z, other.high.z));
+}
+
+float BinBox::area() const
+{
+	return (low.x<=high.x ? surface_area(low, high) : 0);
+}
+
+
+bool CenterLess::operator()(unsigned i, unsigned j) const
+{
+	return get_component(centers[i], axis)<get_component(centers[j], axis);
+}
+
+
+unsigned CenterBin::operator()(unsigned i) const
+{
+	// The largest center would fall just past the last bin
+	unsigned index = static_cast<unsigned>((get_component(centers[i], axis)-low)*scale);
+	return min(index, n_bins-1);
+}
+
+
+float get_component(const Vector &v, unsigned axis)
+{
+	return (axis==0 ? v.x : axis==1 ? v.y : v.z);
+}
+
+float surface_area(const Vector &low, const Vector &high)
+{
+	Vector size = high-low;
+	return 2*(size.x*size.y+size.y*size.z+size.z*size.x);
+}
+
+float surface_area(const Bounds &bounds)
+{
+	if(bounds.is_empty() || bounds.is_infinite())
+		return 0;
+	return surface_area(bounds.get_minimum(), bounds.get_maximum());
+}
+
+bool intersects_sphere(const Bounds &bounds, const Vector &center, float radius)
+{
+	if(bounds.is_empty())
+		return false;
+
+	// Find the point of the box closest to the center
+	const Vector &low = bounds.get_minimum();
+	const Vector &high = bounds.get_maximum();
+	Vector closest(max(low.x, min(center.x, high.x)), max(low.y, min(center.y, high.y)), max(low.z, min(center.z, high.z)));
+	Vector offset = closest-center;
+	return offset.dot(offset)<=radius*radius;
+}
+
+bool intersects_ray(const Bounds &bounds, const Vector &origin, const Vector &direction, float length)
+{
+	if(bounds.is_empty())
+		return false;
+
+	/* Clip the ray against the slabs between the planes of each axis.  The ray
+	hits the box if some part of it is left. */
+	float enter = 0;
+	float leave = length;
+	for(unsigned i=0; i<3; ++i)
+	{
+		float o = get_component(origin, i);
+		float d = get_component(direction, i);
+		float low = get_component(bounds.get_minimum(), i);
+		float high = get_component(bounds.get_maximum(), i);
+		if(d==0)
+		{
+			if(o<low || o>high)
+				return false;
+			continue;
+		}
+
+		float t1 = (low-o)/d;
+		float t2 = (high-o)/d;
+		enter = max(enter, min(t1, t2));
+		leave = min(leave, max(t1, t2));
+		if(enter>leave)
+			return false;
+	}
+
+	return true;
+}
+
+} // namespace SkrolliGL
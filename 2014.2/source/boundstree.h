@@ -0,0 +1,105 @@
+#ifndef SKROLLIGL_BOUNDSTREE_H_
+#define SKROLLIGL_BOUNDSTREE_H_
+
+#include <map>
+#include <vector>
+#include "mathutils.h"
+#include "renderable.h"
+
+namespace SkrolliGL {
+
+/*
+A bounding volume hierarchy over a set of Renderables.  Each Renderable is a
+leaf with its bounds, and each internal node has the combined bounds of its two
+children.  Queries skip whole subtrees whose bounds they miss, so finding a few
+Renderables among many takes logarithmic time.
+
+The tree is built top-down, splitting each node where the surface area
+heuristic predicts the cheapest queries.  When Renderables move, only their
+leaves and the nodes above them are refitted and the structure stays the same.
+Refitting can make the tree much worse than a fresh build would be, so its cost
+is tracked and the tree is rebuilt once the cost has grown by the rebuild
+threshold.
+
+Renderables with infinite bounds are kept outside the tree and are returned by
+every query.
+*/
+class BoundsTree
+{
+private:
+	struct Node
+	{
+		Bounds bounds;
+		unsigned parent;
+		unsigned left;
+		unsigned right;
+		unsigned item;
+	};
+
+	struct Item
+	{
+		const Renderable *renderable;
+		unsigned leaf;
+	};
+
+	std::vector<const Renderable *> renderables;
+	std::vector<Item> items;
+	std::vector<Node> nodes;
+	std::vector<const Renderable *> unbounded;
+	std::multimap<const Renderable *, unsigned> item_lookup;
+	std::vector<unsigned> changed_items;
+	std::vector<bool> node_dirty;
+	std::vector<unsigned> dirty_nodes;
+	bool needs_rebuild;
+	float area_sum;
+	float built_cost;
+	float rebuild_threshold;
+	unsigned n_builds;
+
+public:
+	BoundsTree();
+
+	/* Builds the tree over a set of Renderables, using their current bounds.
+	A Renderable may appear more than once. */
+	void build(const std::vector<const Renderable *> &);
+
+	/* Records that the bounds of a Renderable in the tree have changed.  The
+	tree is refitted on the next call to update. */
+	void mark_changed(const Renderable &);
+
+	/* Refits the leaves of changed Renderables and the nodes above them, and
+	rebuilds the tree if it has degraded too much. */
+	void update();
+
+	/* Sets how much the cost may grow relative to the last build before the
+	tree is rebuilt.  The default is 1.5, or 50% growth. */
+	void set_rebuild_threshold(float);
+
+	/* Returns the surface area heuristic cost of the tree: the total surface
+	area of internal nodes relative to the root.  Lower is better. */
+	float get_cost() const;
+
+	/* Returns how many times the tree has been built, including rebuilds. */
+	unsigned get_build_count() const { return n_builds; }
+
+	/* Finds the Renderables whose bounds may intersect a frustum.  The tests
+	made on nodes are added to the culling statistics. */
+	void query(const Frustum &, std::vector<const Renderable *> &, CullingStats &) const;
+
+	/* Finds the Renderables whose bounding boxes intersect a sphere, given by
+	its center and radius. */
+	void query(const Vector &, float, std::vector<const Renderable *> &) const;
+
+	/* Finds the Renderables whose bounding boxes are hit by a ray.  The ray is
+	given by its origin and direction, and ends at the given multiple of the
+	direction. */
+	void query_ray(const Vector &, const Vector &, float, std::vector<const Renderable *> &) const;
+
+private:
+	unsigned build_node(std::vector<unsigned> &, unsigned, unsigned, const std::vector<Bounds> &, const std::vector<Vector> &, unsigned, unsigned);
+	void add_subtree(unsigned, std::vector<const Renderable *> &) const;
+};
+
+} // namespace SkrolliGL
+
+#endif
@@ -7,15 +7,25 @@
 #include "camera.h"
 #include "engine.h"
 #include "framebuffer.h"
+#include "glstate.h"
+#include "jobpool.h"
+#include "object.h"
+#include "occlusionbuffer.h"
 #include "postprocessor.h"
 #include "renderable.h"
+#include "renderqueue.h"
 #include "rotationanimation.h"
+#include "shader.h"
 #include "translationanimation.h"
 
 using namespace std;
 
 namespace SkrolliGL {
 
+/* Width of the occlusion buffer in pixels.  The height follows the aspect ratio
+of the window. */
+const unsigned occlusion_buffer_width = 256;
+
 Engine::Engine()
 {
 	init(800, 600);
@@ -35,6 +45,8 @@ void Engine::init(unsigned width, unsigned height)
 	scene_root = 0;
 	camera = 0;
 	last_frame = 0;
+	occlusion_buffer = 0;
+	job_pool = 0;
 
 	SDL_Init(SDL_INIT_VIDEO);
 	IMG_Init(IMG_INIT_PNG);
@@ -72,8 +84,15 @@ void Engine::init(unsigned width, unsigned height)
 	glDepthFunc(GL_LEQUAL);
 	glEnable(GL_DEPTH_TEST);
 
-	glEnable(GL_PRIMITIVE_RESTART);
-	glPrimitiveRestartIndex(0xFFFFFFFF);
+	/* Objects may use 16-bit or 32-bit indices.  If possible, use the largest
+	value of each type as the restart index so they can be mixed freely. */
+	if(Object::fixed_restart_index_supported())
+		glEnable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+	else
+	{
+		glEnable(GL_PRIMITIVE_RESTART);
+		glPrimitiveRestartIndex(0xFFFFFFFF);
+	}
 
 	err = glGetError();
 	if(err!=GL_NO_ERROR)
@@ -90,6 +109,8 @@ Engine::~Engine()
 {
 	for(list<Animation *>::iterator i=animations.begin(); i!=animations.end(); ++i)
 		delete *i;
+	delete occlusion_buffer;
+	delete job_pool;
 }
 
 void Engine::set_event_listener(EventListener *l)
@@ -157,9 +178,43 @@ void Engine::remove_postprocessor(Postprocessor &pp)
 		postprocessors.erase(i);
 }
 
+void Engine::set_occlusion_culling(bool enable)
+{
+	if(enable && !occlusion_buffer)
+	{
+		int width, height;
+		SDL_GetWindowSize(window, &width, &height);
+		occlusion_buffer = new OcclusionBuffer(occlusion_buffer_width, occlusion_buffer_width*height/width);
+	}
+
+	render_queue.set_occlusion_buffer(enable ? occlusion_buffer : 0);
+}
+
+void Engine::set_depth_prepass(bool enable)
+{
+	render_queue.set_depth_prepass(enable);
+}
+
+void Engine::set_collect_threads(unsigned threads)
+{
+	delete job_pool;
+	job_pool = new JobPool(threads);
+
+	// A single thread is better off without the overhead of jobs
+	if(job_pool->get_thread_count()<=1)
+	{
+		delete job_pool;
+		job_pool = 0;
+	}
+
+	render_queue.set_job_pool(job_pool);
+}
+
 bool Engine::next_frame()
 {
 	bool result = true;
+	GLState::reset_stats();
+	Shader::reset_uniform_stats();
 
 	// Check for events
 	SDL_PumpEvents();
@@ -220,6 +275,7 @@ bool Engine::next_frame()
 	glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 
 	// Render the scene if we have one
+	render_queue.clear();
 	if(scene_root)
 	{
 		RenderState state;
@@ -232,7 +288,18 @@ bool Engine::next_frame()
 		state.light_direction = state.modelview_matrix.transform_direction(light_direction);
 		state.light_intensity = light_intensity;
 		state.ambient_intensity = ambient_intensity;
-		scene_root->render(state);
+
+		/* Walk the scene once to find what's visible, then draw it in sorted
+		order.  Getting the bounds of the root brings all cached bounds up to
+		date before any jobs start. */
+		render_queue.set_projection_matrix(state.projection_matrix);
+		render_queue.set_view_matrix(state.modelview_matrix);
+		if(render_queue.is_visible(Frustum(render_queue.get_view_projection_matrix()), scene_root->get_bounds()))
+			scene_root->collect(render_queue, WorldTransform());
+		render_queue.join();
+		render_queue.cull_occluded();
+		render_queue.sort();
+		render_queue.render(state);
 	}
 
 	// Apply any postprocessors we may have
@@ -246,6 +313,8 @@ bool Engine::next_frame()
 
 	// Make the new frame visible
 	SDL_GL_SwapWindow(window);
+	gl_state_stats = GLState::get_stats();
+	uniform_stats = Shader::get_uniform_stats();
 
 	int err = glGetError();
 	if(err!=GL_NO_ERROR)
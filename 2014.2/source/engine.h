@@ -4,12 +4,17 @@
 #include <list>
 #include <SDL.h>
 #include "animation.h"
+#include "glstate.h"
+#include "renderqueue.h"
+#include "shader.h"
 
 namespace SkrolliGL {
 
 class Camera;
 class EventListener;
 class Instance;
+class JobPool;
+class OcclusionBuffer;
 class Postprocessor;
 class Renderable;
 
@@ -30,6 +35,11 @@ private:
 	std::list<Animation *> animations;
 	unsigned last_frame;
 	std::list<Postprocessor *> postprocessors;
+	RenderQueue render_queue;
+	OcclusionBuffer *occlusion_buffer;
+	JobPool *job_pool;
+	GLStateStats gl_state_stats;
+	UniformStats uniform_stats;
 
 public:
 	Engine();
@@ -85,6 +95,40 @@ public:
 
 	void remove_postprocessor(Postprocessor &);
 
+	/* Enables or disables occlusion culling.  Objects marked as occluders are
+	drawn into a small depth buffer on the CPU, and Objects hidden behind them
+	are not drawn.  Disabled by default. */
+	void set_occlusion_culling(bool);
+
+	/* Enables or disables the depth pre-pass.  Opaque Objects whose shaders
+	have depth-only variants are first drawn into the depth buffer alone, front
+	to back, and then shaded with an equal depth test.  This pays off when
+	fragment shading is expensive and surfaces overlap a lot.  Disabled by
+	default. */
+	void set_depth_prepass(bool);
+
+	/* Sets the number of threads used to walk the scene and cull it.  Large
+	Groups are split into jobs which are run by a JobPool.  The results are
+	merged and drawn on the thread of the GL context, which takes part in the
+	work as well.  Zero means one thread per CPU core.  The default is one,
+	which collects everything on the calling thread. */
+	void set_collect_threads(unsigned);
+
+	/* Returns the view frustum and occlusion culling results of the latest
+	frame.  The scene root counts as one tested Renderable. */
+	const CullingStats &get_culling_stats() const { return render_queue.get_culling_stats(); }
+
+	/* Returns the items drawn in the latest frame. */
+	const RenderQueue &get_render_queue() const { return render_queue; }
+
+	/* Returns how many binding calls the latest frame issued to OpenGL and how
+	many were skipped as redundant. */
+	const GLStateStats &get_gl_state_stats() const { return gl_state_stats; }
+
+	/* Returns how many uniform values the latest frame uploaded to OpenGL and
+	how many were skipped as unchanged. */
+	const UniformStats &get_uniform_stats() const { return uniform_stats; }
+
 	/* Receives events and renders the next frame.  This should be called
 	regularly from the main loop of the program.  Returns false if a quit event
 	was received, true otherwise. */
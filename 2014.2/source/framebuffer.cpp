@@ -1,5 +1,6 @@
 #include <GL/glew.h>
 #include "framebuffer.h"
+#include "glstate.h"
 
 namespace SkrolliGL {
 
@@ -11,7 +12,7 @@ Framebuffer::Framebuffer(unsigned w, unsigned h):
 	depth_buf_id(0)
 {
 	glGenFramebuffers(1, &id);
-	glBindFramebuffer(GL_FRAMEBUFFER, id);
+	GLState::bind_framebuffer(id);
 
 	color_tex.create(width, height, Texture::RGB);
 	color_tex.set_wrap(false);
@@ -20,6 +21,7 @@ Framebuffer::Framebuffer(unsigned w, unsigned h):
 
 Framebuffer::~Framebuffer()
 {
+	GLState::forget_framebuffer(id);
 	glDeleteFramebuffers(1, &id);
 	if(depth_buf_id)
 		glDeleteRenderbuffers(1, &depth_buf_id);
@@ -51,13 +53,13 @@ void Framebuffer::bind()
 	if(!system_viewport[2])
 		glGetIntegerv(GL_VIEWPORT, system_viewport);
 
-	glBindFramebuffer(GL_FRAMEBUFFER, id);
+	GLState::bind_framebuffer(id);
 	glViewport(0, 0, width, height);
 }
 
 void Framebuffer::unbind()
 {
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	GLState::bind_framebuffer(0);
 	glViewport(system_viewport[0], system_viewport[1], system_viewport[2], system_viewport[3]);
 }
 
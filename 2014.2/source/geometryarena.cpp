@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <GL/glew.h>
+#include "geometryarena.h"
+#include "glstate.h"
+
+using namespace std;
+
+namespace SkrolliGL {
+
+/* Buffers never grow by less than this many elements.  Small meshes are
+common, and each growth copies the whole buffer. */
+const unsigned min_growth = 0x10000;
+
+GeometryArena::GeometryArena(unsigned vertex_size, const vector<Attribute> &attribs, unsigned index_size):
+	attributes(attribs),
+	vertex_buffer(vertex_size),
+	index_buffer(index_size)
+{
+	glGenVertexArrays(1, &vertex_array_id);
+}
+
+GeometryArena::~GeometryArena()
+{
+	GLState::forget_vertex_array(vertex_array_id);
+	glDeleteVertexArrays(1, &vertex_array_id);
+	if(vertex_buffer.id)
+		glDeleteBuffers(1, &vertex_buffer.id);
+	if(index_buffer.id)
+		glDeleteBuffers(1, &index_buffer.id);
+}
+
+unsigned GeometryArena::allocate_vertices(unsigned count)
+{
+	return allocate(vertex_buffer, count);
+}
+
+unsigned GeometryArena::allocate_indices(unsigned count)
+{
+	return allocate(index_buffer, count);
+}
+
+void GeometryArena::free_vertices(unsigned first, unsigned count)
+{
+	free(vertex_buffer, first, count);
+}
+
+void GeometryArena::free_indices(unsigned first, unsigned count)
+{
+	free(index_buffer, first, count);
+}
+
+void GeometryArena::write_vertices(unsigned first, unsigned count, const void *data)
+{
+	write(vertex_buffer, first, count, data);
+}
+
+void GeometryArena::write_indices(unsigned first, unsigned count, const void *data)
+{
+	write(index_buffer, first, count, data);
+}
+
+void GeometryArena::read_vertices(unsigned first, unsigned count, void *data) const
+{
+	read(vertex_buffer, first, count, data);
+}
+
+void GeometryArena::read_indices(unsigned first, unsigned count, void *data) const
+{
+	read(index_buffer, first, count, data);
+}
+
+unsigned GeometryArena::allocate(Buffer &buffer, unsigned count)
+{
+	if(!count)
+		return 0;
+
+	// Take the first free range which is large enough
+	map<unsigned, unsigned>::iterator i = buffer.free_ranges.begin();
+	for(; (i!=buffer.free_ranges.end() && i->second<count); ++i) ;
+	if(i==buffer.free_ranges.end())
+	{
+		// Growing leaves a free range at the end which is large enough
+		grow(buffer, count);
+		i = buffer.free_ranges.end();
+		--i;
+	}
+
+	unsigned first = i->first;
+	unsigned remaining = i->second-count;
+	buffer.free_ranges.erase(i);
+	if(remaining)
+		buffer.free_ranges[first+count] = remaining;
+	buffer.used += count;
+
+	return first;
+}
+
+void GeometryArena::free(Buffer &buffer, unsigned first, unsigned count)
+{
+	if(!count)
+		return;
+
+	buffer.used -= count;
+	map<unsigned, unsigned>::iterator i = buffer.free_ranges.insert(make_pair(first, count)).first;
+
+	// Merge with the following and preceding ranges if they're adjacent
+	map<unsigned, unsigned>::iterator next = i;
+	++next;
+	if(next!=buffer.free_ranges.end() && i->first+i->second==next->first)
+	{
+		i->second += next->second;
+		buffer.free_ranges.erase(next);
+	}
+
+	if(i!=buffer.free_ranges.begin())
+	{
+		map<unsigned, unsigned>::iterator prev = i;
+		--prev;
+		if(prev->first+prev->second==i->first)
+		{
+			prev->second += i->second;
+			buffer.free_ranges.erase(i);
+		}
+	}
+}
+
+void GeometryArena::grow(Buffer &buffer, unsigned count)
+{
+	unsigned old_capacity = buffer.capacity;
+	buffer.capacity = max(old_capacity+max(count, min_growth), old_capacity*2);
+
+	/* The copy targets don't affect any other state, so they can be used
+	without disturbing the vertex array or the attribute buffer. */
+	unsigned new_id;
+	glGenBuffers(1, &new_id);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, new_id);
+	glBufferData(GL_COPY_WRITE_BUFFER, buffer.capacity*buffer.element_size, 0, GL_STATIC_DRAW);
+	if(buffer.id)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, buffer.id);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, old_capacity*buffer.element_size);
+		glDeleteBuffers(1, &buffer.id);
+	}
+	buffer.id = new_id;
+
+	// The new space joins a free range at the end of the old space, if any
+	unsigned first = old_capacity;
+	if(!buffer.free_ranges.empty())
+	{
+		map<unsigned, unsigned>::iterator last = buffer.free_ranges.end();
+		--last;
+		if(last->first+last->second==old_capacity)
+		{
+			first = last->first;
+			buffer.free_ranges.erase(last);
+		}
+	}
+	buffer.free_ranges[first] = buffer.capacity-first;
+
+	set_up_vertex_array();
+}
+
+void GeometryArena::write(const Buffer &buffer, unsigned first, unsigned count, const void *data)
+{
+	if(!count)
+		return;
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer.id);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, first*buffer.element_size, count*buffer.element_size, data);
+}
+
+void GeometryArena::read(const Buffer &buffer, unsigned first, unsigned count, void *data) const
+{
+	if(!count)
+		return;
+
+	glBindBuffer(GL_COPY_READ_BUFFER, buffer.id);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, first*buffer.element_size, count*buffer.element_size, data);
+}
+
+void GeometryArena::set_up_vertex_array()
+{
+	// Both buffers must exist before the vertex array can refer to them
+	if(!vertex_buffer.id || !index_buffer.id)
+		return;
+
+	GLState::bind_vertex_array(vertex_array_id);
+
+	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer.id);
+	for(vector<Attribute>::const_iterator i=attributes.begin(); i!=attributes.end(); ++i)
+	{
+		glVertexAttribPointer(i->index, i->size, i->type, i->normalized, vertex_buffer.element_size, reinterpret_cast<void *>(i->offset));
+		glEnableVertexAttribArray(i->index);
+	}
+
+	// The index buffer binding is part of the vertex array object
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer.id);
+}
+
+
+GeometryArena::Buffer::Buffer(unsigned size):
+	id(0),
+	element_size(size),
+	capacity(0),
+	used(0)
+{ }
+
+} // namespace SkrolliGL
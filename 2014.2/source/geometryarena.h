@@ -0,0 +1,100 @@
+#ifndef SKROLLIGL_GEOMETRYARENA_H_
+#define SKROLLIGL_GEOMETRYARENA_H_
+
+#include <map>
+#include <vector>
+
+namespace SkrolliGL {
+
+/*
+Holds the vertices and indices of many meshes in one vertex buffer and one
+index buffer, behind a single vertex array object.  All meshes in an arena must
+have the same vertex layout and index size.
+
+Meshes get ranges of vertices and indices from the arena.  Indices are relative
+to the first vertex of the mesh, which is passed to draw calls as the base
+vertex.  Since every mesh uses the same vertex array, consecutive draws don't
+need to bind anything and can be submitted with a single multi-draw call.
+
+The buffers grow as needed.  Growing copies the old contents into larger
+buffers on the GPU, so allocated ranges keep their positions.
+*/
+class GeometryArena
+{
+public:
+	/* Describes one vertex attribute, with the parameters given to
+	glVertexAttribPointer.  The offset is in bytes from the start of a vertex. */
+	struct Attribute
+	{
+		unsigned index;
+		unsigned size;
+		unsigned type;
+		bool normalized;
+		unsigned offset;
+
+		Attribute(unsigned i, unsigned s, unsigned t, bool n, unsigned o): index(i), size(s), type(t), normalized(n), offset(o) { }
+	};
+
+private:
+	/* A GPU buffer and the ranges in it which are not in use.  Sizes are
+	counted in elements, not bytes. */
+	struct Buffer
+	{
+		unsigned id;
+		unsigned element_size;
+		unsigned capacity;
+		unsigned used;
+		std::map<unsigned, unsigned> free_ranges;
+
+		Buffer(unsigned);
+	};
+
+	unsigned vertex_array_id;
+	std::vector<Attribute> attributes;
+	Buffer vertex_buffer;
+	Buffer index_buffer;
+
+	GeometryArena(const GeometryArena &);
+	GeometryArena &operator=(const GeometryArena &);
+public:
+	/* Creates an empty arena for vertices of the given size in bytes, with the
+	given attributes, and indices of 2 or 4 bytes. */
+	GeometryArena(unsigned, const std::vector<Attribute> &, unsigned);
+	~GeometryArena();
+
+	unsigned get_vertex_array() const { return vertex_array_id; }
+	unsigned get_vertex_size() const { return vertex_buffer.element_size; }
+	unsigned get_index_size() const { return index_buffer.element_size; }
+
+	/* Reserves a range of vertices or indices and returns the first element of
+	it.  The contents of a new range are undefined. */
+	unsigned allocate_vertices(unsigned);
+	unsigned allocate_indices(unsigned);
+
+	/* Returns a range to the arena.  The first element and count must be the
+	same as when the range was allocated. */
+	void free_vertices(unsigned, unsigned);
+	void free_indices(unsigned, unsigned);
+
+	/* Copies data to or from a range.  The first element and count may
+	describe any part of an allocated range. */
+	void write_vertices(unsigned, unsigned, const void *);
+	void write_indices(unsigned, unsigned, const void *);
+	void read_vertices(unsigned, unsigned, void *) const;
+	void read_indices(unsigned, unsigned, void *) const;
+
+	/* Indicates whether all ranges have been freed. */
+	bool empty() const { return !vertex_buffer.used && !index_buffer.used; }
+
+private:
+	unsigned allocate(Buffer &, unsigned);
+	void free(Buffer &, unsigned, unsigned);
+	void grow(Buffer &, unsigned);
+	void write(const Buffer &, unsigned, unsigned, const void *);
+	void read(const Buffer &, unsigned, unsigned, void *) const;
+	void set_up_vertex_array();
+};
+
+} // namespace SkrolliGL
+
+#endif
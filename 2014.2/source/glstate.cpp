@@ -0,0 +1,125 @@
+#include <GL/glew.h>
+#include "glstate.h"
+
+namespace SkrolliGL {
+
+// Object names are never this large, so it means the binding is unknown
+const unsigned unknown = 0xFFFFFFFF;
+
+unsigned GLState::program = unknown;
+unsigned GLState::active_unit = unknown;
+unsigned GLState::textures[MAX_TEXTURE_UNITS] = { unknown, unknown, unknown, unknown, unknown, unknown, unknown, unknown, unknown, unknown, unknown, unknown, unknown, unknown, unknown, unknown };
+unsigned GLState::vertex_array = unknown;
+unsigned GLState::framebuffer = unknown;
+GLStateStats GLState::stats;
+
+void GLState::use_program(unsigned id)
+{
+	if(id==program)
+	{
+		++stats.skipped;
+		return;
+	}
+
+	glUseProgram(id);
+	program = id;
+	++stats.issued;
+}
+
+void GLState::active_texture(unsigned unit)
+{
+	if(unit==active_unit)
+	{
+		++stats.skipped;
+		return;
+	}
+
+	glActiveTexture(GL_TEXTURE0+unit);
+	active_unit = unit;
+	++stats.issued;
+}
+
+void GLState::bind_texture(unsigned id)
+{
+	unsigned *shadow = (active_unit<MAX_TEXTURE_UNITS ? &textures[active_unit] : 0);
+	if(shadow && id==*shadow)
+	{
+		++stats.skipped;
+		return;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, id);
+	if(shadow)
+		*shadow = id;
+	++stats.issued;
+}
+
+void GLState::bind_vertex_array(unsigned id)
+{
+	if(id==vertex_array)
+	{
+		++stats.skipped;
+		return;
+	}
+
+	glBindVertexArray(id);
+	vertex_array = id;
+	++stats.issued;
+}
+
+void GLState::bind_framebuffer(unsigned id)
+{
+	if(id==framebuffer)
+	{
+		++stats.skipped;
+		return;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, id);
+	framebuffer = id;
+	++stats.issued;
+}
+
+void GLState::forget_program(unsigned id)
+{
+	/* A deleted program stays in use until another one is bound, but its name
+	could be handed out again once that happens. */
+	if(id==program)
+		program = unknown;
+}
+
+void GLState::forget_texture(unsigned id)
+{
+	for(unsigned i=0; i<MAX_TEXTURE_UNITS; ++i)
+		if(textures[i]==id)
+			textures[i] = 0;
+}
+
+void GLState::forget_vertex_array(unsigned id)
+{
+	if(id==vertex_array)
+		vertex_array = 0;
+}
+
+void GLState::forget_framebuffer(unsigned id)
+{
+	if(id==framebuffer)
+		framebuffer = 0;
+}
+
+void GLState::invalidate()
+{
+	program = unknown;
+	active_unit = unknown;
+	for(unsigned i=0; i<MAX_TEXTURE_UNITS; ++i)
+		textures[i] = unknown;
+	vertex_array = unknown;
+	framebuffer = unknown;
+}
+
+void GLState::reset_stats()
+{
+	stats = GLStateStats();
+}
+
+} // namespace SkrolliGL
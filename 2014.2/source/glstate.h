@@ -0,0 +1,71 @@
+#ifndef SKROLLIGL_GLSTATE_H_
+#define SKROLLIGL_GLSTATE_H_
+
+namespace SkrolliGL {
+
+/*
+Counts binding calls which went through GLState.  Issued calls reached OpenGL,
+skipped ones would not have changed anything.
+*/
+struct GLStateStats
+{
+	unsigned issued;
+	unsigned skipped;
+
+	GLStateStats(): issued(0), skipped(0) { }
+};
+
+/*
+Shadows the OpenGL bindings the engine changes most often, and skips calls
+which would set them to the value they already have.  All code which binds
+programs, textures, vertex arrays or framebuffers should go through this class,
+or call invalidate() afterwards so the shadowed state can't go stale.
+
+There is only one OpenGL context, so the state is static.
+*/
+class GLState
+{
+public:
+	/* Texture units above this are not shadowed and are always bound. */
+	enum { MAX_TEXTURE_UNITS = 16 };
+
+private:
+	static unsigned program;
+	static unsigned active_unit;
+	static unsigned textures[MAX_TEXTURE_UNITS];
+	static unsigned vertex_array;
+	static unsigned framebuffer;
+	static GLStateStats stats;
+
+	GLState();
+
+public:
+	/* Equivalents of the corresponding OpenGL calls.  Texture units are given
+	as numbers, not GL_TEXTUREn enums. */
+	static void use_program(unsigned);
+	static void active_texture(unsigned);
+	static void bind_texture(unsigned);
+	static void bind_vertex_array(unsigned);
+	static void bind_framebuffer(unsigned);
+
+	/* Binds a texture to a unit, making it the active unit. */
+	static void bind_texture(unsigned unit, unsigned id) { active_texture(unit); bind_texture(id); }
+
+	/* These must be called when objects are deleted.  OpenGL unbinds deleted
+	objects and may reuse their names. */
+	static void forget_program(unsigned);
+	static void forget_texture(unsigned);
+	static void forget_vertex_array(unsigned);
+	static void forget_framebuffer(unsigned);
+
+	/* Marks all shadowed state as unknown.  The next call of each kind will be
+	issued. */
+	static void invalidate();
+
+	static const GLStateStats &get_stats() { return stats; }
+	static void reset_stats();
+};
+
+} // namespace SkrolliGL
+
+#endif
@@ -1,28 +1,221 @@
 #include <algorithm>
 #include <fstream>
+#include <map>
 #include <sstream>
+#include "boundstree.h"
 #include "group.h"
 #include "instance.h"
+#include "jobpool.h"
 #include "object.h"
+#include "primitivebuilder.h"
+#include "renderqueue.h"
 
 using namespace std;
 
 namespace SkrolliGL {
 
+/* Groups with fewer contents to collect than twice this are collected on the
+calling thread.  Smaller jobs would cost more to set up and merge than they
+gain. */
+const unsigned min_job_contents = 64;
+
+/* Contents are split into at most this many jobs per thread, which leaves some
+for idle threads to steal. */
+const unsigned jobs_per_thread = 4;
+
+// A submesh of an Instance to be copied into a merged Object
+struct MergedCopy
+{
+	const Instance *instance;
+	const Object *object;
+	Object::SubMesh submesh;
+};
+
+static void collect_contents(RenderQueue &, const WorldTransform &, const Frustum *, vector<const Renderable *>::const_iterator, vector<const Renderable *>::const_iterator);
+
+Group::Group():
+	merged_memory(0),
+	bounds_dirty(true),
+	bounds_tree(0),
+	tree_outdated(false),
+	tree_lock(0)
+{ }
+
 Group::~Group()
 {
+	// Renderable unlinks the contents which the Group doesn't own
 	for(vector<Instance *>::iterator i=instances.begin(); i!=instances.end(); ++i)
 		delete *i;
+	for(vector<Object *>::iterator i=merged_objects.begin(); i!=merged_objects.end(); ++i)
+		delete *i;
+	delete bounds_tree;
 }
 
 void Group::add(const Renderable &r)
 {
 	contents.push_back(&r);
+	r.add_parent(*this);
+	tree_outdated = true;
+	child_bounds_changed(r);
 }
 
 void Group::remove(const Renderable &r)
 {
-	contents.erase(std::remove(contents.begin(), contents.end(), &r), contents.end());
+	vector<const Renderable *>::iterator end = std::remove(contents.begin(), contents.end(), &r);
+	for(vector<const Renderable *>::iterator i=end; i!=contents.end(); ++i)
+		r.remove_parent(*this);
+	contents.erase(end, contents.end());
+	tree_outdated = true;
+	child_bounds_changed(r);
+}
+
+void Group::set_use_bounds_tree(bool use)
+{
+	if(use==(bounds_tree!=0))
+		return;
+
+	delete bounds_tree;
+	bounds_tree = (use ? new BoundsTree : 0);
+	tree_outdated = true;
+}
+
+const BoundsTree *Group::get_bounds_tree() const
+{
+	if(!bounds_tree)
+		return 0;
+
+	/* The first thread to get here in a frame does the update.  The others
+	wait for it and find nothing left to do. */
+	SDL_AtomicLock(&tree_lock);
+	if(tree_outdated)
+	{
+		bounds_tree->build(contents);
+		tree_outdated = false;
+	}
+	else
+		bounds_tree->update();
+	SDL_AtomicUnlock(&tree_lock);
+
+	return bounds_tree;
+}
+
+void Group::merge_instances(const vector<const Instance *> &to_merge)
+{
+	// Collect the submeshes to copy, grouped by Material in order of appearance
+	vector<Material *> materials;
+	map<Material *, vector<MergedCopy> > copies;
+	bool strips = true;
+	for(vector<const Instance *>::const_iterator i=to_merge.begin(); i!=to_merge.end(); ++i)
+	{
+		const Object *object = dynamic_cast<const Object *>(&(*i)->get_renderable());
+		if(!object || find(contents.begin(), contents.end(), *i)==contents.end())
+			continue;
+
+		const vector<Object::SubMesh> &submeshes = object->get_submeshes();
+		for(vector<Object::SubMesh>::const_iterator j=submeshes.begin(); j!=submeshes.end(); ++j)
+		{
+			vector<MergedCopy> &material_copies = copies[j->material];
+			if(material_copies.empty())
+				materials.push_back(j->material);
+
+			MergedCopy copy;
+			copy.instance = *i;
+			copy.object = object;
+			copy.submesh = *j;
+			material_copies.push_back(copy);
+		}
+
+		if(object->get_primitive_type()!=Object::TRIANGLE_STRIP)
+			strips = false;
+		remove(**i);
+	}
+
+	if(materials.empty())
+		return;
+
+	/* Strips can be joined with restart indices.  If there are any lists, the
+	strips are converted to lists as well. */
+	vector<Object::Vertex> vertices;
+	vector<unsigned> indices;
+	vector<Object::SubMesh> ranges;
+	map<const Object *, pair<vector<Object::Vertex>, vector<unsigned> > > object_data;
+	vector<unsigned> remap;
+	for(vector<Material *>::const_iterator i=materials.begin(); i!=materials.end(); ++i)
+	{
+		Object::SubMesh range;
+		range.material = *i;
+		range.first = indices.size();
+
+		const vector<MergedCopy> &material_copies = copies[*i];
+		for(vector<MergedCopy>::const_iterator j=material_copies.begin(); j!=material_copies.end(); ++j)
+		{
+			// Each Object is read back from the GPU only once
+			pair<vector<Object::Vertex>, vector<unsigned> > &data = object_data[j->object];
+			if(data.second.empty())
+				j->object->get_data(data.first, data.second);
+
+			const Matrix &matrix = j->instance->get_matrix();
+			remap.assign(data.first.size(), 0xFFFFFFFF);
+			vector<unsigned> copy_indices;
+			copy_indices.reserve(j->submesh.count);
+			for(unsigned k=0; k<j->submesh.count; ++k)
+			{
+				unsigned index = data.second[j->submesh.first+k];
+				if(index==0xFFFFFFFF)
+				{
+					copy_indices.push_back(index);
+					continue;
+				}
+
+				// Only copy vertices that this submesh uses
+				if(remap[index]==0xFFFFFFFF)
+				{
+					const Object::Vertex &v = data.first[index];
+					Vector pos = matrix.transform(Vector(v.x, v.y, v.z));
+					Vector normal = matrix.transform_normal(Vector(v.nx, v.ny, v.nz));
+					normal = normal*(1/max(normal.length(), 1e-20f));
+
+					Object::Vertex out = v;
+					out.x = pos.x;
+					out.y = pos.y;
+					out.z = pos.z;
+					out.nx = normal.x;
+					out.ny = normal.y;
+					out.nz = normal.z;
+					remap[index] = vertices.size();
+					vertices.push_back(out);
+				}
+				copy_indices.push_back(remap[index]);
+			}
+
+			if(strips)
+			{
+				if(indices.size()>range.first)
+					indices.push_back(0xFFFFFFFF);
+				indices.insert(indices.end(), copy_indices.begin(), copy_indices.end());
+			}
+			else if(j->object->get_primitive_type()==Object::TRIANGLE_STRIP)
+				append_strip_as_list(copy_indices.begin(), copy_indices.end(), indices);
+			else
+				indices.insert(indices.end(), copy_indices.begin(), copy_indices.end());
+		}
+
+		range.count = indices.size()-range.first;
+		ranges.push_back(range);
+	}
+
+	// Half float positions are too coarse for a mesh spanning a whole scene
+	Object::VertexFormat format = Object::get_load_options().vertex_format;
+	if(format==Object::HALF_VERTICES)
+		format = Object::SNORM16_VERTICES;
+
+	Object *merged = new Object;
+	merged->set_vertex_format(format);
+	merged->set_data(vertices, indices, (strips ? Object::TRIANGLE_STRIP : Object::TRIANGLES));
+	merged->set_submeshes(ranges);
+	merged_objects.push_back(merged);
+	merged_memory += vertices.size()*merged->get_vertex_size()+indices.size()*merged->get_index_size();
+	add(*merged);
 }
 
 void Group::load(const ResourceManager &res_mgr, const string &filename)
@@ -30,7 +223,9 @@ void Group::load(const ResourceManager &res_mgr, const string &filename)
 	ifstream input(filename.c_str());
 	string line;
 
+	vector<const Instance *> static_instances;
 	Instance *current = 0;
+	Object *current_object = 0;
 	while(getline(input, line))
 	{
 		if(line[0]=='#')
@@ -44,10 +239,13 @@ void Group::load(const ResourceManager &res_mgr, const string &filename)
 		{
 			string name;
 			parse >> name;
-			current = new Instance(res_mgr.get<Object>(name+".obj"));
+			current_object = &res_mgr.get<Object>(name+".obj");
+			current = new Instance(*current_object);
 			instances.push_back(current);
 			add(*current);
 		}
+		else if(command=="bounds_tree")
+			set_use_bounds_tree(true);
 		else if(current)
 		{
 			if(command=="translate")
@@ -74,14 +272,106 @@ void Group::load(const ResourceManager &res_mgr, const string &filename)
 				parse >> angle;
 				current->set_matrix(current->get_matrix()*Matrix::rotation_z(angle));
 			}
+			else if(command=="occluder")
+			{
+				if(!current_object->is_occluder())
+					current_object->build_occluder(current_object->get_bounds().get_radius()*0.01f);
+			}
+			else if(command=="static")
+			{
+				if(static_instances.empty() || static_instances.back()!=current)
+					static_instances.push_back(current);
+			}
 		}
 	}
+
+	if(!static_instances.empty())
+		merge_instances(static_instances);
+}
+
+Bounds Group::get_bounds() const
+{
+	if(bounds_dirty)
+	{
+		bounds = Bounds();
+		for(vector<const Renderable *>::const_iterator i=contents.begin(); i!=contents.end(); ++i)
+			bounds.extend((*i)->get_bounds());
+		bounds_dirty = false;
+	}
+	return bounds;
+}
+
+void Group::child_bounds_changed(const Renderable &child) const
+{
+	// The tree needs to know about every child, even if the bounds are dirty
+	if(bounds_tree && !tree_outdated)
+		bounds_tree->mark_changed(child);
+
+	/* If the bounds are already dirty, the parents have been told and haven't
+	asked for new bounds since. */
+	if(bounds_dirty)
+		return;
+
+	bounds_dirty = true;
+	bounds_changed();
+}
+
+void Group::child_destroyed(const Renderable &child) const
+{
+	// The link is already gone, so only the pointers remain to be removed
+	contents.erase(std::remove(contents.begin(), contents.end(), &child), contents.end());
+	tree_outdated = true;
+	child_bounds_changed(child);
 }
 
 void Group::render(const RenderState &state) const
 {
-	for(vector<const Renderable *>::const_iterator i=contents.begin(); i!=contents.end(); ++i)
-		(*i)->render(state);
+	render_queued(state);
+}
+
+void Group::collect(RenderQueue &queue, const WorldTransform &world) const
+{
+	/* The contents are in the Group's coordinate space.  Bringing the frustum
+	there once is cheaper than transforming the bounds of every child. */
+	Frustum frustum(queue.get_view_projection_matrix()*world.matrix);
+	const vector<const Renderable *> *candidates = &contents;
+	const BoundsTree *tree = get_bounds_tree();
+	if(tree)
+	{
+		// Nested Groups collect into the same queue, so each takes its own list
+		vector<const Renderable *> &visible = queue.acquire_renderable_list();
+		CullingStats stats;
+		tree->query(frustum, visible, stats);
+		queue.add_culling_stats(stats);
+		candidates = &visible;
+	}
+
+	// Contents found through the tree are already known to be visible
+	const Frustum *cull_frustum = (tree ? 0 : &frustum);
+	JobPool *pool = queue.get_job_pool();
+	unsigned count = candidates->size();
+	if(!pool || count<min_job_contents*2)
+		collect_contents(queue, world, cull_frustum, candidates->begin(), candidates->end());
+	else
+	{
+		/* Each job collects into a subqueue added in order, so the items end
+		up in the same order as they would on a single thread. */
+		unsigned n_jobs = min(count/min_job_contents, pool->get_thread_count()*jobs_per_thread);
+		for(unsigned i=0; i<n_jobs; ++i)
+			queue.add_collect_job(candidates->begin()+count*i/n_jobs, candidates->begin()+count*(i+1)/n_jobs, world, cull_frustum);
+	}
+
+	if(tree)
+		queue.release_renderable_list();
+}
+
+
+void collect_contents(RenderQueue &queue, const WorldTransform &world, const Frustum *frustum, vector<const Renderable *>::const_iterator begin, vector<const Renderable *>::const_iterator end)
+{
+	// Without a frustum, the contents are already known to be visible
+	for(vector<const Renderable *>::const_iterator i=begin; i!=end; ++i)
+		if(!frustum || queue.is_visible(*frustum, (*i)->get_bounds()))
+			(*i)->collect(queue, world);
 }
 
 } // namespace SkrolliGL
@@ -2,12 +2,15 @@
 #define SKROLLIGL_GROUP_H_
 
 #include <vector>
+#include <SDL.h>
 #include "renderable.h"
 #include "resourcemanager.h"
 
 namespace SkrolliGL {
 
+class BoundsTree;
 class Instance;
+class Object;
 
 /*
 A group of Renderables.  Groups are useful for managing scenes or compound
@@ -32,6 +35,22 @@ rotate_z <angle>
 
   Rotates the latest object by an angle around a primary axis.
 
+static
+
+  Marks the latest object as static.  After the file has been loaded, all
+  static objects are merged with merge_instances.  They can't be moved
+  afterwards.
+
+occluder
+
+  Makes the Object of the latest object an occluder for occlusion culling.  Its
+  occluder mesh is built from a detail level with an error of at most one
+  percent of the Object's size.  See Object::build_occluder.
+
+bounds_tree
+
+  Enables a BoundsTree for the group.  See set_use_bounds_tree.
+
 Any translation and rotation operations occur withing the already-transformed
 coordinate system.  So a rotation around Z axis by 45 degrees followed by a
 translation by (1 0 0) will translate the object in a direction halfway between
@@ -42,10 +61,20 @@ The canonical filename extension is .scene.
 class Group: public Renderable, public Resource
 {
 private:
-	std::vector<const Renderable *> contents;
+	mutable std::vector<const Renderable *> contents;
 	std::vector<Instance *> instances;
-
+	std::vector<Object *> merged_objects;
+	unsigned merged_memory;
+	mutable Bounds bounds;
+	mutable bool bounds_dirty;
+	mutable BoundsTree *bounds_tree;
+	mutable bool tree_outdated;
+	mutable SDL_SpinLock tree_lock;
+
+	Group(const Group &);
+	Group &operator=(const Group &);
 public:
+	Group();
 	~Group();
 
 	/* Adds a Renderable to the Group. */
@@ -54,11 +83,50 @@ public:
 	/* Removes a Renderable from the Group. */
 	void remove(const Renderable &);
 
+	/* Merges Instances of Objects in the Group into a new Object, which
+	replaces them in the Group.  Vertices are transformed by the Instances'
+	matrices, and index ranges of the same Material are joined so that each
+	Material is drawn with a single call.  Later changes to the Instances have
+	no effect.  Instances of other Renderables are left alone.
+
+	The merged Object has no detail levels and is culled as a whole.  Its
+	vertices take memory for every copy, which get_merged_memory reports. */
+	void merge_instances(const std::vector<const Instance *> &);
+
+	/* Returns the size of the vertex and index buffers of merged Objects, in
+	bytes. */
+	unsigned get_merged_memory() const { return merged_memory; }
+
+	/* Enables or disables a BoundsTree over the contents.  With the tree,
+	collecting only visits contents near the view frustum instead of testing
+	every one of them.  This pays off for Groups with many contents.  The tree
+	is rebuilt when contents are added or removed, and refitted when their
+	bounds change.  Disabled by default. */
+	void set_use_bounds_tree(bool);
+
+	/* Returns the BoundsTree of the Group, brought up to date with the
+	contents, or null if the tree is disabled.  It can be used for sphere and
+	ray queries.  This may be called from several threads at once. */
+	const BoundsTree *get_bounds_tree() const;
+
 	/* Loads contents for the Group from a file.  Existing contents are not
 	removed.  The Group will take care of deleting any newly-created objects. */
 	virtual void load(const ResourceManager &, const std::string &);
 
+	/* Returns the union of the bounds of the Group's contents.  The result is
+	cached until the contents change. */
+	virtual Bounds get_bounds() const;
+protected:
+	virtual void child_bounds_changed(const Renderable &) const;
+	virtual void child_destroyed(const Renderable &) const;
+
+public:
 	virtual void render(const RenderState &) const;
+
+	/* Collects the contents of the Group.  Contents whose bounds are outside
+	the view frustum are skipped.  If the queue has a JobPool and there are many
+	contents to collect, they are split into jobs. */
+	virtual void collect(RenderQueue &, const WorldTransform &) const;
 };
 
 } // namespace SkrolliGL
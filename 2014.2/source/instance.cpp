@@ -4,20 +4,62 @@
 namespace SkrolliGL {
 
 Instance::Instance(const Renderable &r):
-	renderable(r)
-{ }
+	renderable(r),
+	bounds_dirty(true),
+	parent_stamp(0),
+	world_lock(0)
+{
+	renderable.add_parent(*this);
+}
 
 void Instance::set_matrix(const Matrix &m)
 {
 	matrix = m;
+
+	// Zero is never a stamp, so the world matrix is recomputed on next collect
+	parent_stamp = 0;
+	child_bounds_changed(renderable);
+}
+
+Bounds Instance::get_bounds() const
+{
+	if(bounds_dirty)
+	{
+		bounds = renderable.get_bounds().transformed(matrix);
+		bounds_dirty = false;
+	}
+	return bounds;
+}
+
+void Instance::child_bounds_changed(const Renderable &) const
+{
+	/* If the bounds are already dirty, the parents have been told and haven't
+	asked for new bounds since. */
+	if(bounds_dirty)
+		return;
+
+	bounds_dirty = true;
+	bounds_changed();
 }
 
 void Instance::render(const RenderState &state) const
 {
-	RenderState inner_state = state;
-	// Combine this instance's matrix with the incoming modelview matrix.
-	inner_state.modelview_matrix = state.modelview_matrix*matrix;
-	renderable.render(inner_state);
+	render_queued(state);
+}
+
+void Instance::collect(RenderQueue &queue, const WorldTransform &parent) const
+{
+	// Combine this instance's matrix with the incoming world matrix.
+	SDL_AtomicLock(&world_lock);
+	if(parent.stamp!=parent_stamp)
+	{
+		world = WorldTransform(parent.matrix*matrix, WorldTransform::new_stamp());
+		parent_stamp = parent.stamp;
+	}
+	WorldTransform current = world;
+	SDL_AtomicUnlock(&world_lock);
+
+	renderable.collect(queue, current);
 }
 
 } // namespace SkrolliGL
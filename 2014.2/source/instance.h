@@ -1,6 +1,7 @@
 #ifndef SKROLLIGL_OBJECTINSTANCE_H_
 #define SKROLLIGL_OBJECTINSTANCE_H_
 
+#include <SDL.h>
 #include "mathutils.h"
 #include "renderable.h"
 
@@ -15,20 +16,48 @@ determines the position and orientation of the renderable.
 
 Instances can also be animated.  See the Animation and Engine classes for
 details.
+
+The world matrix and the bounds are cached, so Instances which don't move cost
+almost nothing per frame.  The world matrix is recomputed only when the
+Instance's own matrix changes or it's collected with a transform of a different
+stamp.  An Instance which is reached through several paths in the scene sees a
+different stamp on each path and recomputes every time.  Such paths may also be
+collected on different threads at the same time, so the cached world matrix is
+guarded by a lock.
+
+An Instance may outlive its renderable, for example when both are destroyed at
+exit, but it must not be used afterwards.
 */
 class Instance: public Renderable
 {
 private:
 	const Renderable &renderable;
 	Matrix matrix;
+	mutable Bounds bounds;
+	mutable bool bounds_dirty;
+	mutable WorldTransform world;
+	mutable unsigned parent_stamp;
+	mutable SDL_SpinLock world_lock;
 
+	Instance(const Instance &);
+	Instance &operator=(const Instance &);
 public:
 	Instance(const Renderable &);
 
+	const Renderable &get_renderable() const { return renderable; }
+
 	void set_matrix(const Matrix &);
 	const Matrix &get_matrix() const { return matrix; }
 
+	/* Returns the bounds of the renderable transformed by the Instance's
+	matrix. */
+	virtual Bounds get_bounds() const;
+protected:
+	virtual void child_bounds_changed(const Renderable &) const;
+
+public:
 	virtual void render(const RenderState &) const;
+	virtual void collect(RenderQueue &, const WorldTransform &) const;
 };
 
 } // namespace SkrolliGL
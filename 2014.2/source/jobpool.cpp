@@ -0,0 +1,190 @@
+#include <algorithm>
+#include "jobpool.h"
+
+using namespace std;
+
+namespace SkrolliGL {
+
+JobPool::JobPool(unsigned t):
+	workers(t ? t : max(SDL_GetCPUCount(), 1)),
+	current_worker(SDL_TLSCreate()),
+	mutex(SDL_CreateMutex()),
+	cond(SDL_CreateCond())
+{
+	SDL_AtomicSet(&n_queued, 0);
+	SDL_AtomicSet(&n_unfinished, 0);
+	SDL_AtomicSet(&n_sleeping, 0);
+	SDL_AtomicSet(&n_stolen, 0);
+	SDL_AtomicSet(&quit, 0);
+
+	for(unsigned i=0; i<workers.size(); ++i)
+	{
+		workers[i].pool = this;
+		workers[i].index = i;
+		workers[i].thread = 0;
+		workers[i].lock = 0;
+		workers[i].first_job = 0;
+	}
+
+	/* The first worker is whichever thread calls wait.  Workers that fail to
+	start leave their queues to be stolen from. */
+	for(unsigned i=1; i<workers.size(); ++i)
+		workers[i].thread = SDL_CreateThread(worker_thread, "JobPool", &workers[i]);
+}
+
+JobPool::~JobPool()
+{
+	wait();
+
+	SDL_AtomicSet(&quit, 1);
+	wake_all();
+	for(unsigned i=1; i<workers.size(); ++i)
+		if(workers[i].thread)
+			SDL_WaitThread(workers[i].thread, 0);
+
+	SDL_DestroyCond(cond);
+	SDL_DestroyMutex(mutex);
+}
+
+void JobPool::add(Job *job)
+{
+	push(job, true);
+}
+
+void JobPool::add(Job &job)
+{
+	push(&job, false);
+}
+
+void JobPool::push(Job *job, bool owned)
+{
+	QueuedJob queued;
+	queued.job = job;
+	queued.owned = owned;
+
+	Worker *worker = static_cast<Worker *>(SDL_TLSGet(current_worker));
+	if(!worker)
+		worker = &workers[0];
+
+	/* Count the job before it can be seen, so that the counts are never lower
+	than the actual numbers and no thread goes to sleep with jobs queued. */
+	SDL_AtomicIncRef(&n_unfinished);
+	SDL_AtomicIncRef(&n_queued);
+	SDL_AtomicLock(&worker->lock);
+	if(worker->first_job==worker->jobs.size())
+	{
+		worker->jobs.clear();
+		worker->first_job = 0;
+	}
+	worker->jobs.push_back(queued);
+	SDL_AtomicUnlock(&worker->lock);
+
+	if(SDL_AtomicGet(&n_sleeping))
+		wake_all();
+}
+
+void JobPool::wait()
+{
+	QueuedJob job;
+	while(SDL_AtomicGet(&n_unfinished))
+	{
+		if(take(0, job))
+		{
+			run(job);
+			continue;
+		}
+
+		// The remaining jobs are running on other threads
+		SDL_LockMutex(mutex);
+		SDL_AtomicIncRef(&n_sleeping);
+		while(SDL_AtomicGet(&n_unfinished) && !SDL_AtomicGet(&n_queued))
+			SDL_CondWait(cond, mutex);
+		SDL_AtomicAdd(&n_sleeping, -1);
+		SDL_UnlockMutex(mutex);
+	}
+}
+
+bool JobPool::take(unsigned index, QueuedJob &job)
+{
+	if(!SDL_AtomicGet(&n_queued))
+		return false;
+
+	bool found = false;
+	Worker &self = workers[index];
+	SDL_AtomicLock(&self.lock);
+	if(self.jobs.size()>self.first_job)
+	{
+		job = self.jobs.back();
+		self.jobs.pop_back();
+		found = true;
+	}
+	SDL_AtomicUnlock(&self.lock);
+
+	/* Steal from the front, where the oldest jobs are.  Those are usually the
+	largest, so stealing is rare. */
+	for(unsigned i=1; (!found && i<workers.size()); ++i)
+	{
+		Worker &victim = workers[(index+i)%workers.size()];
+		SDL_AtomicLock(&victim.lock);
+		if(victim.jobs.size()>victim.first_job)
+		{
+			job = victim.jobs[victim.first_job++];
+			found = true;
+			SDL_AtomicIncRef(&n_stolen);
+		}
+		SDL_AtomicUnlock(&victim.lock);
+	}
+
+	if(found)
+		SDL_AtomicAdd(&n_queued, -1);
+	return found;
+}
+
+void JobPool::run(const QueuedJob &job)
+{
+	job.job->run();
+	if(job.owned)
+		delete job.job;
+
+	// Wake up the thread waiting for the last job
+	if(SDL_AtomicDecRef(&n_unfinished))
+		wake_all();
+}
+
+void JobPool::wake_all()
+{
+	/* Holding the mutex makes sure that a thread which has just decided to
+	sleep is already waiting. */
+	SDL_LockMutex(mutex);
+	SDL_CondBroadcast(cond);
+	SDL_UnlockMutex(mutex);
+}
+
+int JobPool::worker_thread(void *data)
+{
+	Worker &worker = *static_cast<Worker *>(data);
+	JobPool &pool = *worker.pool;
+	SDL_TLSSet(pool.current_worker, &worker, 0);
+
+	QueuedJob job;
+	while(1)
+	{
+		if(pool.take(worker.index, job))
+		{
+			pool.run(job);
+			continue;
+		}
+
+		SDL_LockMutex(pool.mutex);
+		SDL_AtomicIncRef(&pool.n_sleeping);
+		while(!SDL_AtomicGet(&pool.n_queued) && !SDL_AtomicGet(&pool.quit))
+			SDL_CondWait(pool.cond, pool.mutex);
+		SDL_AtomicAdd(&pool.n_sleeping, -1);
+		SDL_UnlockMutex(pool.mutex);
+
+		if(SDL_AtomicGet(&pool.quit))
+			return 0;
+	}
+}
+
+} // namespace SkrolliGL
@@ -0,0 +1,107 @@
+#ifndef SKROLLIGL_JOBPOOL_H_
+#define SKROLLIGL_JOBPOOL_H_
+
+#include <vector>
+#include <SDL.h>
+
+namespace SkrolliGL {
+
+/*
+A pool of worker threads which run jobs with work stealing.  Every worker has a
+queue of its own.  Jobs added by a running job go to the queue of the worker
+running it, and the worker takes its newest job first, which is likely to use
+the data that is still in its cache.  A worker whose queue is empty steals the
+oldest job of another worker.  Jobs which split their work into more jobs keep
+every thread busy this way, without having to know in advance how the work is
+distributed.
+
+The thread which adds jobs from outside the pool counts as the first worker.  It
+runs jobs as well while it waits for them to finish, so a pool with one thread
+has no worker threads at all and runs everything in wait.  Idle workers sleep
+until there are jobs again.
+*/
+class JobPool
+{
+public:
+	/* A unit of work for the pool.  Jobs added by pointer are deleted after
+	they have run. */
+	class Job
+	{
+	public:
+		virtual ~Job() { }
+
+		virtual void run() = 0;
+	};
+
+private:
+	struct QueuedJob
+	{
+		Job *job;
+		bool owned;
+	};
+
+	/* The jobs of a worker are taken from the back by the worker itself and
+	from the front, starting at first_job, by others.  Once all of them have
+	been taken, the next job starts over at the beginning of the vector, which
+	keeps its memory. */
+	struct Worker
+	{
+		JobPool *pool;
+		unsigned index;
+		SDL_Thread *thread;
+		SDL_SpinLock lock;
+		std::vector<QueuedJob> jobs;
+		unsigned first_job;
+	};
+
+	std::vector<Worker> workers;
+	SDL_TLSID current_worker;
+	SDL_mutex *mutex;
+	SDL_cond *cond;
+	SDL_atomic_t n_queued;
+	SDL_atomic_t n_unfinished;
+	SDL_atomic_t n_sleeping;
+	mutable SDL_atomic_t n_stolen;
+	SDL_atomic_t quit;
+
+	JobPool(const JobPool &);
+	JobPool &operator=(const JobPool &);
+public:
+	/* Creates a pool with the given number of threads, including the one
+	which calls wait.  Zero means one thread per CPU core. */
+	JobPool(unsigned = 0);
+
+	/* Waits for the remaining jobs and stops the worker threads. */
+	~JobPool();
+
+	unsigned get_thread_count() const { return workers.size(); }
+
+	/* Adds a job to the queue of the calling worker, or to the first queue if
+	called from outside the pool.  The pool takes ownership of the job. */
+	void add(Job *);
+
+	/* Adds a job which remains owned by the caller.  It must stay alive until
+	it has run, which is certain once wait returns.  Jobs that run every frame
+	can be reused this way without allocating memory. */
+	void add(Job &);
+
+	/* Runs jobs until every job added so far, and every job they add, has
+	finished. */
+	void wait();
+
+	/* Returns the number of jobs taken from the queue of another worker since
+	the pool was created. */
+	unsigned get_stolen_count() const { return SDL_AtomicGet(&n_stolen); }
+
+private:
+	void push(Job *, bool);
+	bool take(unsigned, QueuedJob &);
+	void run(const QueuedJob &);
+	void wake_all();
+
+	static int worker_thread(void *);
+};
+
+} // namespace SkrolliGL
+
+#endif
@@ -42,6 +42,9 @@ int main()
 	engine.set_light_direction(Vector(-0.8, -0.7, 1.3));
 	engine.set_light_intensity(0.4);
 	engine.set_ambient_intensity(0.2);
+	engine.set_occlusion_culling(true);
+	engine.set_collect_threads(0);
+	engine.set_depth_prepass(true);
 
 	res_mgr.load_directory("data");
 	Group scene;
@@ -0,0 +1,51 @@
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mappedfile.h"
+
+using namespace std;
+
+namespace SkrolliGL {
+
+MappedFile::MappedFile(const string &filename):
+	data(0),
+	size(0)
+{
+	fd = open(filename.c_str(), O_RDONLY);
+	if(fd<0)
+		throw runtime_error("Could not open "+filename);
+
+	struct stat st;
+	if(fstat(fd, &st)<0)
+	{
+		close(fd);
+		throw runtime_error("Could not stat "+filename);
+	}
+
+	// Mapping an empty file is an error, so leave the data pointer null
+	size = st.st_size;
+	if(size)
+	{
+		void *ptr = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(ptr==MAP_FAILED)
+		{
+			close(fd);
+			throw runtime_error("Could not map "+filename);
+		}
+		data = static_cast<char *>(ptr);
+
+		// We'll be reading the file from start to end
+		madvise(data, size, MADV_SEQUENTIAL);
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	if(data)
+		munmap(data, size);
+	close(fd);
+}
+
+} // namespace SkrolliGL
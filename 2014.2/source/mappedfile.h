@@ -0,0 +1,34 @@
+#ifndef SKROLLIGL_MAPPEDFILE_H_
+#define SKROLLIGL_MAPPEDFILE_H_
+
+#include <string>
+
+namespace SkrolliGL {
+
+/*
+Maps the contents of a file into memory for reading.  This avoids copying the
+data into a separate buffer, as the operating system can supply the file's
+pages directly from its cache.
+*/
+class MappedFile
+{
+private:
+	int fd;
+	char *data;
+	unsigned long size;
+
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+public:
+	/* Maps a file.  Throws if the file can't be opened. */
+	MappedFile(const std::string &);
+	~MappedFile();
+
+	const char *begin() const { return data; }
+	const char *end() const { return data+size; }
+	unsigned long get_size() const { return size; }
+};
+
+} // namespace SkrolliGL
+
+#endif
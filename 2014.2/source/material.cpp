@@ -11,11 +11,16 @@ namespace SkrolliGL {
 Material::Material():
 	shader(0),
 	texture(0)
-{ }
+{
+	for(unsigned i=0; i<N_VARIANTS; ++i)
+		handle_generations[i] = 0;
+}
 
 void Material::set_shader(Shader *s)
 {
 	shader = s;
+	for(unsigned i=0; i<N_VARIANTS; ++i)
+		handle_generations[i] = 0;
 }
 
 void Material::set_texture(Texture *t)
@@ -61,36 +66,62 @@ void Material::load(const ResourceManager &manager, const string &filename)
 				++uni.n_elems;
 			}
 			uniforms.push_back(uni);
+
+			// The new uniform has no handles yet
+			for(unsigned i=0; i<N_VARIANTS; ++i)
+				handle_generations[i] = 0;
 		}
 	}
 }
 
-void Material::apply() const
+void Material::apply(bool instanced) const
 {
-	if(shader)
+	Shader *s = shader;
+	Variant variant = NORMAL_VARIANT;
+	if(instanced && s && s->get_instanced_variant())
+	{
+		s = s->get_instanced_variant();
+		variant = INSTANCED_VARIANT;
+	}
+
+	if(s)
 	{
-		shader->bind();
+		s->bind();
+
+		// Generations are unique, so this also notices a change of shader
+		if(s->get_link_generation()!=handle_generations[variant])
+			look_up_uniforms(*s, variant);
 
 		for(list<Uniform>::const_iterator i=uniforms.begin(); i!=uniforms.end(); ++i)
 		{
+			UniformHandle handle = i->handles[variant];
 			if(i->n_elems==1)
-				shader->set_uniform(i->name, i->values[0]);
+				s->set_uniform(handle, i->values[0]);
 			else if(i->n_elems==2)
-				shader->set_uniform(i->name, i->values[0], i->values[1]);
+				s->set_uniform(handle, i->values[0], i->values[1]);
 			else if(i->n_elems==3)
-				shader->set_uniform(i->name, i->values[0], i->values[1], i->values[2]);
+				s->set_uniform(handle, i->values[0], i->values[1], i->values[2]);
 			else if(i->n_elems==4)
-				shader->set_uniform(i->name, i->values[0], i->values[1], i->values[2], i->values[3]);
+				s->set_uniform(handle, i->values[0], i->values[1], i->values[2], i->values[3]);
 		}
 	}
 
 	if(texture)
 	{
 		texture->bind();
-		shader->set_uniform("texture", 0);
+		if(s)
+			s->set_uniform(texture_handles[variant], 0);
 	}
 	else
 		Texture::unbind();
 }
 
+void Material::look_up_uniforms(Shader &s, Variant variant) const
+{
+	for(list<Uniform>::const_iterator i=uniforms.begin(); i!=uniforms.end(); ++i)
+		i->handles[variant] = s.get_uniform(i->name);
+	texture_handles[variant] = s.get_uniform("texture");
+	handle_generations[variant] = s.get_link_generation();
+}
+
 } // namespace SkrolliGL
@@ -2,10 +2,10 @@
 #define SKROLLIGL_MATERIAL_H_
 
 #include "resourcemanager.h"
+#include "shader.h"
 
 namespace SkrolliGL {
 
-class Shader;
 class Texture;
 
 /*
@@ -29,20 +29,39 @@ uniform <name> <values>
   specified.
 
 The canonical filename extension is .mat.
+
+The uniforms are looked up in the shader the first time the material is
+applied, and in the instanced variant the first time it's applied instanced.
+After that, applying the material only sets values, until the shader is linked
+again.
 */
 class Material: public Resource
 {
 private:
+	/* Variants of the shader which uniforms are looked up in. */
+	enum Variant
+	{
+		NORMAL_VARIANT,
+		INSTANCED_VARIANT,
+		N_VARIANTS
+	};
+
+	/* A uniform value and its handles in each variant.  The handles are only
+	valid while the link generation of the variant is in
+	handle_generations. */
 	struct Uniform
 	{
 		std::string name;
 		unsigned n_elems;
 		float values[4];
+		mutable UniformHandle handles[N_VARIANTS];
 	};
 
 	Shader *shader;
 	Texture *texture;
 	std::list<Uniform> uniforms;
+	mutable unsigned handle_generations[N_VARIANTS];
+	mutable UniformHandle texture_handles[N_VARIANTS];
 
 public:
 	Material();
@@ -63,8 +82,11 @@ public:
 	ResourceManager. */
 	virtual void load(const ResourceManager &, const std::string &);
 
-	/* Makes the material active. */
-	void apply() const;
+	/* Makes the material active.  If instanced is true and the shader has an
+	instanced variant, the variant is used instead. */
+	void apply(bool instanced = false) const;
+private:
+	void look_up_uniforms(Shader &, Variant) const;
 };
 
 } // namespace SkrolliGL
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 #include "mathutils.h"
 
@@ -20,6 +21,15 @@ Matrix Matrix::translation(float x, float y, float z)
 	return matrix;
 }
 
+Matrix Matrix::scaling(float x, float y, float z)
+{
+	Matrix matrix;
+	matrix.m[0] = x;
+	matrix.m[5] = y;
+	matrix.m[10] = z;
+	return matrix;
+}
+
 Matrix Matrix::rotation_x(float a)
 {
 	a *=M_PI/180;
@@ -97,4 +107,206 @@ Vector Matrix::transform_direction(const Vector &v) const
 		v.x*m[2]+v.y*m[6]+v.z*m[10]);
 }
 
+Vector Matrix::transform_normal(const Vector &v) const
+{
+	/* The inverse transpose of a matrix with columns a, b and c has columns
+	b×c, c×a and a×b, divided by the determinant. */
+	Vector a(m[0], m[1], m[2]);
+	Vector b(m[4], m[5], m[6]);
+	Vector c(m[8], m[9], m[10]);
+	Vector bc = b.cross(c);
+	Vector ca = c.cross(a);
+	Vector ab = a.cross(b);
+	float det = a.dot(bc);
+	Vector result = bc*v.x+ca*v.y+ab*v.z;
+	return (det ? result*(1/det) : result);
+}
+
+
+
+Bounds::Bounds():
+	radius(-1),
+	infinite(false)
+{ }
+
+Bounds::Bounds(const Vector &low, const Vector &high):
+	minimum(low),
+	maximum(high),
+	center((low+high)*0.5f),
+	radius((high-low).length()*0.5f),
+	infinite(false)
+{ }
+
+Bounds Bounds::infinity()
+{
+	Bounds bounds;
+	bounds.radius = 0;
+	bounds.infinite = true;
+	return bounds;
+}
+
+void Bounds::extend(const Vector &point)
+{
+	if(infinite)
+		return;
+
+	if(is_empty())
+	{
+		minimum = maximum = center = point;
+		radius = 0;
+		return;
+	}
+
+	minimum = Vector(min(minimum.x, point.x), min(minimum.y, point.y), min(minimum.z, point.z));
+	maximum = Vector(max(maximum.x, point.x), max(maximum.y, point.y), max(maximum.z, point.z));
+
+	// Grow the sphere just enough to reach the point
+	Vector offset = point-center;
+	float distance = offset.length();
+	if(distance>radius)
+	{
+		float new_radius = (radius+distance)/2;
+		center = center+offset*((new_radius-radius)/distance);
+		radius = new_radius;
+	}
+}
+
+void Bounds::extend(const Bounds &other)
+{
+	if(infinite || other.is_empty())
+		return;
+
+	if(is_empty() || other.infinite)
+	{
+		*this = other;
+		return;
+	}
+
+	minimum = Vector(min(minimum.x, other.minimum.x), min(minimum.y, other.minimum.y), min(minimum.z, other.minimum.z));
+	maximum = Vector(max(maximum.x, other.maximum.x), max(maximum.y, other.maximum.y), max(maximum.z, other.maximum.z));
+
+	// Find the smallest sphere that contains both spheres
+	Vector offset = other.center-center;
+	float distance = offset.length();
+	if(distance+other.radius<=radius)
+		return;
+	else if(distance+radius<=other.radius)
+	{
+		center = other.center;
+		radius = other.radius;
+	}
+	else
+	{
+		float new_radius = (distance+radius+other.radius)/2;
+		center = center+offset*((new_radius-radius)/distance);
+		radius = new_radius;
+	}
+}
+
+void Bounds::set_sphere(const Vector &c, float r)
+{
+	center = c;
+	radius = r;
+}
+
+Bounds Bounds::transformed(const Matrix &matrix) const
+{
+	if(is_empty() || infinite)
+		return *this;
+
+	const float *m = matrix.m;
+	Bounds result;
+
+	// Each axis of the new box gets contributions from all axes of the old one
+	Vector box_center = matrix.transform((minimum+maximum)*0.5f);
+	Vector half = (maximum-minimum)*0.5f;
+	Vector extent(fabs(m[0])*half.x+fabs(m[4])*half.y+fabs(m[8])*half.z,
+		fabs(m[1])*half.x+fabs(m[5])*half.y+fabs(m[9])*half.z,
+		fabs(m[2])*half.x+fabs(m[6])*half.y+fabs(m[10])*half.z);
+	result.minimum = box_center-extent;
+	result.maximum = box_center+extent;
+
+	// The sphere grows by the largest scale of any axis
+	float scale = max(max(Vector(m[0], m[1], m[2]).length(), Vector(m[4], m[5], m[6]).length()), Vector(m[8], m[9], m[10]).length());
+	result.center = matrix.transform(center);
+	result.radius = radius*scale;
+
+	return result;
+}
+
+
+Frustum::Frustum(const Matrix &matrix)
+{
+	/* Each plane is the sum or difference of the last row of the matrix and
+	one of the others.  Normalizing them makes the distances meaningful for
+	sphere tests. */
+	const float *m = matrix.m;
+	for(unsigned i=0; i<6; ++i)
+	{
+		unsigned row = i/2;
+		float sign = (i%2 ? -1.0f : 1.0f);
+		Vector normal(m[3]+sign*m[row], m[7]+sign*m[4+row], m[11]+sign*m[8+row]);
+		float distance = m[15]+sign*m[12+row];
+		float length = normal.length();
+		planes[i].normal = normal*(1/length);
+		planes[i].distance = distance/length;
+	}
+}
+
+bool Frustum::intersects(const Bounds &bounds) const
+{
+	if(bounds.is_infinite())
+		return true;
+	else if(bounds.is_empty())
+		return false;
+
+	// The sphere is cheap to test and often gives a definite answer
+	const Vector &center = bounds.get_center();
+	float radius = bounds.get_radius();
+	bool inside = true;
+	for(unsigned i=0; i<6; ++i)
+	{
+		float distance = planes[i].normal.dot(center)+planes[i].distance;
+		if(distance<-radius)
+			return false;
+		else if(distance<radius)
+			inside = false;
+	}
+
+	if(inside)
+		return true;
+
+	// Test the corner of the box that is furthest along each plane's normal
+	const Vector &low = bounds.get_minimum();
+	const Vector &high = bounds.get_maximum();
+	for(unsigned i=0; i<6; ++i)
+	{
+		const Vector &normal = planes[i].normal;
+		Vector corner((normal.x>=0 ? high.x : low.x), (normal.y>=0 ? high.y : low.y), (normal.z>=0 ? high.z : low.z));
+		if(normal.dot(corner)+planes[i].distance<0)
+			return false;
+	}
+
+	return true;
+}
+
+bool Frustum::contains(const Bounds &bounds) const
+{
+	if(bounds.is_infinite() || bounds.is_empty())
+		return false;
+
+	// The box is inside if its corner nearest to the outside is inside every plane
+	const Vector &low = bounds.get_minimum();
+	const Vector &high = bounds.get_maximum();
+	for(unsigned i=0; i<6; ++i)
+	{
+		const Vector &normal = planes[i].normal;
+		Vector corner((normal.x>=0 ? low.x : high.x), (normal.y>=0 ? low.y : high.y), (normal.z>=0 ? low.z : high.z));
+		if(normal.dot(corner)+planes[i].distance<0)
+			return false;
+	}
+
+	return true;
+}
+
 } // namespace SkrolliGL
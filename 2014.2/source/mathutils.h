@@ -38,6 +38,8 @@ public:
 
 	static Matrix translation(float, float, float);
 	static Matrix translation(const Vector &v) { return translation(v.x, v.y, v.z); }
+	static Matrix scaling(float s) { return scaling(s, s, s); }
+	static Matrix scaling(float, float, float);
 	static Matrix rotation_x(float);
 	static Matrix rotation_y(float);
 	static Matrix rotation_z(float);
@@ -52,6 +54,86 @@ public:
 	translation that might be present and is suitable for transforming
 	directional vectors. */
 	Vector transform_direction(const Vector &) const;
+
+	/* Transforms a surface normal by the inverse transpose of the linear part
+	of the matrix.  Unlike transform_direction, this keeps normals
+	perpendicular to the surface when the matrix scales non-uniformly.  The
+	result is not normalized. */
+	Vector transform_normal(const Vector &) const;
+};
+
+/*
+A bounding volume consisting of an axis-aligned box and a sphere.  Both enclose
+the same points, but either one may be tighter depending on the shape.  Default-
+constructed Bounds are empty and contain nothing.  Infinite bounds contain
+everything and are used for things that can't be bounded.
+*/
+class Bounds
+{
+private:
+	Vector minimum;
+	Vector maximum;
+	Vector center;
+	float radius;
+	bool infinite;
+
+public:
+	Bounds();
+
+	/* Constructs bounds from a box.  The sphere is the one passing through the
+	corners of the box. */
+	Bounds(const Vector &, const Vector &);
+
+	static Bounds infinity();
+
+	/* Grows the bounds to contain a point. */
+	void extend(const Vector &);
+
+	/* Grows the bounds to contain other bounds. */
+	void extend(const Bounds &);
+
+	/* Replaces the bounding sphere.  The sphere must contain all points that
+	the bounds have been extended with. */
+	void set_sphere(const Vector &, float);
+
+	/* Returns the bounds transformed by an affine matrix.  The result is still
+	axis-aligned, so it may be larger than the original. */
+	Bounds transformed(const Matrix &) const;
+
+	bool is_empty() const { return radius<0; }
+	bool is_infinite() const { return infinite; }
+	const Vector &get_minimum() const { return minimum; }
+	const Vector &get_maximum() const { return maximum; }
+	const Vector &get_center() const { return center; }
+	float get_radius() const { return radius; }
+};
+
+/*
+The volume visible through a projection.  The planes are extracted from a
+combined projection and modelview matrix, so they are in the same coordinate
+space as the vertices the matrix is applied to.
+*/
+class Frustum
+{
+private:
+	struct Plane
+	{
+		Vector normal;
+		float distance;
+	};
+
+	Plane planes[6];
+
+public:
+	Frustum(const Matrix &);
+
+	/* Checks if any part of the bounds may be inside the frustum.  Some bounds
+	that are just outside a corner of the frustum may be reported as visible. */
+	bool intersects(const Bounds &) const;
+
+	/* Checks if the bounds are entirely inside the frustum.  Some bounds that
+	are inside may be reported as not contained, never the other way around. */
+	bool contains(const Bounds &) const;
 };
 
 } // namespace SkrolliGL
@@ -0,0 +1,506 @@
+#include <algorithm>
+#include <cmath>
+#include "meshutils.h"
+
+using namespace std;
+
+namespace SkrolliGL {
+
+// Size of the FIFO cache used for analysis
+const unsigned fifo_cache_size = 16;
+
+// Size of the LRU cache modeled by the optimizer
+const unsigned lru_cache_size = 32;
+
+const unsigned restart_index = 0xFFFFFFFF;
+
+/* The sum of squared distances to a set of planes, as a symmetric 4×4 matrix.
+Planes are weighted by the area of the triangles they come from. */
+class Quadric
+{
+private:
+	double m[10];
+	double weight;
+
+public:
+	Quadric();
+
+	void add_plane(const Vector &, float, float);
+	void add(const Quadric &);
+
+	/* Returns the weighted sum of squared distances from a point to the
+	planes.  Dividing by get_weight() gives a mean squared distance. */
+	double evaluate(const Vector &) const;
+
+	double get_weight() const { return weight; }
+};
+
+/* Moving one vertex onto another.  Candidates are sorted by cost, so the
+cheapest collapses are done first. */
+struct Collapse
+{
+	unsigned from;
+	unsigned to;
+	double cost;
+
+	bool operator<(const Collapse &other) const { return cost<other.cost; }
+};
+
+/* Orders vertices by position to find the ones that share a position. */
+struct PositionLess
+{
+	const vector<Vector> &positions;
+	const vector<unsigned> &vertices;
+
+	PositionLess(const vector<Vector> &p, const vector<unsigned> &v): positions(p), vertices(v) { }
+
+	bool operator()(unsigned, unsigned) const;
+};
+
+static float vertex_score(int, unsigned);
+static Vector triangle_normal(const Vector &, const Vector &, const Vector &);
+
+
+VertexCacheStats analyze_vertex_cache(const vector<unsigned> &indices, bool strip, unsigned n_vertices)
+{
+	vector<unsigned> cache_time(n_vertices, 0);
+	vector<bool> referenced(n_vertices, false);
+	unsigned time = fifo_cache_size+1;
+	unsigned misses = 0;
+	unsigned n_unique = 0;
+	unsigned n_triangles = 0;
+	unsigned strip_length = 0;
+
+	for(unsigned i=0; i<indices.size(); ++i)
+	{
+		unsigned index = indices[i];
+		if(strip && index==restart_index)
+		{
+			strip_length = 0;
+			continue;
+		}
+
+		/* A vertex is in the FIFO if fewer than cache size other vertices have
+		been pushed since it was.  Hits don't modify the FIFO. */
+		if(time-cache_time[index]>fifo_cache_size)
+		{
+			cache_time[index] = time++;
+			++misses;
+		}
+
+		if(!referenced[index])
+		{
+			referenced[index] = true;
+			++n_unique;
+		}
+
+		if(strip)
+		{
+			// Degenerate triangles are not rasterized, but they still cost
+			++strip_length;
+			if(strip_length>=3)
+			{
+				unsigned a = indices[i-2];
+				unsigned b = indices[i-1];
+				if(a!=b && b!=index && a!=index)
+					++n_triangles;
+			}
+		}
+		else if(i%3==2)
+			++n_triangles;
+	}
+
+	VertexCacheStats stats;
+	if(n_triangles)
+		stats.acmr = static_cast<float>(misses)/n_triangles;
+	if(n_unique)
+		stats.atvr = static_cast<float>(misses)/n_unique;
+	return stats;
+}
+
+void optimize_vertex_cache(vector<unsigned> &indices, unsigned n_vertices)
+{
+	unsigned n_triangles = indices.size()/3;
+	if(!n_triangles)
+		return;
+
+	// Build a table of the triangles that use each vertex
+	vector<unsigned> offsets(n_vertices+1, 0);
+	for(unsigned i=0; i<n_triangles*3; ++i)
+		++offsets[indices[i]+1];
+	for(unsigned i=0; i<n_vertices; ++i)
+		offsets[i+1] += offsets[i];
+	vector<unsigned> vertex_triangles(offsets.back());
+	vector<unsigned> fill(offsets.begin(), offsets.end()-1);
+	for(unsigned i=0; i<n_triangles*3; ++i)
+		vertex_triangles[fill[indices[i]]++] = i/3;
+
+	// Live triangles are ones that have not been emitted yet
+	vector<unsigned> live_triangles(n_vertices);
+	for(unsigned i=0; i<n_vertices; ++i)
+		live_triangles[i] = offsets[i+1]-offsets[i];
+
+	vector<int> cache_position(n_vertices, -1);
+	vector<float> scores(n_vertices);
+	for(unsigned i=0; i<n_vertices; ++i)
+		scores[i] = vertex_score(-1, live_triangles[i]);
+
+	vector<float> triangle_scores(n_triangles);
+	for(unsigned i=0; i<n_triangles; ++i)
+		triangle_scores[i] = scores[indices[i*3]]+scores[indices[i*3+1]]+scores[indices[i*3+2]];
+
+	vector<bool> emitted(n_triangles, false);
+	vector<unsigned> result;
+	result.reserve(n_triangles*3);
+
+	// The cache has room for three extra entries while a triangle is added
+	vector<unsigned> cache;
+	cache.reserve(lru_cache_size+3);
+	vector<unsigned> new_cache;
+	new_cache.reserve(lru_cache_size+3);
+
+	unsigned best = 0;
+	unsigned cursor = 0;
+	while(1)
+	{
+		if(best==~0U)
+		{
+			/* Nothing in the cache has live triangles left.  Continue from the
+			next unemitted triangle in the original order; a full search for
+			the highest score would make the algorithm quadratic. */
+			for(; (cursor<n_triangles && emitted[cursor]); ++cursor) ;
+			if(cursor>=n_triangles)
+				break;
+			best = cursor;
+		}
+
+		emitted[best] = true;
+		const unsigned *tri = &indices[best*3];
+		new_cache.clear();
+		for(unsigned i=0; i<3; ++i)
+		{
+			result.push_back(tri[i]);
+			--live_triangles[tri[i]];
+			new_cache.push_back(tri[i]);
+		}
+
+		// Move the triangle's vertices to the front of the LRU cache
+		for(vector<unsigned>::const_iterator i=cache.begin(); i!=cache.end(); ++i)
+			if(*i!=tri[0] && *i!=tri[1] && *i!=tri[2])
+				new_cache.push_back(*i);
+		cache.swap(new_cache);
+
+		// Update scores of everything that was or is in the cache
+		for(unsigned i=0; i<new_cache.size(); ++i)
+			cache_position[new_cache[i]] = -1;
+		for(unsigned i=0; i<cache.size(); ++i)
+			cache_position[cache[i]] = (i<lru_cache_size ? i : -1);
+		if(cache.size()>lru_cache_size)
+			cache.resize(lru_cache_size);
+
+		for(unsigned i=0; i<new_cache.size()+3; ++i)
+		{
+			unsigned v = (i<3 ? tri[i] : new_cache[i-3]);
+			float old_score = scores[v];
+			scores[v] = vertex_score(cache_position[v], live_triangles[v]);
+			float delta = scores[v]-old_score;
+
+			for(unsigned j=offsets[v]; j<offsets[v+1]; ++j)
+				if(!emitted[vertex_triangles[j]])
+					triangle_scores[vertex_triangles[j]] += delta;
+		}
+
+		/* Choose the next triangle only after all scores are up to date, as a
+		triangle may use several of the vertices whose scores changed. */
+		best = ~0U;
+		float best_score = -1;
+		for(unsigned i=0; i<new_cache.size()+3; ++i)
+		{
+			unsigned v = (i<3 ? tri[i] : new_cache[i-3]);
+			for(unsigned j=offsets[v]; j<offsets[v+1]; ++j)
+			{
+				unsigned t = vertex_triangles[j];
+				if(!emitted[t] && triangle_scores[t]>best_score)
+				{
+					best_score = triangle_scores[t];
+					best = t;
+				}
+			}
+		}
+	}
+
+	indices.swap(result);
+}
+
+void optimize_vertex_fetch(vector<unsigned> &indices, vector<unsigned> &remap, unsigned n_vertices)
+{
+	remap.assign(n_vertices, ~0U);
+	unsigned next = 0;
+	for(vector<unsigned>::iterator i=indices.begin(); i!=indices.end(); ++i)
+	{
+		if(*i==restart_index)
+			continue;
+
+		if(remap[*i]==~0U)
+			remap[*i] = next++;
+		*i = remap[*i];
+	}
+
+	for(vector<unsigned>::iterator i=remap.begin(); i!=remap.end(); ++i)
+		if(*i==~0U)
+			*i = next++;
+}
+
+float simplify_triangles(const vector<unsigned> &indices, const vector<Vector> &positions, unsigned target_triangles, vector<unsigned> &result)
+{
+	/* Work with a dense local numbering of the vertices the triangles use, so
+	the cost doesn't depend on the size of the whole vertex array. */
+	vector<unsigned> vertices(indices);
+	sort(vertices.begin(), vertices.end());
+	vertices.erase(unique(vertices.begin(), vertices.end()), vertices.end());
+	unsigned n_vertices = vertices.size();
+
+	result.resize(indices.size());
+	for(unsigned i=0; i<indices.size(); ++i)
+		result[i] = lower_bound(vertices.begin(), vertices.end(), indices[i])-vertices.begin();
+
+	vector<bool> locked(n_vertices, false);
+
+	// Vertices on seams have different attributes on each side
+	vector<unsigned> by_position(n_vertices);
+	for(unsigned i=0; i<n_vertices; ++i)
+		by_position[i] = i;
+	PositionLess position_less(positions, vertices);
+	sort(by_position.begin(), by_position.end(), position_less);
+	for(unsigned i=1; i<n_vertices; ++i)
+		if(!position_less(by_position[i-1], by_position[i]))
+			locked[by_position[i-1]] = locked[by_position[i]] = true;
+
+	// An edge is on a border if no triangle uses it in the opposite direction
+	vector<unsigned long long> edges;
+	edges.reserve(result.size());
+	for(unsigned i=0; i<result.size(); ++i)
+		edges.push_back(static_cast<unsigned long long>(result[i])<<32 | result[i-i%3+(i+1)%3]);
+	sort(edges.begin(), edges.end());
+	for(vector<unsigned long long>::const_iterator i=edges.begin(); i!=edges.end(); ++i)
+	{
+		unsigned a = *i>>32;
+		unsigned b = *i&0xFFFFFFFF;
+		if(!binary_search(edges.begin(), edges.end(), static_cast<unsigned long long>(b)<<32 | a))
+			locked[a] = locked[b] = true;
+	}
+
+	vector<Vector> local_positions(n_vertices);
+	for(unsigned i=0; i<n_vertices; ++i)
+		local_positions[i] = positions[vertices[i]];
+
+	vector<Quadric> quadrics(n_vertices);
+	for(unsigned i=0; i<result.size(); i+=3)
+	{
+		const Vector &p0 = local_positions[result[i]];
+		Vector normal = triangle_normal(p0, local_positions[result[i+1]], local_positions[result[i+2]]);
+		float area = normal.length()/2;
+		if(area<=0)
+			continue;
+
+		normal = normal*(0.5f/area);
+		for(unsigned j=0; j<3; ++j)
+			quadrics[result[i+j]].add_plane(normal, -normal.dot(p0), area);
+	}
+
+	double max_error = 0;
+	vector<Collapse> collapses;
+	vector<unsigned> offsets;
+	vector<unsigned> vertex_triangles;
+	vector<unsigned> remap(n_vertices);
+	vector<bool> touched(n_vertices);
+	while(result.size()/3>target_triangles)
+	{
+		/* Find the cheapest collapse for each edge.  Interior edges are used
+		by two triangles in opposite directions, so both directions get
+		considered. */
+		collapses.clear();
+		for(unsigned i=0; i<result.size(); ++i)
+		{
+			Collapse collapse;
+			collapse.from = result[i];
+			collapse.to = result[i-i%3+(i+1)%3];
+			if(locked[collapse.from])
+				continue;
+
+			const Vector &target = local_positions[collapse.to];
+			const Quadric &q_from = quadrics[collapse.from];
+			const Quadric &q_to = quadrics[collapse.to];
+			double weight = q_from.get_weight()+q_to.get_weight();
+			collapse.cost = (q_from.evaluate(target)+q_to.evaluate(target))/(weight>0 ? weight : 1);
+			collapses.push_back(collapse);
+		}
+		sort(collapses.begin(), collapses.end());
+
+		// Build a table of the triangles that use each vertex
+		offsets.assign(n_vertices+1, 0);
+		for(unsigned i=0; i<result.size(); ++i)
+			++offsets[result[i]+1];
+		for(unsigned i=0; i<n_vertices; ++i)
+			offsets[i+1] += offsets[i];
+		vertex_triangles.resize(offsets.back());
+		vector<unsigned> fill(offsets.begin(), offsets.end()-1);
+		for(unsigned i=0; i<result.size(); ++i)
+			vertex_triangles[fill[result[i]]++] = i/3;
+
+		/* Collapses change the triangles around the vertex being moved.  Other
+		collapses in the same pass must not involve any of those triangles,
+		because their shapes would no longer match what was checked. */
+		for(unsigned i=0; i<n_vertices; ++i)
+			remap[i] = i;
+		touched.assign(n_vertices, false);
+		unsigned n_removable = result.size()/3-target_triangles;
+		unsigned n_removed = 0;
+		for(vector<Collapse>::const_iterator i=collapses.begin(); (i!=collapses.end() && n_removed<n_removable); ++i)
+		{
+			if(touched[i->from] || touched[i->to])
+				continue;
+
+			// Reject collapses that would flip any remaining triangle over
+			bool flipped = false;
+			unsigned n_shared = 0;
+			for(unsigned j=offsets[i->from]; (!flipped && j<offsets[i->from+1]); ++j)
+			{
+				const unsigned *tri = &result[vertex_triangles[j]*3];
+				if(tri[0]==i->to || tri[1]==i->to || tri[2]==i->to)
+				{
+					++n_shared;
+					continue;
+				}
+
+				Vector p[3];
+				for(unsigned k=0; k<3; ++k)
+					p[k] = local_positions[tri[k]];
+				Vector before = triangle_normal(p[0], p[1], p[2]);
+				for(unsigned k=0; k<3; ++k)
+					if(tri[k]==i->from)
+						p[k] = local_positions[i->to];
+				Vector after = triangle_normal(p[0], p[1], p[2]);
+				if(before.dot(after)<=0 && before.dot(before)>0)
+					flipped = true;
+			}
+
+			if(flipped)
+				continue;
+
+			remap[i->from] = i->to;
+			quadrics[i->to].add(quadrics[i->from]);
+			max_error = max(max_error, i->cost);
+			n_removed += n_shared;
+			for(unsigned j=offsets[i->from]; j<offsets[i->from+1]; ++j)
+			{
+				const unsigned *tri = &result[vertex_triangles[j]*3];
+				for(unsigned k=0; k<3; ++k)
+					touched[tri[k]] = true;
+			}
+		}
+
+		if(!n_removed)
+			break;
+
+		// Apply the collapses and drop triangles that became degenerate
+		unsigned n_kept = 0;
+		for(unsigned i=0; i<result.size(); i+=3)
+		{
+			unsigned a = remap[result[i]];
+			unsigned b = remap[result[i+1]];
+			unsigned c = remap[result[i+2]];
+			if(a!=b && b!=c && c!=a)
+			{
+				result[n_kept++] = a;
+				result[n_kept++] = b;
+				result[n_kept++] = c;
+			}
+		}
+		result.resize(n_kept);
+	}
+
+	for(vector<unsigned>::iterator i=result.begin(); i!=result.end(); ++i)
+		*i = vertices[*i];
+
+	return sqrt(max_error);
+}
+
+float vertex_score(int cache_position, unsigned live_triangles)
+{
+	// Vertices with no triangles left are of no use
+	if(!live_triangles)
+		return -1.0f;
+
+	float score = 0.0f;
+	if(cache_position>=0)
+	{
+		/* The vertices of the most recent triangle get a fixed score, so the
+		next triangle doesn't needlessly prefer one of its edges. */
+		if(cache_position<3)
+			score = 0.75f;
+		else
+			score = pow(1.0f-(cache_position-3.0f)/(lru_cache_size-3.0f), 1.5f);
+	}
+
+	// Favor vertices with few triangles left, to get rid of lone triangles
+	score += 2.0f*pow(static_cast<float>(live_triangles), -0.5f);
+
+	return score;
+}
+
+Vector triangle_normal(const Vector &p0, const Vector &p1, const Vector &p2)
+{
+	return (p1-p0).cross(p2-p0);
+}
+
+
+Quadric::Quadric():
+	weight(0)
+{
+	for(unsigned i=0; i<10; ++i)
+		m[i] = 0;
+}
+
+void Quadric::add_plane(const Vector &normal, float distance, float w)
+{
+	double plane[4] = { normal.x, normal.y, normal.z, distance };
+	unsigned k = 0;
+	for(unsigned i=0; i<4; ++i)
+		for(unsigned j=i; j<4; ++j)
+			m[k++] += plane[i]*plane[j]*w;
+	weight += w;
+}
+
+void Quadric::add(const Quadric &other)
+{
+	for(unsigned i=0; i<10; ++i)
+		m[i] += other.m[i];
+	weight += other.weight;
+}
+
+double Quadric::evaluate(const Vector &point) const
+{
+	// Off-diagonal elements appear twice in the full matrix
+	double v[4] = { point.x, point.y, point.z, 1 };
+	double result = 0;
+	unsigned k = 0;
+	for(unsigned i=0; i<4; ++i)
+		for(unsigned j=i; j<4; ++j)
+			result += m[k++]*v[i]*v[j]*(i==j ? 1 : 2);
+	return result;
+}
+
+
+bool PositionLess::operator()(unsigned a, unsigned b) const
+{
+	const Vector &pa = positions[vertices[a]];
+	const Vector &pb = positions[vertices[b]];
+	if(pa.x!=pb.x)
+		return pa.x<pb.x;
+	if(pa.y!=pb.y)
+		return pa.y<pb.y;
+	return pa.z<pb.z;
+}
+
+} // namespace SkrolliGL
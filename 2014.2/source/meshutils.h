@@ -0,0 +1,52 @@
+#ifndef SKROLLIGL_MESHUTILS_H_
+#define SKROLLIGL_MESHUTILS_H_
+
+#include <vector>
+#include "mathutils.h"
+
+namespace SkrolliGL {
+
+/*
+Describes how efficiently an index sequence uses the GPU's post-transform
+vertex cache.  The cache is modeled as a FIFO, which is what most hardware
+implements.
+*/
+struct VertexCacheStats
+{
+	/* Average cache miss ratio: the number of vertex shader invocations per
+	triangle.  The ideal value for a regular grid approaches 0.5. */
+	float acmr;
+
+	/* Average transform to vertex ratio: the number of vertex shader
+	invocations per unique vertex.  The ideal value is 1.0. */
+	float atvr;
+
+	VertexCacheStats(): acmr(0), atvr(0) { }
+};
+
+/* Simulates the post-transform vertex cache for an index sequence.  For
+triangle strips, the index 0xFFFFFFFF is treated as a primitive restart. */
+VertexCacheStats analyze_vertex_cache(const std::vector<unsigned> &, bool strip, unsigned n_vertices);
+
+/* Reorders the triangles of an indexed triangle list to improve vertex cache
+hit rate.  Uses Tom Forsyth's linear-speed vertex cache optimization. */
+void optimize_vertex_cache(std::vector<unsigned> &, unsigned n_vertices);
+
+/* Computes a vertex order in which vertices appear in the same order as they
+are first referenced by the indices, and rewrites the indices to match.
+remap[old_index] receives the new index of each vertex; unreferenced vertices
+are moved to the end.  Restart indices are left untouched. */
+void optimize_vertex_fetch(std::vector<unsigned> &, std::vector<unsigned> &remap, unsigned n_vertices);
+
+/* Simplifies an indexed triangle list by collapsing edges until it has at most
+target_triangles triangles or no more edges can be collapsed.  Each collapse
+moves one end of an edge onto the other using quadric error metrics, so no new
+vertices are created and the result can share the original vertex array.
+Vertices on open borders and seams, where several vertices share a position,
+are kept in place to avoid cracks.  Returns an estimate of the distance between
+the simplified and the original surface. */
+float simplify_triangles(const std::vector<unsigned> &, const std::vector<Vector> &positions, unsigned target_triangles, std::vector<unsigned> &result);
+
+} // namespace SkrolliGL
+
+#endif
@@ -1,93 +1,469 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
-#include <sstream>
 #include <stdexcept>
-#include <cstdlib>
+#include <sys/stat.h>
 #include <GL/glew.h>
+#include "geometryarena.h"
+#include "mappedfile.h"
 #include "material.h"
 #include "object.h"
-#include "shader.h"
+#include "objparser.h"
+#include "primitivebuilder.h"
+#include "renderqueue.h"
 #include "texture.h"
 
 using namespace std;
 
 namespace SkrolliGL {
 
-struct VertexRef
+/* Layout of the binary cache file.  The header is followed by a table of
+submeshes and their material names, padded to a multiple of four bytes, then
+the vertices and the indices.  The version must be incremented whenever the
+layout or the contents change. */
+struct MeshCacheHeader
 {
-	int vertex;
-	int normal;
-	int texcoord;
-
-	VertexRef();
-
-	bool operator<(const VertexRef &) const;
+	char magic[4];
+	unsigned version;
+	unsigned options;
+	unsigned primitive_type;
+	unsigned vertex_format;
+	unsigned unorm_texcoords;
+	unsigned index_size;
+	Matrix position_matrix;
+	Bounds bounds;
+	unsigned n_vertices;
+	unsigned n_indices;
+	unsigned n_submeshes;
+	unsigned n_detail_levels;
+	VertexCacheStats strip_stats;
+	VertexCacheStats list_stats;
 };
 
-struct Face
+/* Detail levels follow the submesh table.  There's an error for each level,
+then a range for each submesh of each level.  The ranges use the same layout as
+submeshes, with no material names. */
+struct MeshCacheSubMesh
 {
-	unsigned char nverts;
-	bool used;
-	unsigned indices[4];
+	unsigned first;
+	unsigned count;
+	unsigned material_name_length;
+};
+
+const char cache_magic[4] = { 'S', 'G', 'L', 'M' };
+const unsigned cache_version = 7;
+
+// Each detail level has about half the triangles of the previous one
+const unsigned max_detail_levels = 8;
 
-	Face();
+/* Vertex layout for HALF_VERTICES and SNORM16_VERTICES.  The fourth position
+component is padding to keep the normal aligned. */
+struct CompactVertex
+{
+	unsigned short position[4];
+	unsigned normal;
+	unsigned short texcoord[2];
 };
 
-istream &operator>>(istream &, VertexRef &);
+typedef ObjParser::Face Face;
+
+template<typename T>
+static const T *vector_data(const vector<T> &);
+static bool compact_vertices_supported();
+static unsigned short float_to_half(float);
+static unsigned short float_to_snorm16(float);
+static unsigned short float_to_unorm16(float);
+static unsigned pack_normal(float, float, float);
+static float half_to_float(unsigned short);
+static Vector unpack_normal(unsigned);
+static unsigned encode_load_options(const Object::LoadOptions &);
+static bool is_newer(const string &, const string &);
+static bool is_valid_range(const MeshCacheSubMesh &, unsigned);
+static bool are_valid_indices(const void *, unsigned, unsigned, unsigned);
+static void optimize_submesh_caches(vector<unsigned> &, const vector<Object::SubMesh> &, unsigned);
+static void build_detail_levels(const vector<unsigned> &, const vector<Object::SubMesh> &, const vector<Object::Vertex> &, vector<unsigned> &, vector<Object::DetailLevel> &);
 
 
+Object::LoadOptions Object::load_options;
+float Object::detail_threshold = 0.001f;
+map<unsigned, GeometryArena *> Object::arenas;
+
 Object::Object():
+	arena(0),
+	first_vertex(0),
+	first_index(0),
+	n_vertices(0),
 	n_indices(0),
-	material(0)
+	index_size(4),
+	primitive_type(TRIANGLE_STRIP),
+	vertex_format(FLOAT_VERTICES),
+	unorm_texcoords(false)
+{ }
+
+Object::~Object()
 {
-	// Create vertex array object first.
-	glGenVertexArrays(1, &vertex_array_id);
-	glBindVertexArray(vertex_array_id);
+	release_geometry();
+}
 
-	// Create a buffer and transfer the vertex data into it.
-	glGenBuffers(1, &vertex_buffer_id);
+void Object::set_load_options(const LoadOptions &opts)
+{
+	load_options = opts;
+}
 
-	// Ditto for index data.
-	glGenBuffers(1, &index_buffer_id);
+void Object::set_detail_threshold(float t)
+{
+	detail_threshold = t;
 }
 
-Object::~Object()
+GeometryArena &Object::get_arena() const
+{
+	// Everything which affects the attribute arrays or the index type
+	unsigned key = vertex_format*4+unorm_texcoords*2+(index_size==2);
+	GeometryArena *&result = arenas[key];
+	if(result)
+		return *result;
+
+	vector<GeometryArena::Attribute> attribs;
+	if(vertex_format==FLOAT_VERTICES)
+	{
+		attribs.push_back(GeometryArena::Attribute(POSITION, 3, GL_FLOAT, false, offsetof(Vertex, x)));
+		attribs.push_back(GeometryArena::Attribute(NORMAL, 3, GL_FLOAT, false, offsetof(Vertex, nx)));
+		attribs.push_back(GeometryArena::Attribute(TEXCOORD, 2, GL_FLOAT, false, offsetof(Vertex, u)));
+	}
+	else
+	{
+		bool snorm = (vertex_format==SNORM16_VERTICES);
+		attribs.push_back(GeometryArena::Attribute(POSITION, 3, (snorm ? GL_SHORT : GL_HALF_FLOAT), snorm, offsetof(CompactVertex, position)));
+		attribs.push_back(GeometryArena::Attribute(NORMAL, 4, GL_INT_2_10_10_10_REV, true, offsetof(CompactVertex, normal)));
+		attribs.push_back(GeometryArena::Attribute(TEXCOORD, 2, (unorm_texcoords ? GL_UNSIGNED_SHORT : GL_HALF_FLOAT), unorm_texcoords, offsetof(CompactVertex, texcoord)));
+	}
+
+	result = new GeometryArena(get_vertex_size(), attribs, index_size);
+	return *result;
+}
+
+void Object::release_geometry()
+{
+	if(!arena)
+		return;
+
+	arena->free_vertices(first_vertex, n_vertices);
+	arena->free_indices(first_index, n_indices);
+
+	// Free the memory of arenas which are no longer used
+	if(arena->empty())
+	{
+		for(map<unsigned, GeometryArena *>::iterator i=arenas.begin(); i!=arenas.end(); ++i)
+			if(i->second==arena)
+			{
+				arenas.erase(i);
+				break;
+			}
+		delete arena;
+	}
+
+	arena = 0;
+}
+
+void Object::set_vertex_format(VertexFormat f)
 {
-	glDeleteVertexArrays(1, &vertex_array_id);
-	glDeleteBuffers(1, &vertex_buffer_id);
-	glDeleteBuffers(1, &index_buffer_id);
+	vertex_format = f;
 }
 
-void Object::set_attrib_array(unsigned index, unsigned size, float Vertex::*member)
+unsigned Object::get_vertex_size() const
 {
-	// Use a dummy Vertex to compute member offsets
-	static Vertex dummy;
-	const char *offset_base = reinterpret_cast<const char *>(&dummy);
-	unsigned offset = reinterpret_cast<const char *>(&(dummy.*member))-offset_base;
-	glVertexAttribPointer(index, size, GL_FLOAT, false, sizeof(Vertex), reinterpret_cast<void *>(offset));
-	glEnableVertexAttribArray(index);
+	return (vertex_format==FLOAT_VERTICES ? sizeof(Vertex) : sizeof(CompactVertex));
 }
 
-void Object::set_data(const vector<Vertex> &vertices, const vector<unsigned> &indices)
+void Object::set_data(const vector<Vertex> &vertices, const vector<unsigned> &indices, PrimitiveType type)
 {
-	// Transfer vertex data to vertex buffer ...
-	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_id);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size()*sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+	vector<char> packed;
+	pack_vertices(vertices, packed);
+	vector<char> packed_indices;
+	pack_indices(indices, vertices.size(), packed_indices);
+	upload(vector_data(packed), vertices.size(), vector_data(packed_indices), indices.size(), type);
+
+	SubMesh submesh;
+	submesh.material = get_material();
+	submesh.count = indices.size();
+	submeshes.assign(1, submesh);
+	detail_levels.clear();
+}
+
+void Object::pack_vertices(const vector<Vertex> &vertices, vector<char> &packed)
+{
+	if(vertex_format!=FLOAT_VERTICES && !compact_vertices_supported())
+		vertex_format = FLOAT_VERTICES;
+
+	position_matrix = Matrix();
+	unorm_texcoords = false;
+	bounds = Bounds();
+	if(vertices.empty())
+	{
+		packed.clear();
+		return;
+	}
 
-	// ... and index data to index buffer.
-	n_indices = indices.size();
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer_id);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, n_indices*sizeof(unsigned), &indices[0], GL_STATIC_DRAW);
+	// Find the bounding box of the positions
+	Vector low(vertices[0].x, vertices[0].y, vertices[0].z);
+	Vector high = low;
+	for(vector<Vertex>::const_iterator i=vertices.begin(); i!=vertices.end(); ++i)
+	{
+		low = Vector(min(low.x, i->x), min(low.y, i->y), min(low.z, i->z));
+		high = Vector(max(high.x, i->x), max(high.y, i->y), max(high.z, i->z));
+	}
+
+	// The sphere around the box corners is often much larger than necessary
+	bounds = Bounds(low, high);
+	float radius = 0;
+	for(vector<Vertex>::const_iterator i=vertices.begin(); i!=vertices.end(); ++i)
+		radius = max(radius, (Vector(i->x, i->y, i->z)-bounds.get_center()).length());
+	bounds.set_sphere(bounds.get_center(), radius);
 
-	// Set up attribute arrays.  This can't be done before the buffer has some
-	// data in it.
-	set_attrib_array(POSITION, 3, &Vertex::x);
-	set_attrib_array(NORMAL, 3, &Vertex::nx);
-	set_attrib_array(TEXCOORD, 2, &Vertex::u);
+	if(vertex_format==FLOAT_VERTICES)
+	{
+		const char *data = reinterpret_cast<const char *>(&vertices[0]);
+		packed.assign(data, data+vertices.size()*sizeof(Vertex));
+		return;
+	}
+
+	// Find the range of texcoords
+	unorm_texcoords = true;
+	for(vector<Vertex>::const_iterator i=vertices.begin(); i!=vertices.end(); ++i)
+		if(i->u<0 || i->u>1 || i->v<0 || i->v>1)
+		{
+			unorm_texcoords = false;
+			break;
+		}
+
+	/* Positions are stored in the range [-1, 1] around the center of the
+	bounding box.  The scale is the same on all axes, so that normals
+	transformed by the model matrix keep their direction. */
+	Vector center = (low+high)*0.5f;
+	float extent = max(max(high.x-low.x, high.y-low.y), high.z-low.z)*0.5f;
+	if(extent<=0)
+		extent = 1;
+	position_matrix = Matrix::translation(center)*Matrix::scaling(extent);
+
+	packed.resize(vertices.size()*sizeof(CompactVertex));
+	CompactVertex *out = reinterpret_cast<CompactVertex *>(&packed[0]);
+	for(vector<Vertex>::const_iterator i=vertices.begin(); i!=vertices.end(); ++i, ++out)
+	{
+		Vector pos = (Vector(i->x, i->y, i->z)-center)*(1/extent);
+		if(vertex_format==HALF_VERTICES)
+		{
+			out->position[0] = float_to_half(pos.x);
+			out->position[1] = float_to_half(pos.y);
+			out->position[2] = float_to_half(pos.z);
+		}
+		else
+		{
+			out->position[0] = float_to_snorm16(pos.x);
+			out->position[1] = float_to_snorm16(pos.y);
+			out->position[2] = float_to_snorm16(pos.z);
+		}
+		out->position[3] = 0;
+
+		out->normal = pack_normal(i->nx, i->ny, i->nz);
+
+		// Texcoords outside [0, 1] are used for tiling and need half floats
+		if(unorm_texcoords)
+		{
+			out->texcoord[0] = float_to_unorm16(i->u);
+			out->texcoord[1] = float_to_unorm16(i->v);
+		}
+		else
+		{
+			out->texcoord[0] = float_to_half(i->u);
+			out->texcoord[1] = float_to_half(i->v);
+		}
+	}
+}
+
+void Object::pack_indices(const vector<unsigned> &indices, unsigned n_vertices, vector<char> &packed)
+{
+	// The largest 16-bit value is reserved for primitive restart
+	if(n_vertices>=0xFFFF)
+	{
+		index_size = 4;
+		const char *data = reinterpret_cast<const char *>(vector_data(indices));
+		packed.assign(data, data+indices.size()*sizeof(unsigned));
+		return;
+	}
+
+	index_size = 2;
+	packed.resize(indices.size()*sizeof(unsigned short));
+	if(packed.empty())
+		return;
+
+	unsigned short *out = reinterpret_cast<unsigned short *>(&packed[0]);
+	for(vector<unsigned>::const_iterator i=indices.begin(); i!=indices.end(); ++i)
+		*out++ = (*i==0xFFFFFFFF ? 0xFFFF : *i);
+}
+
+void Object::get_data(vector<Vertex> &vertices, vector<unsigned> &indices) const
+{
+	vertices.resize(n_vertices);
+	indices.resize(n_indices);
+	if(!n_vertices || !n_indices)
+		return;
+
+	vector<char> packed(n_vertices*get_vertex_size());
+	arena->read_vertices(first_vertex, n_vertices, &packed[0]);
+
+	if(vertex_format==FLOAT_VERTICES)
+		copy(packed.begin(), packed.end(), reinterpret_cast<char *>(&vertices[0]));
+	else
+	{
+		const CompactVertex *in = reinterpret_cast<const CompactVertex *>(&packed[0]);
+		for(vector<Vertex>::iterator i=vertices.begin(); i!=vertices.end(); ++i, ++in)
+		{
+			Vector pos;
+			if(vertex_format==HALF_VERTICES)
+				pos = Vector(half_to_float(in->position[0]), half_to_float(in->position[1]), half_to_float(in->position[2]));
+			else
+			{
+				const short *snorm = reinterpret_cast<const short *>(in->position);
+				pos = Vector(max(snorm[0]/32767.0f, -1.0f), max(snorm[1]/32767.0f, -1.0f), max(snorm[2]/32767.0f, -1.0f));
+			}
+			pos = position_matrix.transform(pos);
+			i->x = pos.x;
+			i->y = pos.y;
+			i->z = pos.z;
+
+			Vector normal = unpack_normal(in->normal);
+			i->nx = normal.x;
+			i->ny = normal.y;
+			i->nz = normal.z;
+
+			if(unorm_texcoords)
+			{
+				i->u = in->texcoord[0]/65535.0f;
+				i->v = in->texcoord[1]/65535.0f;
+			}
+			else
+			{
+				i->u = half_to_float(in->texcoord[0]);
+				i->v = half_to_float(in->texcoord[1]);
+			}
+		}
+	}
+
+	if(index_size==2)
+	{
+		vector<unsigned short> short_indices(n_indices);
+		arena->read_indices(first_index, n_indices, &short_indices[0]);
+		for(unsigned i=0; i<n_indices; ++i)
+			indices[i] = (short_indices[i]==0xFFFF ? 0xFFFFFFFF : short_indices[i]);
+	}
+	else
+		arena->read_indices(first_index, n_indices, &indices[0]);
+}
+
+void Object::upload(const void *vertices, unsigned vertex_count, const void *indices, unsigned count, PrimitiveType type)
+{
+	primitive_type = type;
+
+	// The bounds have been computed for the new vertices by now
+	bounds_changed();
+
+	/* Arenas are deleted as soon as nothing is allocated from them, so an
+	empty Object must not refer to one. */
+	if(!vertex_count && !count)
+	{
+		release_geometry();
+		n_vertices = 0;
+		n_indices = 0;
+		return;
+	}
+
+	/* Allocate the new ranges before releasing the old ones, so the arena
+	isn't deleted and recreated if it's the same. */
+	GeometryArena &new_arena = get_arena();
+	unsigned new_first_vertex = new_arena.allocate_vertices(vertex_count);
+	unsigned new_first_index = new_arena.allocate_indices(count);
+	release_geometry();
+
+	arena = &new_arena;
+	first_vertex = new_first_vertex;
+	first_index = new_first_index;
+	n_vertices = vertex_count;
+	n_indices = count;
+	arena->write_vertices(first_vertex, n_vertices, vertices);
+	arena->write_indices(first_index, n_indices, indices);
+}
+
+void Object::set_submeshes(const vector<SubMesh> &s)
+{
+	submeshes = s;
+	detail_levels.clear();
 }
 
 void Object::set_material(Material *m)
 {
-	material = m;
+	// An empty submesh keeps the Material until set_data is called
+	if(submeshes.empty())
+		submeshes.push_back(SubMesh());
+
+	for(vector<SubMesh>::iterator i=submeshes.begin(); i!=submeshes.end(); ++i)
+		i->material = m;
+	for(vector<DetailLevel>::iterator i=detail_levels.begin(); i!=detail_levels.end(); ++i)
+		for(vector<SubMesh>::iterator j=i->submeshes.begin(); j!=i->submeshes.end(); ++j)
+			j->material = m;
+}
+
+Material *Object::get_material() const
+{
+	return submeshes.empty() ? 0 : submeshes.front().material;
+}
+
+void Object::set_occluder(const vector<Vector> &vertices, const vector<unsigned> &indices)
+{
+	occluder_vertices = vertices;
+	occluder_indices = indices;
+}
+
+void Object::build_occluder(float max_error)
+{
+	vector<Vertex> vertices;
+	vector<unsigned> indices;
+	get_data(vertices, indices);
+
+	unsigned level = 0;
+	for(; (level<detail_levels.size() && detail_levels[level].error<=max_error); ++level) ;
+	const vector<SubMesh> &ranges = (level ? detail_levels[level-1].submeshes : submeshes);
+	bool strips = (primitive_type==TRIANGLE_STRIP && !level);
+
+	// Only keep the vertices that the chosen triangles use
+	vector<unsigned> remap(vertices.size(), 0xFFFFFFFF);
+	occluder_vertices.clear();
+	occluder_indices.clear();
+	for(vector<SubMesh>::const_iterator i=ranges.begin(); i!=ranges.end(); ++i)
+		for(unsigned j=0; j+2<i->count; j+=(strips ? 1 : 3))
+		{
+			// Strips have restarts and degenerate triangles to skip
+			const unsigned *tri = &indices[i->first+j];
+			if(tri[0]==0xFFFFFFFF || tri[1]==0xFFFFFFFF || tri[2]==0xFFFFFFFF)
+				continue;
+			if(tri[0]==tri[1] || tri[1]==tri[2] || tri[2]==tri[0])
+				continue;
+
+			// Winding doesn't matter, since occluders are drawn from both sides
+			for(unsigned k=0; k<3; ++k)
+			{
+				unsigned &index = remap[tri[k]];
+				if(index==0xFFFFFFFF)
+				{
+					const Vertex &v = vertices[tri[k]];
+					index = occluder_vertices.size();
+					occluder_vertices.push_back(Vector(v.x, v.y, v.z));
+				}
+				occluder_indices.push_back(index);
+			}
+		}
 }
 
 void Object::load(const ResourceManager &manager, const string &filename)
@@ -95,247 +471,594 @@ void Object::load(const ResourceManager &manager, const string &filename)
 	string::size_type dot = filename.rfind('.');
 	string ext = filename.substr(dot);
 	if(ext==".obj")
-		load_obj(manager, filename);
+	{
+		// Try the binary cache first and fall back to parsing the text file
+		string cache_filename = filename+".cache";
+		if(!is_newer(cache_filename, filename) || !load_cache(manager, cache_filename))
+			load_obj(manager, filename);
+	}
 	else
 		throw runtime_error("Don't know how to load "+filename);
 }
 
 void Object::load_obj(const ResourceManager &manager, const string &filename)
 {
-	ifstream input(filename.c_str());
-	string line;
-	vector<Vector> positions;
-	vector<Vector> texcoords;
-	vector<Vector> normals;
-	map<VertexRef, unsigned> vertex_map;
+	MappedFile file(filename);
+	ObjParser parser(load_options.parse_threads);
+	parser.parse(file.begin(), file.end());
 
-	vector<Vertex> vertices;
-	vector<Face> faces;
+	const vector<Vertex> &vertices = parser.get_vertices();
+	vector<Face> faces = parser.get_faces();
+	const vector<string> &material_names = parser.get_material_names();
+	vector<Material *> materials;
+	for(vector<string>::const_iterator i=material_names.begin(); i!=material_names.end(); ++i)
+		materials.push_back(i->empty() ? 0 : &manager.get<Material>(*i+".mat"));
 
-	while(getline(input, line))
-	{
-		// Lines starting with # are comments
-		if(line[0]=='#')
-			continue;
+	// Build both primitive types so they can be compared
+	sort_faces(faces, material_names.size());
+	vector<unsigned> strip_indices;
+	vector<SubMesh> strip_ranges(material_names.size());
+	build_triangle_strips(faces, vertices.size(), strip_indices, strip_ranges);
+	vector<unsigned> list_indices;
+	vector<SubMesh> list_ranges(material_names.size());
+	build_triangle_list(strip_indices, strip_ranges, list_indices, list_ranges);
+	optimize_submesh_caches(list_indices, list_ranges, vertices.size());
 
-		istringstream parse(line);
-		string command;
-		parse >> command;
+	topology_stats.strip = analyze_vertex_cache(strip_indices, true, vertices.size());
+	topology_stats.list = analyze_vertex_cache(list_indices, false, vertices.size());
 
-		if(command=="o")
-			throw runtime_error("Multiple objects per file not supported");
+	PrimitiveType type = load_options.primitive_type;
+	if(load_options.auto_primitive_type)
+		type = (topology_stats.list.acmr<topology_stats.strip.acmr ? TRIANGLES : TRIANGLE_STRIP);
+	vector<unsigned> &indices = (type==TRIANGLES ? list_indices : strip_indices);
+	vector<SubMesh> &ranges = (type==TRIANGLES ? list_ranges : strip_ranges);
 
-		if(command=="v")  // Vertex coordinate
-		{
-			Vector v;
-			parse >> v.x >> v.y >> v.z;
-			positions.push_back(v);
-		}
-		else if(command=="vt")  // Texture coordinate
-		{
-			Vector vt;
-			parse >> vt.x >> vt.y;
-			texcoords.push_back(vt);
-		}
-		else if(command=="vn")  // Vertex normal
+	// Store vertices in the order they are used, to help the vertex fetcher
+	vector<unsigned> remap;
+	optimize_vertex_fetch(indices, remap, vertices.size());
+	vector<Vertex> ordered_vertices(vertices.size());
+	for(unsigned i=0; i<vertices.size(); ++i)
+		ordered_vertices[remap[i]] = vertices[i];
+
+	// Detail levels are built from the triangle lists, with the final vertex order
+	vector<DetailLevel> levels;
+	if(load_options.build_detail_levels)
+	{
+		if(type!=TRIANGLES)
 		{
-			Vector vn;
-			parse >> vn.x >> vn.y >> vn.z;
-			normals.push_back(vn);
+			for(vector<unsigned>::iterator i=list_indices.begin(); i!=list_indices.end(); ++i)
+				*i = remap[*i];
 		}
-		else if(command=="f")  // Face
+		build_detail_levels(list_indices, list_ranges, ordered_vertices, indices, levels);
+	}
+
+	vertex_format = load_options.vertex_format;
+	vector<char> packed;
+	pack_vertices(ordered_vertices, packed);
+	vector<char> packed_indices;
+	pack_indices(indices, ordered_vertices.size(), packed_indices);
+	upload(vector_data(packed), ordered_vertices.size(), vector_data(packed_indices), indices.size(), type);
+
+	// Materials that were named but had no faces don't need a submesh
+	submeshes.clear();
+	detail_levels.assign(levels.size(), DetailLevel());
+	vector<string> submesh_names;
+	for(unsigned i=0; i<ranges.size(); ++i)
+		if(ranges[i].count)
 		{
-			Face face;
-			for(unsigned i=0; i<4; ++i)
+			ranges[i].material = materials[i];
+			submeshes.push_back(ranges[i]);
+			submesh_names.push_back(material_names[i]);
+			for(unsigned j=0; j<levels.size(); ++j)
 			{
-				/* WaveFront OBJ references vertex attributes separately, so we
-				must do a little dance to make them suitable for OpenGL. */
-				VertexRef vref;
-				if(!(parse >> vref))
-					break;
-
-				// Have we used this combination of attributes before?
-				map<VertexRef, unsigned>::iterator j = vertex_map.find(vref);
-				unsigned index;
-				if(j!=vertex_map.end())
-					index = j->second;
-				else
-				{
-					// Create a new vertex and use it
-					Vertex vertex;
-					if(vref.vertex>=0)
-					{
-						vertex.x = positions[vref.vertex].x;
-						vertex.y = positions[vref.vertex].y;
-						vertex.z = positions[vref.vertex].z;
-					}
-					if(vref.normal>=0)
-					{
-						vertex.nx = normals[vref.normal].x;
-						vertex.ny = normals[vref.normal].y;
-						vertex.nz = normals[vref.normal].z;
-					}
-					if(vref.texcoord>=0)
-					{
-						vertex.u = texcoords[vref.texcoord].x;
-						vertex.v = texcoords[vref.texcoord].y;
-					}
-					vertices.push_back(vertex);
-					index = vertices.size()-1;
-					vertex_map[vref] = index;
-				}
-
-				face.indices[i] = index;
-				++face.nverts;
+				levels[j].submeshes[i].material = materials[i];
+				detail_levels[j].submeshes.push_back(levels[j].submeshes[i]);
 			}
-			faces.push_back(face);
 		}
-		else if(command=="usemtl")  // Material information
+	for(unsigned i=0; i<levels.size(); ++i)
+		detail_levels[i].error = levels[i].error;
+
+	save_cache(filename+".cache", packed, ordered_vertices.size(), packed_indices, indices.size(), submesh_names);
+}
+
+bool Object::load_cache(const ResourceManager &manager, const string &filename)
+{
+	MappedFile file(filename);
+	if(file.get_size()<sizeof(MeshCacheHeader))
+		return false;
+
+	// A cache from a different version or with different options is stale
+	const MeshCacheHeader &header = *reinterpret_cast<const MeshCacheHeader *>(file.begin());
+	if(memcmp(header.magic, cache_magic, 4) || header.version!=cache_version)
+		return false;
+	if(header.options!=encode_load_options(load_options))
+		return false;
+	if(header.vertex_format!=FLOAT_VERTICES && !compact_vertices_supported())
+		return false;
+
+	if(header.primitive_type>TRIANGLES || header.vertex_format>SNORM16_VERTICES)
+		return false;
+	if(header.index_size!=2 && header.index_size!=4)
+		return false;
+
+	vertex_format = static_cast<VertexFormat>(header.vertex_format);
+	unorm_texcoords = header.unorm_texcoords;
+	position_matrix = header.position_matrix;
+	bounds = header.bounds;
+	index_size = header.index_size;
+
+	unsigned long table_size = header.n_submeshes*sizeof(MeshCacheSubMesh);
+	unsigned long levels_size = header.n_detail_levels*(sizeof(float)+table_size);
+	if(file.get_size()<sizeof(MeshCacheHeader)+table_size+levels_size)
+		return false;
+
+	const MeshCacheSubMesh *table = reinterpret_cast<const MeshCacheSubMesh *>(file.begin()+sizeof(MeshCacheHeader));
+	unsigned long names_size = 0;
+	for(unsigned i=0; i<header.n_submeshes; ++i)
+		names_size += table[i].material_name_length;
+	names_size = (names_size+3)&~3UL;
+
+	// Widen the counts so that huge values can't wrap around to the right size
+	unsigned long vertices_size = static_cast<unsigned long>(header.n_vertices)*get_vertex_size();
+	unsigned long indices_size = static_cast<unsigned long>(header.n_indices)*index_size;
+	unsigned long expected_size = sizeof(MeshCacheHeader)+table_size+levels_size+names_size+vertices_size+indices_size;
+	if(file.get_size()!=expected_size)
+		return false;
+
+	/* A damaged cache could otherwise make the GL read outside the vertex and
+	index data.  Checking the indices costs little next to uploading them. */
+	const float *errors = reinterpret_cast<const float *>(table+header.n_submeshes);
+	const MeshCacheSubMesh *level_table = reinterpret_cast<const MeshCacheSubMesh *>(errors+header.n_detail_levels);
+	for(unsigned i=0; i<header.n_submeshes; ++i)
+		if(!is_valid_range(table[i], header.n_indices))
+			return false;
+	for(unsigned i=0; i<header.n_detail_levels*header.n_submeshes; ++i)
+		if(!is_valid_range(level_table[i], header.n_indices))
+			return false;
+	const char *vertices = file.begin()+sizeof(MeshCacheHeader)+table_size+levels_size+names_size;
+	const char *indices = vertices+vertices_size;
+	if(!are_valid_indices(indices, header.n_indices, index_size, header.n_vertices))
+		return false;
+
+	const char *ptr = file.begin()+sizeof(MeshCacheHeader)+table_size+levels_size;
+	submeshes.clear();
+	for(unsigned i=0; i<header.n_submeshes; ++i)
+	{
+		SubMesh submesh;
+		if(table[i].material_name_length)
+			submesh.material = &manager.get<Material>(string(ptr, table[i].material_name_length)+".mat");
+		submesh.first = table[i].first;
+		submesh.count = table[i].count;
+		submeshes.push_back(submesh);
+		ptr += table[i].material_name_length;
+	}
+
+	detail_levels.assign(header.n_detail_levels, DetailLevel());
+	for(unsigned i=0; i<header.n_detail_levels; ++i)
+	{
+		detail_levels[i].error = errors[i];
+		detail_levels[i].submeshes = submeshes;
+		for(unsigned j=0; j<header.n_submeshes; ++j, ++level_table)
 		{
-			string name;
-			parse >> name;
-			set_material(&manager.get<Material>(name+".mat"));
+			detail_levels[i].submeshes[j].first = level_table->first;
+			detail_levels[i].submeshes[j].count = level_table->count;
 		}
 	}
 
-	// Construct index array for triangle strips
-	vector<unsigned> indices;
-	indices.reserve(faces.size()*4);
-	while(1)
-	{
-		// Search for an unused face
-		vector<Face>::iterator face;
-		for(face=faces.begin(); face!=faces.end(); ++face)
-			if(!face->used)
-				break;
+	topology_stats.strip = header.strip_stats;
+	topology_stats.list = header.list_stats;
 
-		// Have all faces been processed?
-		if(face==faces.end())
-			break;
+	// The data goes to the GL straight from the mapped pages
+	upload(vertices, header.n_vertices, indices, header.n_indices, static_cast<PrimitiveType>(header.primitive_type));
+
+	return true;
+}
+
+void Object::save_cache(const string &filename, const vector<char> &vertices, unsigned n_vertices, const vector<char> &indices, unsigned count, const vector<string> &material_names) const
+{
+	MeshCacheHeader header;
+	memcpy(header.magic, cache_magic, 4);
+	header.version = cache_version;
+	header.options = encode_load_options(load_options);
+	header.primitive_type = primitive_type;
+	header.vertex_format = vertex_format;
+	header.unorm_texcoords = unorm_texcoords;
+	header.index_size = index_size;
+	header.position_matrix = position_matrix;
+	header.bounds = bounds;
+	header.n_vertices = n_vertices;
+	header.n_indices = count;
+	header.n_submeshes = submeshes.size();
+	header.n_detail_levels = detail_levels.size();
+	header.strip_stats = topology_stats.strip;
+	header.list_stats = topology_stats.list;
+
+	/* Write to a temporary file and rename it into place, so that a partially
+	written cache is never picked up. */
+	string temp_filename = filename+".tmp";
+	ofstream out(temp_filename.c_str(), ios::binary);
+	if(!out)
+		return;
 
-		// Inject restart index if this is not the first strip
-		if(!indices.empty())
-			indices.push_back(0xFFFFFFFF);
+	out.write(reinterpret_cast<const char *>(&header), sizeof(header));
 
-		// Add the initial face's indices to the strip
-		face->used = true;
-		indices.push_back(face->indices[0]);
-		indices.push_back(face->indices[1]);
-		if(face->nverts==4)
-			indices.push_back(face->indices[3]);
-		indices.push_back(face->indices[2]);
+	unsigned names_size = 0;
+	for(unsigned i=0; i<submeshes.size(); ++i)
+	{
+		MeshCacheSubMesh entry;
+		entry.first = submeshes[i].first;
+		entry.count = submeshes[i].count;
+		entry.material_name_length = material_names[i].size();
+		out.write(reinterpret_cast<const char *>(&entry), sizeof(entry));
+		names_size += entry.material_name_length;
+	}
 
-		unsigned triangle_count = face->nverts-2;
-		while(1)
+	for(unsigned i=0; i<detail_levels.size(); ++i)
+		out.write(reinterpret_cast<const char *>(&detail_levels[i].error), sizeof(float));
+	for(unsigned i=0; i<detail_levels.size(); ++i)
+		for(unsigned j=0; j<submeshes.size(); ++j)
 		{
-			unsigned last_index = indices.back();
-			unsigned prev_index = indices[indices.size()-2];
-			if(triangle_count%2)
-				swap(last_index, prev_index);
-
-			// Try to find a face that uses the last two indices in the correct order
-			vector<Face>::iterator next;
-			unsigned i;
-			for(next=faces.begin(); next!=faces.end(); ++next)
-				if(!next->used)
-				{
-					for(i=0; i<next->nverts; ++i)
-						if(next->indices[i]==prev_index)
-							break;
+			MeshCacheSubMesh entry;
+			entry.first = detail_levels[i].submeshes[j].first;
+			entry.count = detail_levels[i].submeshes[j].count;
+			entry.material_name_length = 0;
+			out.write(reinterpret_cast<const char *>(&entry), sizeof(entry));
+		}
 
-					if(i>=next->nverts)
-						continue;
+	const char padding[4] = { 0, 0, 0, 0 };
+	for(unsigned i=0; i<material_names.size(); ++i)
+		out.write(material_names[i].data(), material_names[i].size());
+	out.write(padding, ((names_size+3)&~3)-names_size);
+	out.write(vector_data(vertices), vertices.size());
+	out.write(vector_data(indices), indices.size());
+	out.close();
 
-					if(next->indices[(i+1)%next->nverts]==last_index)
-						break;
-				}
+	if(out)
+		rename(temp_filename.c_str(), filename.c_str());
+	else
+		remove(temp_filename.c_str());
+}
 
-			// If there was no suitable face to continue this strip, break out
-			if(next==faces.end())
-				break;
+unsigned Object::choose_detail_level(const Matrix &projection, const Matrix &model, float depth) const
+{
+	if(detail_levels.empty() || detail_threshold<=0)
+		return 0;
 
-			face = next;
-			face->used = true;
-			// For quadrilateral faces we have to emit two triangles
-			if(next->nverts==4 && !(triangle_count%2))
-				indices.push_back(face->indices[(i+3)%face->nverts]);
-			indices.push_back(face->indices[(i+2)%face->nverts]);
-			if(next->nverts==4 && (triangle_count%2))
-				indices.push_back(face->indices[(i+3)%face->nverts]);
+	/* Errors are in object space.  Instances may scale the Object, so use the
+	largest scale of the model matrix to be safe.  The view matrix doesn't
+	scale. */
+	const float *m = model.m;
+	float scale = max(max(Vector(m[0], m[1], m[2]).length(), Vector(m[4], m[5], m[6]).length()), Vector(m[8], m[9], m[10]).length());
 
-			triangle_count += face->nverts-2;
-		}
+	/* The vertical scale of the projection maps view space to normalized device
+	coordinates, which span two units across the viewport.  Perspective
+	projections also divide by the depth of the nearest point of the bounding
+	sphere. */
+	float error_scale = scale*projection.m[5]/2;
+	if(projection.m[11])
+	{
+		depth -= bounds.get_radius()*scale;
+		if(depth<=0)
+			return 0;
+		error_scale /= depth;
 	}
 
-	set_data(vertices, indices);
+	unsigned level = 0;
+	for(; (level<detail_levels.size() && detail_levels[level].error*error_scale<=detail_threshold); ++level) ;
+	return level;
 }
 
 void Object::render(const RenderState &state) const
 {
-	if(material)
+	render_queued(state);
+}
+
+void Object::collect(RenderQueue &queue, const WorldTransform &world) const
+{
+	// Nothing has been uploaded yet
+	if(!arena)
+		return;
+
+	/* The shaders apply the view matrix, so only the center of the bounds is
+	transformed to view space here.  Its depth orders the items and picks the
+	detail level. */
+	float depth = -queue.get_view_matrix().transform(world.matrix.transform(bounds.get_center())).z;
+
+	// Detail levels are always triangle lists
+	unsigned level = choose_detail_level(queue.get_projection_matrix(), world.matrix, depth);
+	const vector<SubMesh> &ranges = (level ? detail_levels[level-1].submeshes : submeshes);
+
+	unsigned first_item = queue.get_items().size();
+	RenderQueue::DrawItem item;
+	// Compact vertex formats need their positions restored
+	item.model_matrix = (vertex_format==FLOAT_VERTICES ? world.matrix : world.matrix*position_matrix);
+	item.depth = depth;
+	item.object = this;
+	item.renderable = this;
+	item.vertex_array = arena->get_vertex_array();
+	item.base_vertex = first_vertex;
+	item.primitive_type = (primitive_type==TRIANGLE_STRIP && !level ? GL_TRIANGLE_STRIP : GL_TRIANGLES);
+	item.index_type = (index_size==2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT);
+	for(vector<SubMesh>::const_iterator i=ranges.begin(); i!=ranges.end(); ++i)
 	{
-		material->apply();
+		// Submeshes may be simplified away entirely
+		if(!i->count)
+			continue;
 
-		Shader *shader = material->get_shader();
-		if(shader)
-		{
-			shader->set_uniform("modelview", state.modelview_matrix);
-			shader->set_uniform("projection", state.projection_matrix);
-			shader->set_uniform("sky_direction", state.sky_direction);
-			shader->set_uniform("light_direction", state.light_direction);
-			shader->set_uniform("light_intensity", state.light_intensity);
-			shader->set_uniform("ambient_intensity", state.ambient_intensity);
-		}
+		item.material = i->material;
+		item.first = (first_index+i->first)*index_size;
+		item.count = i->count;
+		queue.add(item);
 	}
 
-	glBindVertexArray(vertex_array_id);
-	glDrawElements(GL_TRIANGLE_STRIP, n_indices, GL_UNSIGNED_INT, 0);
+	if(queue.get_occlusion_buffer())
+	{
+		if(!occluder_indices.empty())
+			queue.add_occluder(*this, world.matrix, depth);
+		queue.add_occlusion_test(*this, world.matrix, first_item);
+	}
 }
 
+bool Object::fixed_restart_index_supported()
+{
+	return GLEW_VERSION_4_3 || GLEW_ARB_ES3_compatibility;
+}
 
-VertexRef::VertexRef():
-	vertex(-1),
-	normal(-1),
-	texcoord(-1)
+
+Object::LoadOptions::LoadOptions():
+	primitive_type(TRIANGLE_STRIP),
+	auto_primitive_type(false),
+	vertex_format(FLOAT_VERTICES),
+	parse_threads(0),
+	build_detail_levels(true)
 { }
 
-bool VertexRef::operator<(const VertexRef &other) const
+
+template<typename T>
+const T *vector_data(const vector<T> &v)
+{
+	// Taking the address of the first element is undefined for empty vectors
+	return (v.empty() ? 0 : &v[0]);
+}
+
+bool compact_vertices_supported()
+{
+	// Half floats are core since 3.0, but the packed normals need 3.3
+	return GLEW_VERSION_3_3 || GLEW_ARB_vertex_type_2_10_10_10_rev;
+}
+
+unsigned short float_to_half(float value)
+{
+	union
+	{
+		float f;
+		unsigned u;
+	} bits;
+	bits.f = value;
+
+	unsigned sign = (bits.u>>16)&0x8000;
+	int exponent = static_cast<int>((bits.u>>23)&0xFF)-127+15;
+	unsigned mantissa = bits.u&0x7FFFFF;
+
+	if(exponent>=31)
+		// Overflow becomes infinity.  NaNs aren't expected in vertex data.
+		return sign|0x7C00;
+	else if(exponent<=0)
+	{
+		// Too small for a normal half; produce a denormal or zero
+		if(exponent<-10)
+			return sign;
+		mantissa |= 0x800000;
+		unsigned shift = 14-exponent;
+		return sign|((mantissa+(1<<(shift-1)))>>shift);
+	}
+
+	// Round to nearest.  A carry out of the mantissa correctly bumps the exponent.
+	return sign|((exponent<<10)+((mantissa+0x1000)>>13));
+}
+
+unsigned short float_to_snorm16(float value)
+{
+	value = min(max(value, -1.0f), 1.0f);
+	return static_cast<short>(floor(value*32767.0f+0.5f));
+}
+
+unsigned short float_to_unorm16(float value)
+{
+	value = min(max(value, 0.0f), 1.0f);
+	return static_cast<unsigned short>(value*65535.0f+0.5f);
+}
+
+unsigned pack_normal(float x, float y, float z)
 {
-	if(vertex!=other.vertex)
-		return vertex<other.vertex;
-	else if(normal!=other.normal)
-		return normal<other.normal;
+	// GL_INT_2_10_10_10_REV stores x in the lowest bits
+	float comps[3] = { x, y, z };
+	unsigned packed = 0;
+	for(unsigned i=0; i<3; ++i)
+	{
+		float c = min(max(comps[i], -1.0f), 1.0f);
+		int value = static_cast<int>(floor(c*511.0f+0.5f));
+		packed |= (value&0x3FF)<<(i*10);
+	}
+	return packed;
+}
+
+float half_to_float(unsigned short value)
+{
+	unsigned sign = (value&0x8000)<<16;
+	unsigned exponent = (value>>10)&0x1F;
+	unsigned mantissa = value&0x3FF;
+
+	union
+	{
+		float f;
+		unsigned u;
+	} bits;
+
+	if(exponent==0)
+	{
+		// Denormals are exact in single precision
+		bits.f = mantissa/16777216.0f;
+		bits.u |= sign;
+	}
+	else if(exponent==31)
+		bits.u = sign|0x7F800000|(mantissa<<13);
 	else
-		return texcoord<other.texcoord;
+		bits.u = sign|((exponent-15+127)<<23)|(mantissa<<13);
+
+	return bits.f;
 }
 
-istream &operator>>(istream &input, VertexRef &vref)
+Vector unpack_normal(unsigned packed)
 {
-	string word;
-	input >> word;
-	if(!input)
-		return input;
+	float comps[3];
+	for(unsigned i=0; i<3; ++i)
+	{
+		// Sign extend the 10-bit value
+		int value = static_cast<int>((packed>>(i*10))&0x3FF);
+		if(value&0x200)
+			value -= 0x400;
+		comps[i] = max(value/511.0f, -1.0f);
+	}
+	return Vector(comps[0], comps[1], comps[2]);
+}
 
-	vref = VertexRef();
 
-	string::size_type slash = word.find('/');
-	vref.vertex = strtol(word.substr(0, slash).c_str(), NULL, 10)-1;
-	if(slash!=string::npos)
+unsigned encode_load_options(const Object::LoadOptions &opts)
+{
+	return opts.primitive_type | (opts.auto_primitive_type<<8) | (opts.vertex_format<<16) | (opts.build_detail_levels<<24);
+}
+
+bool is_newer(const string &filename, const string &other)
+{
+	struct stat st;
+	if(stat(filename.c_str(), &st)<0)
+		return false;
+	struct stat other_st;
+	if(stat(other.c_str(), &other_st)<0)
+		return true;
+
+	// Use the full timestamp, as files are often modified in quick succession
+	if(st.st_mtim.tv_sec!=other_st.st_mtim.tv_sec)
+		return st.st_mtim.tv_sec>other_st.st_mtim.tv_sec;
+	return st.st_mtim.tv_nsec>=other_st.st_mtim.tv_nsec;
+}
+
+bool is_valid_range(const MeshCacheSubMesh &range, unsigned n_indices)
+{
+	return range.first<=n_indices && range.count<=n_indices-range.first;
+}
+
+bool are_valid_indices(const void *data, unsigned count, unsigned index_size, unsigned n_vertices)
+{
+	// Restart indices are the largest value of the index type
+	if(index_size==2)
 	{
-		string::size_type slash2 = word.find('/', slash+1);
-		if(slash2>slash+1)
-			vref.texcoord = strtol(word.substr(slash+1, slash2-slash-1).c_str(), NULL, 10)-1;
-		if(slash2!=string::npos)
-			vref.normal = strtol(word.substr(slash2+1).c_str(), NULL, 10)-1;
+		const unsigned short *indices = static_cast<const unsigned short *>(data);
+		for(unsigned i=0; i<count; ++i)
+			if(indices[i]>=n_vertices && indices[i]!=0xFFFF)
+				return false;
+	}
+	else
+	{
+		const unsigned *indices = static_cast<const unsigned *>(data);
+		for(unsigned i=0; i<count; ++i)
+			if(indices[i]>=n_vertices && indices[i]!=0xFFFFFFFF)
+				return false;
 	}
 
-	return input;
+	return true;
 }
 
+void optimize_submesh_caches(vector<unsigned> &indices, const vector<Object::SubMesh> &ranges, unsigned n_vertices)
+{
+	/* Each submesh is optimized on its own, so triangles don't move between
+	them.  Vertices are renumbered densely for each submesh to keep the cost
+	proportional to the size of the submesh. */
+	vector<unsigned> local_index(n_vertices, ~0U);
+	vector<unsigned> global_index;
+	vector<unsigned> local_indices;
+	for(vector<Object::SubMesh>::const_iterator i=ranges.begin(); i!=ranges.end(); ++i)
+	{
+		global_index.clear();
+		local_indices.resize(i->count);
+		for(unsigned j=0; j<i->count; ++j)
+		{
+			unsigned &local = local_index[indices[i->first+j]];
+			if(local==~0U)
+			{
+				local = global_index.size();
+				global_index.push_back(indices[i->first+j]);
+			}
+			local_indices[j] = local;
+		}
 
-Face::Face():
-	nverts(0),
-	used(false)
-{ }
+		optimize_vertex_cache(local_indices, global_index.size());
+
+		for(unsigned j=0; j<i->count; ++j)
+			indices[i->first+j] = global_index[local_indices[j]];
+		for(vector<unsigned>::const_iterator j=global_index.begin(); j!=global_index.end(); ++j)
+			local_index[*j] = ~0U;
+	}
+}
+
+
+void build_detail_levels(const vector<unsigned> &list_indices, const vector<Object::SubMesh> &list_ranges, const vector<Object::Vertex> &vertices, vector<unsigned> &indices, vector<Object::DetailLevel> &levels)
+{
+	vector<Vector> positions;
+	positions.reserve(vertices.size());
+	for(vector<Object::Vertex>::const_iterator i=vertices.begin(); i!=vertices.end(); ++i)
+		positions.push_back(Vector(i->x, i->y, i->z));
+
+	/* Copy the triangles before appending anything, since list_indices may be
+	the same array as indices. */
+	vector<vector<unsigned> > current(list_ranges.size());
+	unsigned n_triangles = 0;
+	for(unsigned i=0; i<list_ranges.size(); ++i)
+	{
+		vector<unsigned>::const_iterator begin = list_indices.begin()+list_ranges[i].first;
+		current[i].assign(begin, begin+list_ranges[i].count);
+		n_triangles += list_ranges[i].count/3;
+	}
+
+	/* Each level is simplified from the previous one, so their errors add up.
+	Submeshes are simplified separately to keep their Materials apart. */
+	float error = 0;
+	vector<vector<unsigned> > next(list_ranges.size());
+	while(levels.size()<max_detail_levels)
+	{
+		float level_error = 0;
+		unsigned n_simplified = 0;
+		for(unsigned i=0; i<current.size(); ++i)
+		{
+			next[i].clear();
+			if(current[i].empty())
+				continue;
+
+			level_error = max(level_error, simplify_triangles(current[i], positions, current[i].size()/6, next[i]));
+			n_simplified += next[i].size()/3;
+		}
+
+		// Stop once simplification no longer pays for the memory
+		if(!n_simplified || n_simplified*5>n_triangles*4)
+			break;
+
+		error += level_error;
+		Object::DetailLevel level;
+		level.error = error;
+		level.submeshes.resize(current.size());
+		for(unsigned i=0; i<current.size(); ++i)
+		{
+			level.submeshes[i].first = indices.size();
+			level.submeshes[i].count = next[i].size();
+			indices.insert(indices.end(), next[i].begin(), next[i].end());
+		}
+		optimize_submesh_caches(indices, level.submeshes, vertices.size());
+		levels.push_back(level);
+
+		current.swap(next);
+		n_triangles = n_simplified;
+	}
+}
 
 } // namespace SkrolliGL
@@ -1,31 +1,75 @@
 #ifndef SKROLLIGL_OBJECT_H_
 #define SKROLLIGL_OBJECT_H_
 
+#include <map>
 #include <string>
 #include <vector>
 #include "mathutils.h"
+#include "meshutils.h"
 #include "renderable.h"
 #include "resourcemanager.h"
 
 namespace SkrolliGL {
 
+class GeometryArena;
 class Material;
 
 /*
-Stores a single mesh with a material.
+Stores a mesh, divided into submeshes which each have their own Material.  The
+vertices and indices are kept in a GeometryArena shared with all other Objects
+that have the same vertex layout and index size.  Drawing any number of those
+Objects only requires binding one vertex array.
 
-Materials can be loaded from files in the WaveFront OBJ format.  The canonical
+Objects can be loaded from files in the WaveFront OBJ format.  The canonical
 filename extension is .obj.
+
+Parsing text files is slow, so after an OBJ file has been loaded, the final
+vertex and index arrays are written into a binary cache file next to it.  The
+name of the cache file is the name of the OBJ file with .cache appended.  The
+cache is used instead of the OBJ file as long as it's newer and was built with
+the same LoadOptions.  If the cache can't be written, loading still succeeds.
+
+Loaded Objects also get a chain of simplified detail levels, which are drawn
+instead of the full mesh when the difference would be too small to see.  The
+detail levels share the vertex buffer of the full mesh.
 */
 class Object: public Resource, public Renderable
 {
 public:
-	/* Handy constants for vertex attributes. */
+	/* Handy constants for vertex attributes.  The model matrix is only used by
+	instanced shaders and takes four consecutive locations. */
 	enum VertexAttribute
 	{
 		POSITION,
 		NORMAL,
-		TEXCOORD
+		TEXCOORD,
+		MODEL
+	};
+
+	/* Kinds of primitives the indices of an Object can form. */
+	enum PrimitiveType
+	{
+		// Triangle strips, separated by 0xFFFFFFFF restart indices
+		TRIANGLE_STRIP,
+
+		// Independent triangles, three indices each
+		TRIANGLES
+	};
+
+	/* Layouts for storing vertices on the GPU.  Vertex data is always passed
+	in as Vertex structures and converted to the selected layout. */
+	enum VertexFormat
+	{
+		// Eight floats, 32 bytes per vertex
+		FLOAT_VERTICES,
+
+		/* Half-float positions, 2_10_10_10 normals and 16-bit texture
+		coordinates, 16 bytes per vertex. */
+		HALF_VERTICES,
+
+		/* Like HALF_VERTICES, but positions are 16-bit normalized integers.
+		This has better precision for large meshes. */
+		SNORM16_VERTICES
 	};
 
 	/* A structure describing a three dimensional vertex with a normal and a
@@ -37,31 +81,180 @@ public:
 		float u, v;
 	};
 
+	/* Settings which affect how Objects are built from files. */
+	struct LoadOptions
+	{
+		/* The primitive type to build from the faces of the file.  Triangle
+		lists are reordered for the vertex cache.  The default is
+		TRIANGLE_STRIP. */
+		PrimitiveType primitive_type;
+
+		/* If true, primitive_type is ignored and the primitive type with the
+		lower ACMR is used for each Object. */
+		bool auto_primitive_type;
+
+		/* The vertex format for loaded Objects.  The default is
+		FLOAT_VERTICES. */
+		VertexFormat vertex_format;
+
+		/* The number of threads to use for parsing large files.  Zero means one
+		thread per CPU core, which is the default.  This doesn't affect the
+		result. */
+		unsigned parse_threads;
+
+		/* If true, simplified detail levels are built for the Object.  The
+		default is true. */
+		bool build_detail_levels;
+
+		LoadOptions();
+	};
+
+	/* A range of indices which is drawn with a single Material. */
+	struct SubMesh
+	{
+		Material *material;
+		unsigned first;
+		unsigned count;
+
+		SubMesh(): material(0), first(0), count(0) { }
+	};
+
+	/* A simplified version of the mesh for viewing from a distance.  It has a
+	triangle list for each submesh of the full mesh, with the same Materials.
+	The error is an estimate of how far the simplified surface is from the full
+	mesh, in object space. */
+	struct DetailLevel
+	{
+		float error;
+		std::vector<SubMesh> submeshes;
+	};
+
+	/* Vertex cache statistics for both primitive types, computed at load. */
+	struct TopologyStats
+	{
+		VertexCacheStats strip;
+		VertexCacheStats list;
+	};
+
 private:
-	unsigned vertex_buffer_id;
-	unsigned index_buffer_id;
-	unsigned vertex_array_id;
+	GeometryArena *arena;
+	unsigned first_vertex;
+	unsigned first_index;
+	unsigned n_vertices;
 	unsigned n_indices;
+	unsigned index_size;
+	PrimitiveType primitive_type;
+	VertexFormat vertex_format;
+	bool unorm_texcoords;
+	Matrix position_matrix;
+	Bounds bounds;
+	TopologyStats topology_stats;
+	std::vector<SubMesh> submeshes;
+	std::vector<DetailLevel> detail_levels;
+	std::vector<Vector> occluder_vertices;
+	std::vector<unsigned> occluder_indices;
 
-	Material *material;
+	static LoadOptions load_options;
+	static float detail_threshold;
+	static std::map<unsigned, GeometryArena *> arenas;
 
 public:
 	Object();
 	~Object();
 
+	/* Sets the options to be used for loading Objects from files. */
+	static void set_load_options(const LoadOptions &);
+	static const LoadOptions &get_load_options() { return load_options; }
+
+	/* Sets the largest error allowed for a detail level, as a fraction of the
+	viewport height.  The default is 0.001, or about one pixel on a 1080 line
+	display.  Zero disables detail levels. */
+	static void set_detail_threshold(float);
+	static float get_detail_threshold() { return detail_threshold; }
+
 private:
-	void set_attrib_array(unsigned, unsigned, float Vertex::*);
+	GeometryArena &get_arena() const;
+	void release_geometry();
+	void pack_vertices(const std::vector<Vertex> &, std::vector<char> &);
+	void pack_indices(const std::vector<unsigned> &, unsigned, std::vector<char> &);
+	void upload(const void *, unsigned, const void *, unsigned, PrimitiveType);
 
 public:
-	/* Sets vertex and index data for the object.  The indices must form a
-	single triangle strip. */
-	void set_data(const std::vector<Vertex> &, const std::vector<unsigned> &);
+	/* Sets the layout to use for vertex data.  This takes effect on the next
+	call to set_data.  Compact formats fall back to FLOAT_VERTICES if the GL
+	implementation doesn't support packed vertex types. */
+	void set_vertex_format(VertexFormat);
+
+	VertexFormat get_vertex_format() const { return vertex_format; }
+
+	/* Returns the size of one vertex in the GPU vertex buffer, in bytes. */
+	unsigned get_vertex_size() const;
+
+	/* Returns the transform from stored positions to object space.  This is
+	identity for FLOAT_VERTICES.  Compact formats store positions relative to
+	the bounding box and rely on this to restore them. */
+	const Matrix &get_position_matrix() const { return position_matrix; }
+
+	/* Returns the bounds of the vertices given to set_data or loaded from a
+	file.  The sphere is centered on the bounding box. */
+	virtual Bounds get_bounds() const { return bounds; }
+
+	/* Sets vertex and index data for the object.  The indices must form
+	primitives of the given type.  Indices are stored with 16 bits if there are
+	few enough vertices; restart indices are converted to match.  The Object
+	will have a single submesh with the Material of the previous first
+	submesh. */
+	void set_data(const std::vector<Vertex> &, const std::vector<unsigned> &, PrimitiveType = TRIANGLE_STRIP);
+
+	/* Reads the vertex and index data back from the GPU.  Positions are
+	returned in object space whatever the vertex format is, and restart indices
+	are 0xFFFFFFFF.  Compact formats lose some precision.  This is slow and
+	meant for processing Objects at load time. */
+	void get_data(std::vector<Vertex> &, std::vector<unsigned> &) const;
 
-	/* Sets the Material for the Object.  A null Material is permitted, but an
-	Object can't be rendered without one. */
+	PrimitiveType get_primitive_type() const { return primitive_type; }
+
+	/* Returns the size of one index in the GPU index buffer, in bytes.  This
+	is either 2 or 4. */
+	unsigned get_index_size() const { return index_size; }
+
+	/* Returns the vertex cache statistics computed when the Object was loaded
+	from a file.  These can be used to choose the primitive type per asset. */
+	const TopologyStats &get_topology_stats() const { return topology_stats; }
+
+	/* Replaces the submeshes of the Object.  The index ranges must be within
+	the data given to set_data.  Any detail levels are discarded. */
+	void set_submeshes(const std::vector<SubMesh> &);
+
+	const std::vector<SubMesh> &get_submeshes() const { return submeshes; }
+
+	/* Returns the simplified detail levels of the Object, from the most
+	detailed to the least detailed.  The full mesh is not included. */
+	const std::vector<DetailLevel> &get_detail_levels() const { return detail_levels; }
+
+	/* Sets a simplified mesh which is drawn into occlusion buffers in place of
+	the Object.  The vertices are in object space and the indices form a
+	triangle list.  Anything behind the mesh is considered hidden, so it
+	should stay within the real surface.  Empty vectors stop the Object from
+	being an occluder. */
+	void set_occluder(const std::vector<Vector> &, const std::vector<unsigned> &);
+
+	/* Makes the Object an occluder with the least detailed level whose error
+	is at most the given distance in object space, or the full mesh if no
+	level is accurate enough.  This reads the mesh back from the GPU. */
+	void build_occluder(float);
+
+	bool is_occluder() const { return !occluder_indices.empty(); }
+	const std::vector<Vector> &get_occluder_vertices() const { return occluder_vertices; }
+	const std::vector<unsigned> &get_occluder_indices() const { return occluder_indices; }
+
+	/* Sets the Material for all submeshes of the Object.  A null Material is
+	permitted, but an Object can't be rendered without one.  If the Object has
+	no data yet, set_data will use the Material. */
 	void set_material(Material *);
 
-	Material *get_material() const { return material; }
+	/* Returns the Material of the first submesh. */
+	Material *get_material() const;
 
 	/* Loads object data from a file.  Usually called by ResourceManager.  Any
 	material referenced by the file must be already known to the
@@ -69,9 +262,27 @@ public:
 	virtual void load(const ResourceManager &, const std::string &);
 private:
 	void load_obj(const ResourceManager &, const std::string &);
+	bool load_cache(const ResourceManager &, const std::string &);
+	void save_cache(const std::string &, const std::vector<char> &, unsigned, const std::vector<char> &, unsigned, const std::vector<std::string> &) const;
 
 public:
+	/* Returns the index of the least detailed level whose error is below the
+	threshold when seen through a projection matrix, placed with a model matrix
+	and with the center of the bounds at a depth in view space.  Zero is the
+	full mesh and higher numbers are get_detail_levels()[n-1]. */
+	unsigned choose_detail_level(const Matrix &, const Matrix &, float) const;
+
 	virtual void render(const RenderState &) const;
+
+	/* Adds an item for each submesh of the chosen detail level.  If the
+	RenderQueue does occlusion culling, the items are tested together with the
+	bounds of the Object, and the occluder mesh is added if there is one. */
+	virtual void collect(RenderQueue &, const WorldTransform &) const;
+
+	/* Indicates whether the GL implementation can use the largest value of
+	each index type as the restart index.  If not, the engine uses a restart
+	index of 0xFFFFFFFF. */
+	static bool fixed_restart_index_supported();
 };
 
 } // namespace SkrolliGL
@@ -0,0 +1,587 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <SDL.h>
+#include "objparser.h"
+
+using namespace std;
+
+namespace SkrolliGL {
+
+/* An open-addressing hash table which maps VertexRefs to unsigned values.  This
+is visited for every face corner, so it avoids allocating per entry. */
+class VertexMap
+{
+private:
+	struct Slot
+	{
+		ObjParser::VertexRef ref;
+		unsigned value;
+	};
+
+	vector<Slot> slots;
+	unsigned count;
+
+public:
+	VertexMap();
+
+	/* Returns the value of a VertexRef.  If it isn't in the map yet, it's
+	inserted with the given value. */
+	unsigned insert(const ObjParser::VertexRef &, unsigned);
+private:
+	void grow();
+};
+
+/* Splits a memory buffer into lines and whitespace-separated words.  Words are
+returned as pointers into the buffer, so no copies are made. */
+class ObjTokenizer
+{
+private:
+	const char *ptr;
+	const char *end;
+
+public:
+	ObjTokenizer(const char *, const char *);
+
+	bool at_end() const { return ptr>=end; }
+
+	/* Reads the next word on the current line.  Returns false if the line has
+	no more words. */
+	bool read_word(const char *&, unsigned &);
+
+	bool read_float(float &);
+	bool read_vertex_ref(ObjParser::VertexRef &);
+
+	/* Advances to the beginning of the next line. */
+	void next_line();
+
+	/* Returns the first character of the current line without consuming it. */
+	char peek() const { return ptr<end ? *ptr : 0; }
+};
+
+struct ObjParser::Job
+{
+	ObjParser *parser;
+	void (ObjParser::*func)(unsigned);
+	unsigned index;
+};
+
+static unsigned bucket_of(const ObjParser::VertexRef &, unsigned);
+static int parse_int(const char *&, const char *);
+static bool word_equals(const char *, unsigned, const char *);
+
+/* Chunks smaller than this are not worth the cost of a thread.  The same goes
+for deduplicating small numbers of face corners. */
+const unsigned min_chunk_size = 1<<20;
+const unsigned min_refs_per_task = 1<<16;
+
+
+ObjParser::ObjParser(unsigned t):
+	max_threads(t ? t : max(SDL_GetCPUCount(), 1)),
+	n_tasks(1)
+{ }
+
+void ObjParser::parse(const char *begin, const char *end)
+{
+	vertices.clear();
+	faces.clear();
+	material_names.clear();
+
+	// Split the file into chunks at line boundaries
+	size_t size = end-begin;
+	unsigned n_chunks = min<size_t>(max_threads, max<size_t>(size/min_chunk_size, 1));
+	chunks.assign(n_chunks, Chunk());
+	const char *chunk_begin = begin;
+	for(unsigned i=0; i<n_chunks; ++i)
+	{
+		const char *chunk_end = end;
+		if(i+1<n_chunks)
+		{
+			chunk_end = max(begin+size*(i+1)/n_chunks, chunk_begin);
+			const char *newline = static_cast<const char *>(memchr(chunk_end, '\n', end-chunk_end));
+			chunk_end = (newline ? newline+1 : end);
+		}
+		chunks[i].begin = chunk_begin;
+		chunks[i].end = chunk_end;
+		chunk_begin = chunk_end;
+	}
+
+	run_jobs(&ObjParser::parse_chunk, n_chunks);
+	merge_chunks();
+
+	/* Vertices are numbered by their first use in the file.  Each task buckets
+	the corners of its range of faces by hash, then each bucket is searched for
+	first uses in file order.  This gives every corner the position of the
+	first corner with the same attributes. */
+	n_tasks = min(max_threads, max<unsigned>(refs.size()/min_refs_per_task, 1U));
+	range_faces.resize(n_tasks+1);
+	range_refs.resize(n_tasks+1);
+	unsigned ref_index = 0;
+	for(unsigned i=0; i<=n_tasks; ++i)
+	{
+		unsigned first_face = static_cast<size_t>(faces.size())*i/n_tasks;
+		for(unsigned j=(i ? range_faces[i-1] : 0); j<first_face; ++j)
+			ref_index += faces[j].nverts;
+		range_faces[i] = first_face;
+		range_refs[i] = ref_index;
+	}
+
+	first_use.resize(refs.size());
+	ref_vertices.resize(refs.size());
+	buckets.assign(n_tasks*n_tasks, vector<unsigned>());
+	run_jobs(&ObjParser::bucket_refs, n_tasks);
+	run_jobs(&ObjParser::find_first_uses, n_tasks);
+
+	// Count the new vertices in each range to find where their numbering starts
+	range_vertices.assign(n_tasks+1, 0);
+	for(unsigned i=0; i<n_tasks; ++i)
+	{
+		unsigned count = 0;
+		for(unsigned j=range_refs[i]; j<range_refs[i+1]; ++j)
+			if(first_use[j]==j)
+				++count;
+		range_vertices[i+1] = range_vertices[i]+count;
+	}
+
+	vertices.resize(range_vertices.back());
+	run_jobs(&ObjParser::create_vertices, n_tasks);
+	run_jobs(&ObjParser::resolve_faces, n_tasks);
+
+	// Release the intermediate data
+	vector<Chunk>().swap(chunks);
+	vector<Vector>().swap(positions);
+	vector<Vector>().swap(texcoords);
+	vector<Vector>().swap(normals);
+	vector<VertexRef>().swap(refs);
+	vector<vector<unsigned> >().swap(buckets);
+	vector<unsigned>().swap(first_use);
+	vector<unsigned>().swap(ref_vertices);
+}
+
+void ObjParser::run_jobs(void (ObjParser::*func)(unsigned), unsigned count)
+{
+	vector<Job> jobs(count);
+	vector<SDL_Thread *> threads(count, static_cast<SDL_Thread *>(0));
+	for(unsigned i=0; i<count; ++i)
+	{
+		jobs[i].parser = this;
+		jobs[i].func = func;
+		jobs[i].index = i;
+	}
+
+	// The first job runs on the calling thread, as do any that fail to start
+	for(unsigned i=1; i<count; ++i)
+		threads[i] = SDL_CreateThread(job_thread, "ObjParser", &jobs[i]);
+	for(unsigned i=0; i<count; ++i)
+		if(!threads[i])
+			(this->*func)(i);
+	for(unsigned i=1; i<count; ++i)
+		if(threads[i])
+			SDL_WaitThread(threads[i], 0);
+}
+
+int ObjParser::job_thread(void *data)
+{
+	Job *job = static_cast<Job *>(data);
+	(job->parser->*job->func)(job->index);
+	return 0;
+}
+
+void ObjParser::parse_chunk(unsigned index)
+{
+	Chunk &chunk = chunks[index];
+	ObjTokenizer tokens(chunk.begin, chunk.end);
+	for(; !tokens.at_end(); tokens.next_line())
+	{
+		// Lines starting with # are comments
+		if(tokens.peek()=='#')
+			continue;
+
+		const char *command;
+		unsigned length;
+		if(!tokens.read_word(command, length))
+			continue;
+
+		if(word_equals(command, length, "v"))  // Vertex coordinate
+		{
+			Vector v;
+			tokens.read_float(v.x);
+			tokens.read_float(v.y);
+			tokens.read_float(v.z);
+			chunk.positions.push_back(v);
+		}
+		else if(word_equals(command, length, "vt"))  // Texture coordinate
+		{
+			Vector vt;
+			tokens.read_float(vt.x);
+			tokens.read_float(vt.y);
+			chunk.texcoords.push_back(vt);
+		}
+		else if(word_equals(command, length, "vn"))  // Vertex normal
+		{
+			Vector vn;
+			tokens.read_float(vn.x);
+			tokens.read_float(vn.y);
+			tokens.read_float(vn.z);
+			chunk.normals.push_back(vn);
+		}
+		else if(word_equals(command, length, "f"))  // Face
+		{
+			/* WaveFront OBJ references vertex attributes separately.  The
+			references are resolved into vertices once all chunks are done. */
+			unsigned char nverts = 0;
+			VertexRef vref;
+			while(nverts<4 && tokens.read_vertex_ref(vref))
+			{
+				chunk.refs.push_back(vref);
+				++nverts;
+			}
+			chunk.face_sizes.push_back(nverts);
+			chunk.face_materials.push_back(chunk.final_material);
+		}
+		else if(word_equals(command, length, "usemtl"))  // Material information
+		{
+			const char *name;
+			unsigned name_length;
+			if(tokens.read_word(name, name_length))
+			{
+				string material_name(name, name_length);
+				chunk.final_material = find(chunk.material_names.begin(), chunk.material_names.end(), material_name)-chunk.material_names.begin();
+				if(chunk.final_material==chunk.material_names.size())
+					chunk.material_names.push_back(material_name);
+			}
+		}
+		// Object and group names (o, g) need no special handling
+	}
+}
+
+void ObjParser::merge_chunks()
+{
+	size_t n_positions = 0;
+	size_t n_texcoords = 0;
+	size_t n_normals = 0;
+	size_t n_refs = 0;
+	size_t n_faces = 0;
+	for(vector<Chunk>::const_iterator i=chunks.begin(); i!=chunks.end(); ++i)
+	{
+		n_positions += i->positions.size();
+		n_texcoords += i->texcoords.size();
+		n_normals += i->normals.size();
+		n_refs += i->refs.size();
+		n_faces += i->face_sizes.size();
+	}
+
+	/* Files can be larger than 4 GB, but the elements are numbered with 32-bit
+	integers, and OBJ indices are signed. */
+	if(max(max(n_positions, n_texcoords), n_normals)>0x7FFFFFFF || max(n_refs, n_faces)>=0xFFFFFFFF)
+		throw runtime_error("OBJ data has too many elements");
+
+	positions.clear();
+	positions.reserve(n_positions);
+	texcoords.clear();
+	texcoords.reserve(n_texcoords);
+	normals.clear();
+	normals.reserve(n_normals);
+	refs.clear();
+	refs.reserve(n_refs);
+	faces.reserve(n_faces);
+
+	unsigned current_submesh = ~0U;
+	vector<unsigned> submesh_map;
+	for(vector<Chunk>::iterator i=chunks.begin(); i!=chunks.end(); ++i)
+	{
+		positions.insert(positions.end(), i->positions.begin(), i->positions.end());
+		texcoords.insert(texcoords.end(), i->texcoords.begin(), i->texcoords.end());
+		normals.insert(normals.end(), i->normals.begin(), i->normals.end());
+		refs.insert(refs.end(), i->refs.begin(), i->refs.end());
+
+		/* Faces before any material go in a submesh without one.  It must be
+		created before the materials of this chunk to keep the submeshes in the
+		order they appear in the file. */
+		if(current_submesh==~0U && !i->face_materials.empty() && i->face_materials.front()==~0U)
+		{
+			current_submesh = material_names.size();
+			material_names.push_back(string());
+		}
+
+		/* Faces with the same material go to the same submesh, even if they are
+		not together in the file. */
+		submesh_map.clear();
+		for(vector<string>::const_iterator j=i->material_names.begin(); j!=i->material_names.end(); ++j)
+		{
+			unsigned submesh = find(material_names.begin(), material_names.end(), *j)-material_names.begin();
+			if(submesh==material_names.size())
+				material_names.push_back(*j);
+			submesh_map.push_back(submesh);
+		}
+
+		for(unsigned j=0; j<i->face_sizes.size(); ++j)
+		{
+			Face face;
+			face.nverts = i->face_sizes[j];
+			face.submesh = (i->face_materials[j]==~0U ? current_submesh : submesh_map[i->face_materials[j]]);
+			faces.push_back(face);
+		}
+
+		if(i->final_material!=~0U)
+			current_submesh = submesh_map[i->final_material];
+
+		// The chunk's data has been copied and is no longer needed
+		*i = Chunk();
+	}
+}
+
+void ObjParser::bucket_refs(unsigned index)
+{
+	vector<unsigned> *task_buckets = &buckets[index*n_tasks];
+	for(unsigned i=range_refs[index]; i<range_refs[index+1]; ++i)
+		task_buckets[bucket_of(refs[i], n_tasks)].push_back(i);
+}
+
+void ObjParser::find_first_uses(unsigned index)
+{
+	/* Identical VertexRefs always end up in the same bucket.  Buckets of
+	earlier ranges contain earlier corners, so visiting them in order finds the
+	first use. */
+	VertexMap first_uses;
+	for(unsigned i=0; i<n_tasks; ++i)
+	{
+		const vector<unsigned> &bucket = buckets[i*n_tasks+index];
+		for(vector<unsigned>::const_iterator j=bucket.begin(); j!=bucket.end(); ++j)
+			first_use[*j] = first_uses.insert(refs[*j], *j);
+	}
+}
+
+void ObjParser::create_vertices(unsigned index)
+{
+	unsigned vertex_index = range_vertices[index];
+	for(unsigned i=range_refs[index]; i<range_refs[index+1]; ++i)
+	{
+		if(first_use[i]!=i)
+			continue;
+
+		// Attributes that are missing or out of range are left as zero
+		const VertexRef &vref = refs[i];
+		Object::Vertex &vertex = vertices[vertex_index];
+		vertex = Object::Vertex();
+		if(vref.vertex>=0 && static_cast<unsigned>(vref.vertex)<positions.size())
+		{
+			vertex.x = positions[vref.vertex].x;
+			vertex.y = positions[vref.vertex].y;
+			vertex.z = positions[vref.vertex].z;
+		}
+		if(vref.normal>=0 && static_cast<unsigned>(vref.normal)<normals.size())
+		{
+			vertex.nx = normals[vref.normal].x;
+			vertex.ny = normals[vref.normal].y;
+			vertex.nz = normals[vref.normal].z;
+		}
+		if(vref.texcoord>=0 && static_cast<unsigned>(vref.texcoord)<texcoords.size())
+		{
+			vertex.u = texcoords[vref.texcoord].x;
+			vertex.v = texcoords[vref.texcoord].y;
+		}
+
+		ref_vertices[i] = vertex_index++;
+	}
+}
+
+void ObjParser::resolve_faces(unsigned index)
+{
+	unsigned ref_index = range_refs[index];
+	for(unsigned i=range_faces[index]; i<range_faces[index+1]; ++i)
+	{
+		Face &face = faces[i];
+		for(unsigned j=0; j<face.nverts; ++j, ++ref_index)
+			face.indices[j] = ref_vertices[first_use[ref_index]];
+	}
+}
+
+
+ObjParser::Face::Face():
+	nverts(0),
+	submesh(0)
+{ }
+
+
+ObjParser::VertexRef::VertexRef():
+	vertex(-1),
+	normal(-1),
+	texcoord(-1)
+{ }
+
+bool ObjParser::VertexRef::operator==(const VertexRef &other) const
+{
+	return vertex==other.vertex && normal==other.normal && texcoord==other.texcoord;
+}
+
+unsigned ObjParser::VertexRef::hash() const
+{
+	// Mix the fields with large odd multipliers to spread out nearby indices
+	unsigned h = vertex*0x9E3779B1U;
+	h ^= normal*0x85EBCA77U+(h<<6)+(h>>2);
+	h ^= texcoord*0xC2B2AE3DU+(h<<6)+(h>>2);
+	return h^(h>>16);
+}
+
+
+ObjParser::Chunk::Chunk():
+	begin(0),
+	end(0),
+	final_material(~0U)
+{ }
+
+
+VertexMap::VertexMap():
+	slots(1024),
+	count(0)
+{
+	for(vector<Slot>::iterator i=slots.begin(); i!=slots.end(); ++i)
+		i->value = ~0U;
+}
+
+unsigned VertexMap::insert(const ObjParser::VertexRef &vref, unsigned value)
+{
+	// Keep the load factor at or below one half to keep probe chains short
+	if((count+1)*2>slots.size())
+		grow();
+
+	unsigned mask = slots.size()-1;
+	for(unsigned i=vref.hash()&mask; ; i=(i+1)&mask)
+	{
+		Slot &slot = slots[i];
+		if(slot.value==~0U)
+		{
+			slot.ref = vref;
+			slot.value = value;
+			++count;
+			return value;
+		}
+		else if(slot.ref==vref)
+			return slot.value;
+	}
+}
+
+void VertexMap::grow()
+{
+	vector<Slot> old_slots(slots.size()*2);
+	old_slots.swap(slots);
+	for(vector<Slot>::iterator i=slots.begin(); i!=slots.end(); ++i)
+		i->value = ~0U;
+
+	count = 0;
+	for(vector<Slot>::const_iterator i=old_slots.begin(); i!=old_slots.end(); ++i)
+		if(i->value!=~0U)
+			insert(i->ref, i->value);
+}
+
+
+ObjTokenizer::ObjTokenizer(const char *b, const char *e):
+	ptr(b),
+	end(e)
+{ }
+
+bool ObjTokenizer::read_word(const char *&word, unsigned &length)
+{
+	while(ptr<end && (*ptr==' ' || *ptr=='\t' || *ptr=='\r'))
+		++ptr;
+	if(ptr>=end || *ptr=='\n')
+		return false;
+
+	word = ptr;
+	while(ptr<end && *ptr!=' ' && *ptr!='\t' && *ptr!='\r' && *ptr!='\n')
+		++ptr;
+	length = ptr-word;
+
+	return true;
+}
+
+bool ObjTokenizer::read_float(float &value)
+{
+	const char *word;
+	unsigned length;
+	if(!read_word(word, length))
+		return false;
+
+	/* The mapped buffer isn't null-terminated, so copy the word to the stack
+	for strtof.  This gives the same correctly rounded results as iostreams. */
+	char buf[64];
+	if(length>=sizeof(buf))
+		length = sizeof(buf)-1;
+	memcpy(buf, word, length);
+	buf[length] = 0;
+
+	char *parse_end;
+	value = strtof(buf, &parse_end);
+	return parse_end!=buf;
+}
+
+bool ObjTokenizer::read_vertex_ref(ObjParser::VertexRef &vref)
+{
+	const char *word;
+	unsigned length;
+	if(!read_word(word, length))
+		return false;
+
+	vref = ObjParser::VertexRef();
+
+	// The format is vertex[/[texcoord][/normal]]
+	const char *word_end = word+length;
+	vref.vertex = parse_int(word, word_end)-1;
+	if(word<word_end && *word=='/')
+	{
+		++word;
+		if(word<word_end && *word!='/')
+			vref.texcoord = parse_int(word, word_end)-1;
+		if(word<word_end && *word=='/')
+		{
+			++word;
+			vref.normal = parse_int(word, word_end)-1;
+		}
+	}
+
+	return true;
+}
+
+void ObjTokenizer::next_line()
+{
+	const char *newline = static_cast<const char *>(memchr(ptr, '\n', end-ptr));
+	ptr = (newline ? newline+1 : end);
+}
+
+
+unsigned bucket_of(const ObjParser::VertexRef &vref, unsigned n_buckets)
+{
+	/* This must not correlate with VertexRef::hash.  Otherwise the entries of
+	a bucket would only land in some of the slots of a VertexMap. */
+	unsigned h = vref.vertex*0xCC9E2D51U^vref.normal*0x1B873593U^vref.texcoord*0xE6546B65U;
+	h ^= h>>15;
+	h *= 0x85EBCA6BU;
+	h ^= h>>13;
+	return h%n_buckets;
+}
+
+int parse_int(const char *&ptr, const char *end)
+{
+	bool negative = false;
+	if(ptr<end && (*ptr=='-' || *ptr=='+'))
+		negative = (*ptr++=='-');
+
+	int value = 0;
+	for(; (ptr<end && *ptr>='0' && *ptr<='9'); ++ptr)
+		value = value*10+(*ptr-'0');
+
+	// Skip over anything else up to the next separator, like strtol would
+	while(ptr<end && *ptr!='/')
+		++ptr;
+
+	return negative ? -value : value;
+}
+
+bool word_equals(const char *word, unsigned length, const char *str)
+{
+	return !strncmp(word, str, length) && !str[length];
+}
+
+} // namespace SkrolliGL
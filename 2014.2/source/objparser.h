@@ -0,0 +1,122 @@
+#ifndef SKROLLIGL_OBJPARSER_H_
+#define SKROLLIGL_OBJPARSER_H_
+
+#include <string>
+#include <vector>
+#include "object.h"
+
+namespace SkrolliGL {
+
+/*
+Reads the geometry of a WaveFront OBJ file.  The file references positions,
+normals and texture coordinates separately, so each distinct combination of
+them becomes one Object::Vertex.  Vertices are numbered in the order they are
+first used by a face.
+
+Large files are split into chunks at line boundaries and parsed on multiple
+threads.  The chunks are merged in order and vertices are deduplicated in
+parallel, so the result is identical to parsing the file sequentially.
+*/
+class ObjParser
+{
+public:
+	/* A polygon with three or four vertices.  Polygons with more vertices are
+	truncated to four. */
+	struct Face
+	{
+		unsigned char nverts;
+		unsigned submesh;
+		unsigned indices[4];
+
+		Face();
+	};
+
+	/* Indices of the attributes of a face corner.  Attributes which are not
+	present are -1. */
+	struct VertexRef
+	{
+		int vertex;
+		int normal;
+		int texcoord;
+
+		VertexRef();
+
+		bool operator==(const VertexRef &) const;
+		unsigned hash() const;
+	};
+
+private:
+	/* The contents of a part of the file.  Material numbers are local to the
+	chunk; ~0U means the faces use the material left by the previous chunk. */
+	struct Chunk
+	{
+		const char *begin;
+		const char *end;
+		std::vector<Vector> positions;
+		std::vector<Vector> texcoords;
+		std::vector<Vector> normals;
+		std::vector<VertexRef> refs;
+		std::vector<unsigned char> face_sizes;
+		std::vector<unsigned> face_materials;
+		std::vector<std::string> material_names;
+		unsigned final_material;
+
+		Chunk();
+	};
+
+	struct Job;
+
+	unsigned max_threads;
+	unsigned n_tasks;
+	std::vector<Chunk> chunks;
+	std::vector<Vector> positions;
+	std::vector<Vector> texcoords;
+	std::vector<Vector> normals;
+	std::vector<VertexRef> refs;
+	std::vector<unsigned> range_faces;
+	std::vector<unsigned> range_refs;
+	std::vector<unsigned> range_vertices;
+	std::vector<std::vector<unsigned> > buckets;
+	std::vector<unsigned> first_use;
+	std::vector<unsigned> ref_vertices;
+
+	std::vector<Object::Vertex> vertices;
+	std::vector<Face> faces;
+	std::vector<std::string> material_names;
+
+public:
+	/* Constructs a parser which uses up to the given number of threads.  Zero
+	means one thread per CPU core. */
+	ObjParser(unsigned = 0);
+
+	/* Parses OBJ data from memory.  Any previous results are discarded.  Data
+	of any size is accepted, but throws if it has more vertices or faces than
+	32-bit indices can number. */
+	void parse(const char *, const char *);
+
+	const std::vector<Object::Vertex> &get_vertices() const { return vertices; }
+
+	/* Returns the faces of the file.  The submesh of a face is the position of
+	its material in get_material_names(). */
+	const std::vector<Face> &get_faces() const { return faces; }
+
+	/* Returns the names of the materials used by the file, in the order they
+	first appear.  Faces before the first usemtl line are given a material with
+	an empty name. */
+	const std::vector<std::string> &get_material_names() const { return material_names; }
+
+private:
+	void run_jobs(void (ObjParser::*)(unsigned), unsigned);
+	static int job_thread(void *);
+
+	void parse_chunk(unsigned);
+	void merge_chunks();
+	void bucket_refs(unsigned);
+	void find_first_uses(unsigned);
+	void create_vertices(unsigned);
+	void resolve_faces(unsigned);
+};
+
+} // namespace SkrolliGL
+
+#endif
@@ -0,0 +1,337 @@
+#include <algorithm>
+#include <cfloat>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "occlusionbuffer.h"
+
+using namespace std;
+
+namespace SkrolliGL {
+
+// Tiles are square, with this many pixels on each side
+const unsigned tile_size = 8;
+const unsigned tile_pixels = tile_size*tile_size;
+
+/* The planes triangles are clipped against: near, left, right, bottom and top.
+There's no need to clip against the far plane, since anything behind it is
+never visible anyway. */
+const unsigned n_clip_planes = 5;
+
+OcclusionBuffer::OcclusionBuffer(unsigned w, unsigned h):
+	tiles_x((w+tile_size-1)/tile_size),
+	tiles_y((h+tile_size-1)/tile_size),
+	n_triangles(0)
+{
+	width = tiles_x*tile_size;
+	height = tiles_y*tile_size;
+	depth.resize(width*height);
+	tile_max.resize(tiles_x*tiles_y);
+	clear();
+}
+
+void OcclusionBuffer::clear()
+{
+	fill(depth.begin(), depth.end(), 1.0f);
+	fill(tile_max.begin(), tile_max.end(), 1.0f);
+	n_triangles = 0;
+}
+
+void OcclusionBuffer::draw(const Matrix &matrix, const vector<Vector> &vertices, const vector<unsigned> &indices)
+{
+	// The vectors are kept between calls, so drawing doesn't allocate memory
+	clip_vertices.clear();
+	outcodes.clear();
+	for(vector<Vector>::const_iterator i=vertices.begin(); i!=vertices.end(); ++i)
+	{
+		ClipVertex v = transform_to_clip(matrix, *i);
+		unsigned outcode = 0;
+		for(unsigned j=0; j<n_clip_planes; ++j)
+			if(clip_distance(v, j)<0)
+				outcode |= 1<<j;
+		clip_vertices.push_back(v);
+		outcodes.push_back(outcode);
+	}
+
+	for(unsigned i=0; i+2<indices.size(); i+=3)
+	{
+		const unsigned *tri = &indices[i];
+
+		// Triangles entirely outside one of the planes can't be visible
+		if(outcodes[tri[0]]&outcodes[tri[1]]&outcodes[tri[2]])
+			continue;
+
+		ClipVertex polygon[3+n_clip_planes];
+		ClipVertex clipped[3+n_clip_planes];
+		unsigned n_vertices = 3;
+		for(unsigned j=0; j<3; ++j)
+			polygon[j] = clip_vertices[tri[j]];
+
+		unsigned crossed = outcodes[tri[0]]|outcodes[tri[1]]|outcodes[tri[2]];
+		for(unsigned j=0; (j<n_clip_planes && n_vertices>=3); ++j)
+			if(crossed&(1<<j))
+			{
+				n_vertices = clip_polygon(polygon, n_vertices, j, clipped);
+				copy(clipped, clipped+n_vertices, polygon);
+			}
+
+		// Project to pixel coordinates and split the polygon into a fan
+		Vector screen[3+n_clip_planes];
+		for(unsigned j=0; j<n_vertices; ++j)
+		{
+			float inv_w = 1/polygon[j].w;
+			screen[j] = Vector((polygon[j].x*inv_w*0.5f+0.5f)*width, (polygon[j].y*inv_w*0.5f+0.5f)*height, polygon[j].z*inv_w);
+		}
+
+		for(unsigned j=2; j<n_vertices; ++j)
+			draw_triangle(screen[0], screen[j-1], screen[j]);
+	}
+}
+
+void OcclusionBuffer::draw_triangle(const Vector &v0, const Vector &v1, const Vector &v2)
+{
+	// Occluders are drawn from both sides, so turn every triangle counterclockwise
+	float area = (v1.x-v0.x)*(v2.y-v0.y)-(v2.x-v0.x)*(v1.y-v0.y);
+	if(area==0)
+		return;
+
+	const Vector *p[3] = { &v0, (area>0 ? &v1 : &v2), (area>0 ? &v2 : &v1) };
+	area = fabs(area);
+	++n_triangles;
+
+	/* Each edge has a function a*x+b*y+c which is positive on the inner side.
+	The values of the functions are proportional to the barycentric coordinates
+	of the opposite vertices, which gives the plane of depth values as well. */
+	float a[3], b[3], c[3];
+	for(unsigned i=0; i<3; ++i)
+	{
+		const Vector &from = *p[i];
+		const Vector &to = *p[(i+1)%3];
+		a[i] = from.y-to.y;
+		b[i] = to.x-from.x;
+		c[i] = from.x*to.y-from.y*to.x;
+	}
+
+	float za = (a[1]*p[0]->z+a[2]*p[1]->z+a[0]*p[2]->z)/area;
+	float zb = (b[1]*p[0]->z+b[2]*p[1]->z+b[0]*p[2]->z)/area;
+	float zc = (c[1]*p[0]->z+c[2]*p[1]->z+c[0]*p[2]->z)/area;
+	float z_min = min(min(v0.z, v1.z), v2.z);
+
+	// Clipping keeps the vertices within the buffer
+	float x_low = min(min(v0.x, v1.x), v2.x);
+	float x_high = max(max(v0.x, v1.x), v2.x);
+	float y_low = min(min(v0.y, v1.y), v2.y);
+	float y_high = max(max(v0.y, v1.y), v2.y);
+	unsigned tx_begin = min(static_cast<unsigned>(max(x_low, 0.0f))/tile_size, tiles_x-1);
+	unsigned tx_end = min(static_cast<unsigned>(max(x_high, 0.0f))/tile_size, tiles_x-1)+1;
+	unsigned ty_begin = min(static_cast<unsigned>(max(y_low, 0.0f))/tile_size, tiles_y-1);
+	unsigned ty_end = min(static_cast<unsigned>(max(y_high, 0.0f))/tile_size, tiles_y-1)+1;
+
+	for(unsigned ty=ty_begin; ty<ty_end; ++ty)
+		for(unsigned tx=tx_begin; tx<tx_end; ++tx)
+		{
+			unsigned tile = ty*tiles_x+tx;
+
+			// Skip tiles where everything is already nearer than the triangle
+			if(z_min>=tile_max[tile])
+				continue;
+
+			/* Skip tiles outside any edge.  The edge functions are linear, so
+			their largest values are at the corners of the tile. */
+			float x0 = tx*tile_size+0.5f;
+			float y0 = ty*tile_size+0.5f;
+			float x1 = x0+tile_size-1;
+			float y1 = y0+tile_size-1;
+			bool outside = false;
+			for(unsigned i=0; (!outside && i<3); ++i)
+				outside = (a[i]*(a[i]>0 ? x1 : x0)+b[i]*(b[i]>0 ? y1 : y0)+c[i]<0);
+			if(outside)
+				continue;
+
+			float *pixels = &depth[tile*tile_pixels];
+#ifdef __SSE2__
+			__m128 zero = _mm_setzero_ps();
+			__m128 farthest = _mm_set1_ps(-FLT_MAX);
+			for(unsigned y=0; y<tile_size; ++y)
+				for(unsigned x=0; x<tile_size; x+=4)
+				{
+					__m128 px = _mm_add_ps(_mm_set1_ps(x0+x), _mm_setr_ps(0, 1, 2, 3));
+					__m128 py = _mm_set1_ps(y0+y);
+
+					__m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[0]), px), _mm_mul_ps(_mm_set1_ps(b[0]), py)), _mm_set1_ps(c[0])), zero);
+					for(unsigned i=1; i<3; ++i)
+					{
+						__m128 e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[i]), px), _mm_mul_ps(_mm_set1_ps(b[i]), py)), _mm_set1_ps(c[i]));
+						inside = _mm_and_ps(inside, _mm_cmpge_ps(e, zero));
+					}
+
+					__m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(za), px), _mm_mul_ps(_mm_set1_ps(zb), py)), _mm_set1_ps(zc));
+					float *row = pixels+y*tile_size+x;
+					__m128 old_z = _mm_loadu_ps(row);
+					__m128 nearer = _mm_and_ps(inside, _mm_cmplt_ps(z, old_z));
+					__m128 new_z = _mm_or_ps(_mm_and_ps(nearer, z), _mm_andnot_ps(nearer, old_z));
+					_mm_storeu_ps(row, new_z);
+					farthest = _mm_max_ps(farthest, new_z);
+				}
+
+			farthest = _mm_max_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(1, 0, 3, 2)));
+			farthest = _mm_max_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(2, 3, 0, 1)));
+			tile_max[tile] = _mm_cvtss_f32(farthest);
+#else
+			float farthest = -FLT_MAX;
+			for(unsigned y=0; y<tile_size; ++y)
+				for(unsigned x=0; x<tile_size; ++x)
+				{
+					float px = x0+x;
+					float py = y0+y;
+					bool inside = true;
+					for(unsigned i=0; i<3; ++i)
+						inside = (inside && a[i]*px+b[i]*py+c[i]>=0);
+
+					float &pixel = pixels[y*tile_size+x];
+					float z = za*px+zb*py+zc;
+					if(inside && z<pixel)
+						pixel = z;
+					farthest = max(farthest, pixel);
+				}
+			tile_max[tile] = farthest;
+#endif
+		}
+}
+
+bool OcclusionBuffer::is_occluded(const Matrix &matrix, const Bounds &bounds) const
+{
+	if(bounds.is_empty() || bounds.is_infinite())
+		return false;
+
+	// Find the screen rectangle and the nearest depth of the box
+	const Vector &low = bounds.get_minimum();
+	const Vector &high = bounds.get_maximum();
+	float x_low = FLT_MAX;
+	float x_high = -FLT_MAX;
+	float y_low = FLT_MAX;
+	float y_high = -FLT_MAX;
+	float z_near = FLT_MAX;
+	for(unsigned i=0; i<8; ++i)
+	{
+		Vector corner((i&1 ? high.x : low.x), (i&2 ? high.y : low.y), (i&4 ? high.z : low.z));
+		ClipVertex v = transform_to_clip(matrix, corner);
+		if(clip_distance(v, 0)<=0)
+			return false;
+
+		float inv_w = 1/v.w;
+		x_low = min(x_low, v.x*inv_w);
+		x_high = max(x_high, v.x*inv_w);
+		y_low = min(y_low, v.y*inv_w);
+		y_high = max(y_high, v.y*inv_w);
+		z_near = min(z_near, v.z*inv_w);
+	}
+
+	// Bounds outside the view are for frustum culling to deal with
+	if(x_high<-1 || x_low>1 || y_high<-1 || y_low>1)
+		return false;
+
+	// Test every pixel the rectangle touches, even partially
+	unsigned x_begin = static_cast<unsigned>(max((x_low*0.5f+0.5f)*width, 0.0f));
+	unsigned x_end = static_cast<unsigned>(min((x_high*0.5f+0.5f)*width, width-1.0f))+1;
+	unsigned y_begin = static_cast<unsigned>(max((y_low*0.5f+0.5f)*height, 0.0f));
+	unsigned y_end = static_cast<unsigned>(min((y_high*0.5f+0.5f)*height, height-1.0f))+1;
+
+	for(unsigned ty=y_begin/tile_size; ty*tile_size<y_end; ++ty)
+		for(unsigned tx=x_begin/tile_size; tx*tile_size<x_end; ++tx)
+		{
+			unsigned tile = ty*tiles_x+tx;
+			if(tile_max[tile]<z_near)
+				continue;
+
+			// Part of the tile is at least as far as the bounds; check the pixels
+			unsigned x0 = tx*tile_size;
+			unsigned y0 = ty*tile_size;
+			unsigned row_begin = max(y_begin, y0)-y0;
+			unsigned row_end = min(y_end, y0+tile_size)-y0;
+			unsigned column_begin = max(x_begin, x0)-x0;
+			unsigned column_end = min(x_end, x0+tile_size)-x0;
+			const float *pixels = &depth[tile*tile_pixels];
+#ifdef __SSE2__
+			__m128 z = _mm_set1_ps(z_near);
+			for(unsigned x=0; x<tile_size; x+=4)
+			{
+				if(x+4<=column_begin || x>=column_end)
+					continue;
+
+				__m128 columns = _mm_setr_ps(x, x+1, x+2, x+3);
+				__m128 in_range = _mm_and_ps(_mm_cmpge_ps(columns, _mm_set1_ps(column_begin)), _mm_cmplt_ps(columns, _mm_set1_ps(column_end)));
+				for(unsigned y=row_begin; y<row_end; ++y)
+				{
+					__m128 visible = _mm_and_ps(in_range, _mm_cmpge_ps(_mm_loadu_ps(pixels+y*tile_size+x), z));
+					if(_mm_movemask_ps(visible))
+						return false;
+				}
+			}
+#else
+			for(unsigned y=row_begin; y<row_end; ++y)
+				for(unsigned x=column_begin; x<column_end; ++x)
+					if(pixels[y*tile_size+x]>=z_near)
+						return false;
+#endif
+		}
+
+	return true;
+}
+
+float OcclusionBuffer::get_depth(unsigned x, unsigned y) const
+{
+	unsigned tile = (y/tile_size)*tiles_x+x/tile_size;
+	return depth[tile*tile_pixels+(y%tile_size)*tile_size+x%tile_size];
+}
+
+OcclusionBuffer::ClipVertex OcclusionBuffer::transform_to_clip(const Matrix &matrix, const Vector &v)
+{
+	const float *m = matrix.m;
+	ClipVertex result;
+	result.x = v.x*m[0]+v.y*m[4]+v.z*m[8]+m[12];
+	result.y = v.x*m[1]+v.y*m[5]+v.z*m[9]+m[13];
+	result.z = v.x*m[2]+v.y*m[6]+v.z*m[10]+m[14];
+	result.w = v.x*m[3]+v.y*m[7]+v.z*m[11]+m[15];
+	return result;
+}
+
+float OcclusionBuffer::clip_distance(const ClipVertex &v, unsigned plane)
+{
+	switch(plane)
+	{
+	case 0: return v.w+v.z;
+	case 1: return v.w+v.x;
+	case 2: return v.w-v.x;
+	case 3: return v.w+v.y;
+	default: return v.w-v.y;
+	}
+}
+
+unsigned OcclusionBuffer::clip_polygon(const ClipVertex *in, unsigned n_in, unsigned plane, ClipVertex *out)
+{
+	// Keep the parts of the polygon's edges on the inner side of the plane
+	unsigned n_out = 0;
+	for(unsigned i=0; i<n_in; ++i)
+	{
+		const ClipVertex &v1 = in[i];
+		const ClipVertex &v2 = in[(i+1)%n_in];
+		float d1 = clip_distance(v1, plane);
+		float d2 = clip_distance(v2, plane);
+		if(d1>=0)
+			out[n_out++] = v1;
+		if((d1>=0)!=(d2>=0))
+		{
+			float t = d1/(d1-d2);
+			ClipVertex &v = out[n_out++];
+			v.x = v1.x+(v2.x-v1.x)*t;
+			v.y = v1.y+(v2.y-v1.y)*t;
+			v.z = v1.z+(v2.z-v1.z)*t;
+			v.w = v1.w+(v2.w-v1.w)*t;
+		}
+	}
+
+	return n_out;
+}
+
+} // namespace SkrolliGL
@@ -0,0 +1,87 @@
+#ifndef SKROLLIGL_OCCLUSIONBUFFER_H_
+#define SKROLLIGL_OCCLUSIONBUFFER_H_
+
+#include <vector>
+#include "mathutils.h"
+
+namespace SkrolliGL {
+
+/*
+A small depth buffer rendered on the CPU for occlusion culling.  Large things
+which hide much of the scene, such as walls and terrain, are drawn into it as
+occluders.  Bounds can then be tested against it to find out if they are
+entirely behind the occluders.
+
+Occluders are triangle lists with a matrix which transforms them to clip space,
+usually the product of the projection and modelview matrices.  Depth is stored
+as normalized device Z, like OpenGL would store it.  A pixel is covered by a
+triangle if its center is, so an occluder which covers part of a pixel may hide
+something seen next to it.  At the low resolution of the buffer this is rarely
+noticeable.
+
+The pixels are stored in tiles of 8×8, and the farthest depth of each tile is
+kept up to date.  Triangles skip the tiles they don't touch or are behind
+everything in, and most tests are decided by the tile depths alone.  With SSE2,
+four pixels are processed at once.  Other architectures use scalar code that
+gives the same results.
+
+No GL context is needed, so the buffer can also be used and tested without a
+GPU.
+*/
+class OcclusionBuffer
+{
+private:
+	// A vertex in homogeneous clip space
+	struct ClipVertex
+	{
+		float x, y, z, w;
+	};
+
+	unsigned width;
+	unsigned height;
+	unsigned tiles_x;
+	unsigned tiles_y;
+	std::vector<float> depth;
+	std::vector<float> tile_max;
+	unsigned n_triangles;
+	std::vector<ClipVertex> clip_vertices;
+	std::vector<unsigned> outcodes;
+
+public:
+	/* Creates a buffer of the given width and height in pixels.  The size is
+	rounded up to whole tiles. */
+	OcclusionBuffer(unsigned, unsigned);
+
+	unsigned get_width() const { return width; }
+	unsigned get_height() const { return height; }
+
+	/* Resets every pixel to the far plane. */
+	void clear();
+
+	/* Draws occluder triangles, given as vertices and a triangle list of
+	indices, transformed by a matrix to clip space.  Triangles are clipped to
+	the view and drawn from both sides. */
+	void draw(const Matrix &, const std::vector<Vector> &, const std::vector<unsigned> &);
+private:
+	void draw_triangle(const Vector &, const Vector &, const Vector &);
+	static ClipVertex transform_to_clip(const Matrix &, const Vector &);
+	static float clip_distance(const ClipVertex &, unsigned);
+	static unsigned clip_polygon(const ClipVertex *, unsigned, unsigned, ClipVertex *);
+
+public:
+	/* Checks if bounds transformed by a matrix to clip space are entirely
+	behind occluders.  Bounds that reach past the near plane are never
+	considered occluded, and neither are empty or infinite bounds. */
+	bool is_occluded(const Matrix &, const Bounds &) const;
+
+	/* Returns the depth of a pixel.  Rows are counted from the bottom. */
+	float get_depth(unsigned, unsigned) const;
+
+	/* Returns the number of triangles drawn since the last clear, counted
+	after clipping. */
+	unsigned get_triangle_count() const { return n_triangles; }
+};
+
+} // namespace SkrolliGL
+
+#endif
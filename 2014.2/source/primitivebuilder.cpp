@@ -0,0 +1,205 @@
+#include <algorithm>
+#include "primitivebuilder.h"
+
+using namespace std;
+
+namespace SkrolliGL {
+
+typedef ObjParser::Face Face;
+
+/* Maps directed edges to the faces they belong to.  Edges are grouped by their
+starting vertex, so finding a face to continue a triangle strip only needs to
+look at the handful of faces around a single vertex. */
+class EdgeTable
+{
+private:
+	struct Edge
+	{
+		unsigned end;
+		unsigned face;
+		unsigned corner;
+	};
+
+	vector<unsigned> offsets;
+	vector<Edge> edges;
+
+public:
+	EdgeTable(const vector<Face> &, unsigned);
+
+	/* Finds the first unused face of a submesh which has an edge from one
+	vertex to another.  Returns the index of the face, or -1 if there isn't
+	one.  The position of the edge's starting vertex within the face is stored
+	in corner. */
+	unsigned find_unused_face(const vector<Face> &, const vector<bool> &, unsigned, unsigned, unsigned, unsigned &corner) const;
+};
+
+void sort_faces(vector<Face> &faces, unsigned n_submeshes)
+{
+	// Counting sort keeps the faces of each submesh in their original order
+	vector<unsigned> offsets(n_submeshes+1, 0);
+	for(vector<Face>::const_iterator i=faces.begin(); i!=faces.end(); ++i)
+		++offsets[i->submesh+1];
+	for(unsigned i=0; i<n_submeshes; ++i)
+		offsets[i+1] += offsets[i];
+
+	vector<Face> sorted(faces.size());
+	for(vector<Face>::const_iterator i=faces.begin(); i!=faces.end(); ++i)
+		sorted[offsets[i->submesh]++] = *i;
+	faces.swap(sorted);
+}
+
+void build_triangle_strips(const vector<Face> &faces, unsigned n_vertices, vector<unsigned> &indices, vector<Object::SubMesh> &ranges)
+{
+	EdgeTable edges(faces, n_vertices);
+	vector<bool> used(faces.size(), false);
+
+	// Construct index array for triangle strips
+	indices.reserve(faces.size()*4);
+	unsigned face_index = 0;
+	while(1)
+	{
+		/* Search for an unused face.  Faces are only ever marked as used, so
+		the search can resume from where the previous one left off. */
+		for(; face_index<faces.size(); ++face_index)
+			if(!used[face_index])
+				break;
+
+		// Have all faces been processed?
+		if(face_index==faces.size())
+			break;
+
+		const Face *face = &faces[face_index];
+
+		/* Inject restart index if this is not the first strip.  There's one
+		between submeshes too, which makes the index array easier to analyze;
+		it's not part of either range. */
+		if(!indices.empty())
+			indices.push_back(0xFFFFFFFF);
+
+		Object::SubMesh &range = ranges[face->submesh];
+		if(!range.count)
+			range.first = indices.size();
+
+		// Add the initial face's indices to the strip
+		used[face_index] = true;
+		indices.push_back(face->indices[0]);
+		indices.push_back(face->indices[1]);
+		if(face->nverts==4)
+			indices.push_back(face->indices[3]);
+		indices.push_back(face->indices[2]);
+
+		unsigned triangle_count = face->nverts-2;
+		while(1)
+		{
+			unsigned last_index = indices.back();
+			unsigned prev_index = indices[indices.size()-2];
+			if(triangle_count%2)
+				swap(last_index, prev_index);
+
+			// Try to find a face that uses the last two indices in the correct order
+			unsigned i;
+			unsigned next_index = edges.find_unused_face(faces, used, face->submesh, prev_index, last_index, i);
+
+			// If there was no suitable face to continue this strip, break out
+			if(next_index==~0U)
+				break;
+
+			const Face &next = faces[next_index];
+			used[next_index] = true;
+			// For quadrilateral faces we have to emit two triangles
+			if(next.nverts==4 && !(triangle_count%2))
+				indices.push_back(next.indices[(i+3)%next.nverts]);
+			indices.push_back(next.indices[(i+2)%next.nverts]);
+			if(next.nverts==4 && (triangle_count%2))
+				indices.push_back(next.indices[(i+3)%next.nverts]);
+
+			triangle_count += next.nverts-2;
+		}
+
+		range.count = indices.size()-range.first;
+	}
+}
+
+void build_triangle_list(const vector<unsigned> &strip_indices, const vector<Object::SubMesh> &strip_ranges, vector<unsigned> &indices, vector<Object::SubMesh> &ranges)
+{
+	indices.reserve(strip_indices.size()*3);
+	for(unsigned i=0; i<strip_ranges.size(); ++i)
+	{
+		vector<unsigned>::const_iterator begin = strip_indices.begin()+strip_ranges[i].first;
+		ranges[i].first = indices.size();
+		append_strip_as_list(begin, begin+strip_ranges[i].count, indices);
+		ranges[i].count = indices.size()-ranges[i].first;
+	}
+}
+
+void append_strip_as_list(vector<unsigned>::const_iterator begin, vector<unsigned>::const_iterator end, vector<unsigned> &list)
+{
+	// Every other triangle of a strip has reversed winding
+	unsigned parity = 0;
+	for(vector<unsigned>::const_iterator i=begin; i+2<end; ++i, ++parity)
+	{
+		unsigned a = i[0];
+		unsigned b = i[1];
+		unsigned c = i[2];
+		if(a==0xFFFFFFFF || b==0xFFFFFFFF || c==0xFFFFFFFF)
+		{
+			// A restart begins a new strip after the restart index
+			parity = 1;
+			continue;
+		}
+		if(a==b || b==c || a==c)
+			continue;
+
+		list.push_back(a);
+		list.push_back(parity%2 ? c : b);
+		list.push_back(parity%2 ? b : c);
+	}
+}
+
+EdgeTable::EdgeTable(const vector<Face> &faces, unsigned n_vertices):
+	offsets(n_vertices+1, 0)
+{
+	/* Only the first occurrence of each vertex in a face gets an edge.
+	Degenerate faces could otherwise be continued from the wrong corner. */
+	for(vector<Face>::const_iterator i=faces.begin(); i!=faces.end(); ++i)
+		for(unsigned j=0; j<i->nverts; ++j)
+			if(find(i->indices, i->indices+j, i->indices[j])==i->indices+j)
+				++offsets[i->indices[j]+1];
+
+	// Turn the counts into offsets.  This is a counting sort by start vertex.
+	for(unsigned i=0; i<n_vertices; ++i)
+		offsets[i+1] += offsets[i];
+
+	edges.resize(offsets.back());
+	vector<unsigned> fill(offsets.begin(), offsets.end()-1);
+	for(vector<Face>::const_iterator i=faces.begin(); i!=faces.end(); ++i)
+		for(unsigned j=0; j<i->nverts; ++j)
+			if(find(i->indices, i->indices+j, i->indices[j])==i->indices+j)
+			{
+				Edge &edge = edges[fill[i->indices[j]]++];
+				edge.end = i->indices[(j+1)%i->nverts];
+				edge.face = i-faces.begin();
+				edge.corner = j;
+			}
+}
+
+unsigned EdgeTable::find_unused_face(const vector<Face> &faces, const vector<bool> &used, unsigned submesh, unsigned start, unsigned end, unsigned &corner) const
+{
+	// Edges were inserted in face order, so the first match is the lowest face
+	for(unsigned i=offsets[start]; i<offsets[start+1]; ++i)
+	{
+		const Edge &edge = edges[i];
+		if(edge.end!=end || used[edge.face])
+			continue;
+
+		if(faces[edge.face].submesh==submesh)
+		{
+			corner = edge.corner;
+			return edge.face;
+		}
+	}
+
+	return ~0U;
+}
+
+} // namespace SkrolliGL
@@ -0,0 +1,33 @@
+#ifndef SKROLLIGL_PRIMITIVEBUILDER_H_
+#define SKROLLIGL_PRIMITIVEBUILDER_H_
+
+#include <vector>
+#include "object.h"
+#include "objparser.h"
+
+namespace SkrolliGL {
+
+/* Sorts faces by submesh.  The faces of each submesh keep their relative
+order. */
+void sort_faces(std::vector<ObjParser::Face> &, unsigned n_submeshes);
+
+/* Joins faces into triangle strips separated by the restart index 0xFFFFFFFF.
+Each strip is continued with the lowest unused face sharing its last edge, so
+the result only depends on the order of the faces.  Faces must be sorted by
+submesh, and ranges must have an element for every submesh.  A quad which
+continues a strip is split along the diagonal from the corner the strip enters
+it from, so non-planar quads may be split either way. */
+void build_triangle_strips(const std::vector<ObjParser::Face> &, unsigned n_vertices, std::vector<unsigned> &, std::vector<Object::SubMesh> &ranges);
+
+/* Builds an indexed triangle list from the output of build_triangle_strips.
+The triangles keep the split of each quad and the winding they have in the
+strips, in strip order; optimize them for the vertex cache afterwards. */
+void build_triangle_list(const std::vector<unsigned> &strip_indices, const std::vector<Object::SubMesh> &strip_ranges, std::vector<unsigned> &, std::vector<Object::SubMesh> &ranges);
+
+/* Appends the triangles of strips separated by restart indices to a triangle
+list.  Degenerate triangles are left out. */
+void append_strip_as_list(std::vector<unsigned>::const_iterator, std::vector<unsigned>::const_iterator, std::vector<unsigned> &);
+
+} // namespace SkrolliGL
+
+#endif
@@ -0,0 +1,100 @@
+#include <algorithm>
+#include "renderable.h"
+#include "renderqueue.h"
+
+using namespace std;
+
+namespace SkrolliGL {
+
+static void remove_one(vector<const Renderable *> &, const Renderable *);
+
+// Stamp 1 belongs to the default identity transform
+SDL_atomic_t WorldTransform::last_stamp = { 1 };
+
+unsigned WorldTransform::new_stamp()
+{
+	// Skip the reserved stamps if the counter wraps around
+	unsigned stamp;
+	do
+		stamp = SDL_AtomicAdd(&last_stamp, 1)+1;
+	while(stamp<2);
+	return stamp;
+}
+
+
+Renderable::~Renderable()
+{
+	// Each link is listed on both sides, once for every time it was made
+	for(vector<const Renderable *>::const_iterator i=parents.begin(); i!=parents.end(); ++i)
+	{
+		remove_one((*i)->children, this);
+		(*i)->child_destroyed(*this);
+	}
+	for(vector<const Renderable *>::const_iterator i=children.begin(); i!=children.end(); ++i)
+		remove_one((*i)->parents, this);
+}
+
+void Renderable::render_queued(const RenderState &state) const
+{
+	/* The queues are kept so that their memory and stream buffers are reused.
+	A custom item may call this again while its queue is rendering, so each
+	level of nesting gets its own.  They're never deleted, since their buffers
+	belong to the GL context. */
+	static vector<RenderQueue *> queues;
+	static unsigned nesting = 0;
+	if(nesting==queues.size())
+		queues.push_back(new RenderQueue);
+
+	RenderQueue &queue = *queues[nesting];
+	queue.clear();
+	queue.set_projection_matrix(state.projection_matrix);
+	queue.set_view_matrix(state.modelview_matrix);
+	collect(queue, WorldTransform());
+	queue.sort();
+
+	++nesting;
+	try
+	{
+		queue.render(state);
+	}
+	catch(...)
+	{
+		--nesting;
+		throw;
+	}
+	--nesting;
+}
+
+void Renderable::bounds_changed() const
+{
+	for(vector<const Renderable *>::const_iterator i=parents.begin(); i!=parents.end(); ++i)
+		(*i)->child_bounds_changed(*this);
+}
+
+void Renderable::add_parent(const Renderable &parent) const
+{
+	parents.push_back(&parent);
+	parent.children.push_back(this);
+}
+
+void Renderable::remove_parent(const Renderable &parent) const
+{
+	remove_one(parents, &parent);
+	remove_one(parent.children, this);
+}
+
+void Renderable::collect(RenderQueue &queue, const WorldTransform &world) const
+{
+	queue.add(*this, world.matrix);
+}
+
+
+void remove_one(vector<const Renderable *> &renderables, const Renderable *renderable)
+{
+	// A Renderable may be contained several times in the same parent
+	vector<const Renderable *>::iterator i = find(renderables.begin(), renderables.end(), renderable);
+	if(i!=renderables.end())
+		renderables.erase(i);
+}
+
+} // namespace SkrolliGL
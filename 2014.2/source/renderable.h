@@ -1,10 +1,29 @@
 #ifndef SKROLLIGL_RENDERABLE_H_
 #define SKROLLIGL_RENDERABLE_H_
 
+#include <vector>
+#include <SDL.h>
 #include "mathutils.h"
 
 namespace SkrolliGL {
 
+class RenderQueue;
+
+/*
+Counts the work done by view frustum culling.  Each Renderable whose bounds are
+tested counts once, and those found to be outside the frustum are culled along
+with their contents.  Objects which pass the frustum test but are hidden behind
+occluders are counted as occluded.
+*/
+struct CullingStats
+{
+	unsigned tested;
+	unsigned culled;
+	unsigned occluded;
+
+	CullingStats(): tested(0), culled(0), occluded(0) { }
+};
+
 /*
 Holds global render state.  A RenderState instance is passed to each Renderable
 during the rendering of a frame.
@@ -19,21 +38,92 @@ struct RenderState
 	float ambient_intensity;
 };
 
+/*
+A matrix from some coordinate space to world space, with a stamp identifying its
+value.  Every computed world matrix gets a new stamp, so a Renderable which is
+given the same stamp as last time knows that nothing above it has moved and can
+reuse whatever it derived from the matrix.  The default is identity, which has a
+stamp of its own.  Stamps are never zero, and new ones may be taken from several
+threads at once.
+*/
+struct WorldTransform
+{
+	Matrix matrix;
+	unsigned stamp;
+
+	static SDL_atomic_t last_stamp;
+
+	WorldTransform(): stamp(1) { }
+	WorldTransform(const Matrix &m, unsigned s): matrix(m), stamp(s) { }
+
+	/* Returns a stamp which hasn't been used before. */
+	static unsigned new_stamp();
+};
+
 /*
 An abstract base class for things that can be rendered.
+
+Containers cache things derived from their contents, such as bounds.  They
+register themselves as parents of the Renderables they contain, and
+Renderables call bounds_changed to let their parents know that the caches are
+out of date.  A Renderable may be contained in several places, so it can have
+any number of parents.
+
+The links are kept on both sides.  A destroyed Renderable unlinks itself from
+its parents and children, so containers and their contents may be destroyed in
+any order.  Parents are told through child_destroyed and must forget the
+child.
 */
 class Renderable
 {
+private:
+	mutable std::vector<const Renderable *> parents;
+	mutable std::vector<const Renderable *> children;
+
 protected:
 	Renderable() { }
 
+	/* Renders by collecting into a RenderQueue which is reused between calls.
+	Renderables which implement collect can use this to implement render. */
+	void render_queued(const RenderState &) const;
+
+	/* Notifies parents that the bounds of the Renderable have changed. */
+	void bounds_changed() const;
+
+	/* Called when the bounds of a Renderable contained in this one have
+	changed.  The default implementation passes the notification on to the
+	parents.  Containers which cache bounds should discard them here. */
+	virtual void child_bounds_changed(const Renderable &) const { bounds_changed(); }
+
+	/* Called when a Renderable contained in this one is being destroyed.  The
+	link between them has already been removed.  Containers which refer to
+	their contents must drop the child here. */
+	virtual void child_destroyed(const Renderable &) const { }
+
 public:
-	virtual ~Renderable() { }
+	virtual ~Renderable();
+
+	/* Registers a container of the Renderable.  Containers must remove
+	themselves when they stop containing the Renderable.  Destroying either
+	one removes the link. */
+	void add_parent(const Renderable &) const;
+	void remove_parent(const Renderable &) const;
 
 	/* Renders the renderable.  It is permissible to modify the shader program
 	binding, the texture binding for texture unit 0 and the vertex array
 	binding.  All other state must be restored after use. */
 	virtual void render(const RenderState &) const = 0;
+
+	/* Adds whatever the renderable draws to a RenderQueue.  The transform
+	maps the renderable's coordinates to world space; the view matrix comes
+	from the RenderQueue.  The default implementation adds an item which calls
+	render(). */
+	virtual void collect(RenderQueue &, const WorldTransform &) const;
+
+	/* Returns bounds which enclose everything the renderable draws, in its own
+	coordinate space.  Containers use these to skip contents that are outside
+	the view.  The default is infinite bounds, which are never culled. */
+	virtual Bounds get_bounds() const { return Bounds::infinity(); }
 };
 
 } // namespace SkrolliGL
@@ -0,0 +1,845 @@
+#include <algorithm>
+#include <cstring>
+#include <GL/glew.h>
+#include "glstate.h"
+#include "jobpool.h"
+#include "material.h"
+#include "object.h"
+#include "occlusionbuffer.h"
+#include "renderqueue.h"
+#include "shader.h"
+#include "streambuffer.h"
+#include "texture.h"
+
+using namespace std;
+
+namespace SkrolliGL {
+
+// Widths of the fields of sort keys.  The depth takes the rest of the bits.
+const unsigned pass_bits = 2;
+const unsigned shader_bits = 10;
+const unsigned texture_bits = 12;
+const unsigned material_bits = 10;
+const unsigned object_bits = 14;
+const unsigned depth_bits = 64-pass_bits-shader_bits-texture_bits-material_bits-object_bits;
+
+// Enough for a few frames of a typical scene.  Larger frames grow the buffer.
+const unsigned stream_buffer_size = 0x100000;
+
+// Size of the sort id tables when the first id is added
+const unsigned min_sort_id_slots = 64;
+
+struct RenderQueue::CollectJob: public JobPool::Job
+{
+	RenderQueue &queue;
+	vector<const Renderable *> contents;
+	WorldTransform world;
+	Frustum frustum;
+	bool cull;
+
+	CollectJob(RenderQueue &);
+
+	virtual void run();
+};
+
+static unsigned hash_pointer(const void *);
+static unsigned depth_to_bits(float);
+static bool is_same_draw(const RenderQueue::DrawItem &, const RenderQueue::DrawItem &);
+static bool is_same_state(const RenderQueue::DrawItem &, const RenderQueue::DrawItem &);
+static bool has_depth_variant(const RenderQueue::DrawItem &);
+static unsigned get_uniform_alignment();
+
+RenderQueue::RenderQueue():
+	occlusion_buffer(0),
+	job_pool(0),
+	collect_job(0),
+	n_acquired_lists(0),
+	depth_prepass(false),
+	stream_buffer(0),
+	frame_block_offset(0),
+	draw_blocks_offset(0),
+	instance_data_offset(0),
+	draw_commands_offset(0)
+{ }
+
+RenderQueue::~RenderQueue()
+{
+	for(vector<SubQueue>::const_iterator i=subqueues.begin(); i!=subqueues.end(); ++i)
+		delete i->queue;
+	for(vector<RenderQueue *>::const_iterator i=spare_subqueues.begin(); i!=spare_subqueues.end(); ++i)
+		delete *i;
+	delete collect_job;
+	delete stream_buffer;
+}
+
+void RenderQueue::clear()
+{
+	items.clear();
+	depth_items.clear();
+	occluders.clear();
+	occlusion_tests.clear();
+	recycle_subqueues(subqueues);
+	n_acquired_lists = 0;
+	culling_stats = CullingStats();
+	shader_ids.clear();
+	texture_ids.clear();
+	material_ids.clear();
+	object_ids.clear();
+}
+
+void RenderQueue::set_projection_matrix(const Matrix &m)
+{
+	projection_matrix = m;
+	view_projection_matrix = projection_matrix*view_matrix;
+}
+
+void RenderQueue::set_view_matrix(const Matrix &m)
+{
+	view_matrix = m;
+	view_projection_matrix = projection_matrix*view_matrix;
+}
+
+void RenderQueue::add(const DrawItem &item)
+{
+	items.push_back(item);
+	// Ids must be assigned in the order of the merged queue
+	if(!job_pool)
+		items.back().sort_key = make_sort_key(item);
+}
+
+void RenderQueue::add(const Renderable &renderable, const Matrix &world)
+{
+	DrawItem item;
+	item.model_matrix = world;
+	item.renderable = &renderable;
+	add(item);
+}
+
+unsigned long long RenderQueue::make_sort_key(const DrawItem &item)
+{
+	// Custom items are left in the order they were added
+	if(!item.object)
+		return static_cast<unsigned long long>(CUSTOM_PASS)<<(64-pass_bits);
+
+	const Shader *shader = (item.material ? item.material->get_shader() : 0);
+	const Texture *texture = (item.material ? item.material->get_texture() : 0);
+
+	unsigned long long key = OPAQUE_PASS;
+	key = (key<<shader_bits) | shader_ids.get(shader, shader_bits);
+	key = (key<<texture_bits) | texture_ids.get(texture, texture_bits);
+	key = (key<<material_bits) | material_ids.get(item.material, material_bits);
+	key = (key<<object_bits) | object_ids.get(item.object, object_bits);
+	key = (key<<depth_bits) | depth_to_bits(item.depth);
+
+	return key;
+}
+
+bool RenderQueue::is_visible(const Frustum &frustum, const Bounds &bounds)
+{
+	++culling_stats.tested;
+	if(frustum.intersects(bounds))
+		return true;
+
+	++culling_stats.culled;
+	return false;
+}
+
+void RenderQueue::add_culling_stats(const CullingStats &stats)
+{
+	culling_stats.tested += stats.tested;
+	culling_stats.culled += stats.culled;
+	culling_stats.occluded += stats.occluded;
+}
+
+void RenderQueue::set_occlusion_buffer(OcclusionBuffer *buffer)
+{
+	occlusion_buffer = buffer;
+}
+
+void RenderQueue::add_occluder(const Object &object, const Matrix &world, float depth)
+{
+	Occluder occluder;
+	occluder.object = &object;
+	occluder.model_matrix = world;
+	occluder.depth = depth;
+	occluders.push_back(occluder);
+}
+
+void RenderQueue::add_occlusion_test(const Object &object, const Matrix &world, unsigned begin)
+{
+	// Objects may have added no items at all
+	if(begin==items.size())
+		return;
+
+	OcclusionTest test;
+	test.object = &object;
+	test.model_matrix = world;
+	test.begin = begin;
+	test.end = items.size();
+	occlusion_tests.push_back(test);
+}
+
+void RenderQueue::set_job_pool(JobPool *pool)
+{
+	job_pool = pool;
+}
+
+RenderQueue &RenderQueue::add_subqueue()
+{
+	SubQueue sub;
+	sub.position = items.size();
+	if(spare_subqueues.empty())
+		sub.queue = new RenderQueue;
+	else
+	{
+		sub.queue = spare_subqueues.back();
+		spare_subqueues.pop_back();
+	}
+	sub.queue->projection_matrix = projection_matrix;
+	sub.queue->view_matrix = view_matrix;
+	sub.queue->view_projection_matrix = view_projection_matrix;
+	sub.queue->occlusion_buffer = occlusion_buffer;
+	sub.queue->job_pool = job_pool;
+	subqueues.push_back(sub);
+
+	return *sub.queue;
+}
+
+void RenderQueue::add_collect_job(vector<const Renderable *>::const_iterator begin, vector<const Renderable *>::const_iterator end, const WorldTransform &world, const Frustum *frustum)
+{
+	RenderQueue &sub = add_subqueue();
+	if(!sub.collect_job)
+		sub.collect_job = new CollectJob(sub);
+
+	CollectJob &job = *sub.collect_job;
+	job.contents.assign(begin, end);
+	job.world = world;
+	job.cull = (frustum!=0);
+	if(frustum)
+		job.frustum = *frustum;
+	job_pool->add(job);
+}
+
+vector<const Renderable *> &RenderQueue::acquire_renderable_list()
+{
+	// A deque doesn't move its elements, so lists acquired earlier stay valid
+	if(n_acquired_lists==renderable_lists.size())
+		renderable_lists.push_back(vector<const Renderable *>());
+
+	vector<const Renderable *> &list = renderable_lists[n_acquired_lists++];
+	list.clear();
+	return list;
+}
+
+void RenderQueue::release_renderable_list()
+{
+	--n_acquired_lists;
+}
+
+void RenderQueue::join()
+{
+	if(!job_pool)
+		return;
+
+	if(!subqueues.empty())
+		job_pool->wait();
+
+	/* Take the items collected on this thread aside and add them back with the
+	subqueues in their places.  The sorting buffer is free until sorting. */
+	sorted_items.swap(items);
+	items.clear();
+	joined_tests.swap(occlusion_tests);
+	occlusion_tests.clear();
+	joined_subqueues.swap(subqueues);
+	subqueues.clear();
+	append_collected(sorted_items, joined_tests, joined_subqueues);
+
+	joined_tests.clear();
+	recycle_subqueues(joined_subqueues);
+}
+
+void RenderQueue::recycle_subqueues(vector<SubQueue> &subs)
+{
+	for(vector<SubQueue>::const_iterator i=subs.begin(); i!=subs.end(); ++i)
+	{
+		i->queue->clear();
+		spare_subqueues.push_back(i->queue);
+	}
+	subs.clear();
+}
+
+void RenderQueue::append_collected(const vector<DrawItem> &source_items, const vector<OcclusionTest> &source_tests, const vector<SubQueue> &source_subqueues)
+{
+	vector<OcclusionTest>::const_iterator test = source_tests.begin();
+	unsigned next = 0;
+	for(unsigned i=0; i<=source_subqueues.size(); ++i)
+	{
+		unsigned end = (i<source_subqueues.size() ? source_subqueues[i].position : source_items.size());
+
+		/* Tests cover the items of a single Object, which never contain a
+		subqueue, so they only need to be moved along with their items. */
+		unsigned offset = items.size()-next;
+		for(; (test!=source_tests.end() && test->begin<end); ++test)
+		{
+			occlusion_tests.push_back(*test);
+			occlusion_tests.back().begin += offset;
+			occlusion_tests.back().end += offset;
+		}
+
+		for(; next<end; ++next)
+		{
+			items.push_back(source_items[next]);
+			items.back().sort_key = make_sort_key(source_items[next]);
+		}
+
+		if(i<source_subqueues.size())
+		{
+			const RenderQueue &sub = *source_subqueues[i].queue;
+			append_collected(sub.items, sub.occlusion_tests, sub.subqueues);
+			occluders.insert(occluders.end(), sub.occluders.begin(), sub.occluders.end());
+			add_culling_stats(sub.culling_stats);
+		}
+	}
+}
+
+void RenderQueue::cull_occluded()
+{
+	if(!occlusion_buffer || occluders.empty())
+	{
+		occluders.clear();
+		occlusion_tests.clear();
+		return;
+	}
+
+	// Near occluders hide the most, and let farther ones skip covered tiles
+	std::sort(occluders.begin(), occluders.end());
+	occlusion_buffer->clear();
+	for(vector<Occluder>::const_iterator i=occluders.begin(); i!=occluders.end(); ++i)
+		occlusion_buffer->draw(view_projection_matrix*i->model_matrix, i->object->get_occluder_vertices(), i->object->get_occluder_indices());
+
+	/* The tests are in the order their items were added, so the hidden items
+	can be removed in a single pass. */
+	unsigned kept = 0;
+	unsigned next = 0;
+	for(vector<OcclusionTest>::const_iterator i=occlusion_tests.begin(); i!=occlusion_tests.end(); ++i)
+	{
+		for(; next<i->begin; ++next)
+			items[kept++] = items[next];
+
+		if(occlusion_buffer->is_occluded(view_projection_matrix*i->model_matrix, i->object->get_bounds()))
+		{
+			++culling_stats.occluded;
+			next = i->end;
+		}
+	}
+	for(; next<items.size(); ++next)
+		items[kept++] = items[next];
+	items.resize(kept);
+
+	occluders.clear();
+	occlusion_tests.clear();
+}
+
+void RenderQueue::sort()
+{
+	unsigned n_items = items.size();
+	sort_entries.resize(n_items);
+	for(unsigned i=0; i<n_items; ++i)
+	{
+		sort_entries[i].key = items[i].sort_key;
+		sort_entries[i].index = i;
+	}
+
+	radix_sort();
+
+	sorted_items.resize(n_items);
+	for(unsigned i=0; i<n_items; ++i)
+		sorted_items[i] = items[sort_entries[i].index];
+	items.swap(sorted_items);
+
+	depth_items.clear();
+	if(!depth_prepass)
+		return;
+
+	/* The pre-pass lays down depth front to back.  The depth gets all bits of
+	the key here, since state changes are cheap without color. */
+	sort_entries.clear();
+	for(unsigned i=0; i<n_items; ++i)
+		if(items[i].object && has_depth_variant(items[i]))
+		{
+			unsigned bits = 0;
+			if(items[i].depth>0)
+				memcpy(&bits, &items[i].depth, sizeof(bits));
+
+			SortEntry entry;
+			entry.key = bits;
+			entry.index = i;
+			sort_entries.push_back(entry);
+		}
+	radix_sort();
+
+	depth_items.resize(sort_entries.size());
+	for(unsigned i=0; i<sort_entries.size(); ++i)
+		depth_items[i] = items[sort_entries[i].index];
+}
+
+void RenderQueue::radix_sort()
+{
+	unsigned n_items = sort_entries.size();
+	sort_temp.resize(n_items);
+
+	/* Least significant digit first radix sort, eight bits at a time.  Each pass
+	is stable, so the final order is too. */
+	for(unsigned shift=0; shift<64; shift+=8)
+	{
+		unsigned counts[256] = { };
+		for(unsigned i=0; i<n_items; ++i)
+			++counts[(sort_entries[i].key>>shift)&0xFF];
+
+		// Skip digits which are the same in all keys
+		if(n_items==0 || counts[(sort_entries[0].key>>shift)&0xFF]==n_items)
+			continue;
+
+		unsigned offset = 0;
+		for(unsigned i=0; i<256; ++i)
+		{
+			unsigned count = counts[i];
+			counts[i] = offset;
+			offset += count;
+		}
+
+		for(unsigned i=0; i<n_items; ++i)
+			sort_temp[counts[(sort_entries[i].key>>shift)&0xFF]++] = sort_entries[i];
+		sort_entries.swap(sort_temp);
+	}
+}
+
+void RenderQueue::set_depth_prepass(bool enable)
+{
+	depth_prepass = enable;
+}
+
+void RenderQueue::render(const RenderState &state)
+{
+	bool indirect = multi_draw_indirect_supported();
+	bool instancing = instancing_supported();
+
+	if(!stream_buffer)
+		stream_buffer = new StreamBuffer(stream_buffer_size);
+	upload_frame_block(state);
+
+	if(depth_prepass)
+	{
+		build_batches(depth_items, indirect, instancing);
+		upload_batch_data();
+		glColorMask(false, false, false, false);
+		render_batches(depth_items, state, DEPTH_ONLY, indirect);
+		glColorMask(true, true, true, true);
+	}
+
+	build_batches(items, indirect, instancing);
+	upload_batch_data();
+	render_batches(items, state, (depth_prepass ? COLOR_AFTER_DEPTH : COLOR), indirect);
+
+	// The data can be overwritten once the GPU has finished these draws
+	stream_buffer->fence();
+}
+
+void RenderQueue::upload_frame_block(const RenderState &state)
+{
+	FrameBlock block;
+	copy(state.projection_matrix.m, state.projection_matrix.m+16, block.projection_matrix);
+	copy(view_matrix.m, view_matrix.m+16, block.view_matrix);
+	block.light_direction[0] = state.light_direction.x;
+	block.light_direction[1] = state.light_direction.y;
+	block.light_direction[2] = state.light_direction.z;
+	block.light_intensity = state.light_intensity;
+	block.sky_direction[0] = state.sky_direction.x;
+	block.sky_direction[1] = state.sky_direction.y;
+	block.sky_direction[2] = state.sky_direction.z;
+	block.ambient_intensity = state.ambient_intensity;
+
+	frame_block_offset = stream_buffer->write(&block, sizeof(block), get_uniform_alignment());
+}
+
+void RenderQueue::upload_batch_data()
+{
+	if(!draw_block_data.empty())
+		draw_blocks_offset = stream_buffer->write(&draw_block_data[0], draw_block_data.size(), get_uniform_alignment());
+	if(!instance_data.empty())
+		instance_data_offset = stream_buffer->write(&instance_data[0], instance_data.size()*sizeof(float), 4*sizeof(float));
+	if(!draw_commands.empty())
+		draw_commands_offset = stream_buffer->write(&draw_commands[0], draw_commands.size()*sizeof(DrawCommand), sizeof(unsigned));
+}
+
+void RenderQueue::bind_stream_buffer()
+{
+	// Writing may have moved the data to a larger buffer
+	unsigned id = stream_buffer->get_id();
+	glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_BLOCK, id, frame_block_offset, sizeof(FrameBlock));
+	if(!draw_commands.empty())
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, id);
+}
+
+void RenderQueue::render_batches(const vector<DrawItem> &draw_items, const RenderState &state, DrawMode mode, bool indirect)
+{
+	/* Track the material of the previous item.  Null means unknown, which
+	forces the next item to apply its material. */
+	const Material *material = 0;
+	bool material_instanced = false;
+	bool short_restart = false;
+
+	// The vertex array whose instance attributes point to the first matrix
+	unsigned instance_vertex_array = 0;
+
+	/* Without fixed restart indices, the engine sets the restart index for
+	32-bit indices.  It must be changed for strips with 16-bit indices. */
+	bool fixed_restart = Object::fixed_restart_index_supported();
+
+	// Whether the depth test is set up for items drawn in the pre-pass
+	bool equal_depth = false;
+
+	bind_stream_buffer();
+
+	for(vector<Batch>::const_iterator i=batches.begin(); i!=batches.end(); ++i)
+	{
+		const DrawItem &item = draw_items[i->begin];
+		if(!item.object)
+		{
+			if(short_restart)
+				glPrimitiveRestartIndex(0xFFFFFFFF);
+			short_restart = false;
+
+			// Custom items expect the usual depth test
+			if(equal_depth)
+			{
+				glDepthFunc(GL_LEQUAL);
+				glDepthMask(true);
+				equal_depth = false;
+			}
+
+			RenderState item_state = state;
+			item_state.modelview_matrix = view_matrix*item.model_matrix;
+			item.renderable->render(item_state);
+
+			/* The renderable may have bound things behind GLState's back,
+			including buffers of its own. */
+			GLState::invalidate();
+			bind_stream_buffer();
+			material = 0;
+			instance_vertex_array = 0;
+			continue;
+		}
+
+		if(item.material!=material || i->instanced!=material_instanced)
+		{
+			material = item.material;
+			material_instanced = i->instanced;
+			if(material && mode==DEPTH_ONLY)
+			{
+				// Only items with depth-only variants are in the pre-pass
+				Shader *shader = material->get_shader();
+				if(i->instanced)
+					shader = shader->get_instanced_variant();
+				shader = shader->get_depth_variant();
+				shader->bind();
+			}
+			else if(material)
+				material->apply(i->instanced);
+
+			/* Fragments of items in the pre-pass are shaded only where they
+			won.  Depth is already final there. */
+			if(mode==COLOR_AFTER_DEPTH && has_depth_variant(item)!=equal_depth)
+			{
+				equal_depth = !equal_depth;
+				glDepthFunc(equal_depth ? GL_EQUAL : GL_LEQUAL);
+				glDepthMask(!equal_depth);
+			}
+		}
+
+		GLState::bind_vertex_array(item.vertex_array);
+
+		bool needs_short_restart = (!fixed_restart && item.primitive_type==GL_TRIANGLE_STRIP && item.index_type==GL_UNSIGNED_SHORT);
+		if(needs_short_restart!=short_restart)
+		{
+			short_restart = needs_short_restart;
+			glPrimitiveRestartIndex(short_restart ? 0xFFFF : 0xFFFFFFFF);
+		}
+
+		if(i->instanced && indirect)
+		{
+			// Commands select their matrices by base instance
+			if(item.vertex_array!=instance_vertex_array)
+			{
+				set_instance_attributes(instance_data_offset);
+				instance_vertex_array = item.vertex_array;
+			}
+			glMultiDrawElementsIndirect(item.primitive_type, item.index_type, reinterpret_cast<void *>(draw_commands_offset+i->first_draw*sizeof(DrawCommand)), i->n_draws, 0);
+		}
+		else if(i->instanced)
+		{
+			set_instance_attributes(instance_data_offset+i->first_instance*16*sizeof(float));
+			glDrawElementsInstancedBaseVertex(item.primitive_type, item.count, item.index_type, reinterpret_cast<void *>(item.first), i->end-i->begin, item.base_vertex);
+		}
+		else
+		{
+			glBindBufferRange(GL_UNIFORM_BUFFER, DRAW_BLOCK, stream_buffer->get_id(), draw_blocks_offset+i->draw_block_offset, sizeof(item.model_matrix.m));
+			if(i->n_draws>1)
+				glMultiDrawElementsBaseVertex(item.primitive_type, &multi_draw_counts[i->first_draw], item.index_type, &multi_draw_offsets[i->first_draw], i->n_draws, &multi_draw_base_vertices[i->first_draw]);
+			else
+				glDrawElementsBaseVertex(item.primitive_type, item.count, item.index_type, reinterpret_cast<void *>(item.first), item.base_vertex);
+		}
+	}
+
+	if(short_restart)
+		glPrimitiveRestartIndex(0xFFFFFFFF);
+	if(equal_depth)
+	{
+		glDepthFunc(GL_LEQUAL);
+		glDepthMask(true);
+	}
+}
+
+void RenderQueue::build_batches(const vector<DrawItem> &draw_items, bool indirect, bool instancing)
+{
+	batches.clear();
+	draw_block_data.clear();
+	unsigned alignment = get_uniform_alignment();
+	unsigned draw_block_stride = (sizeof(float)*16+alignment-1)/alignment*alignment;
+	instance_data.clear();
+	draw_commands.clear();
+	multi_draw_counts.clear();
+	multi_draw_offsets.clear();
+	multi_draw_base_vertices.clear();
+
+	unsigned n_items = draw_items.size();
+	for(unsigned i=0; i<n_items; )
+	{
+		const DrawItem &item = draw_items[i];
+		Batch batch;
+		batch.begin = i;
+		batch.end = i+1;
+		batch.instanced = false;
+		batch.first_instance = instance_data.size()/16;
+		batch.first_draw = 0;
+		batch.n_draws = 0;
+
+		const Shader *shader = (item.material ? item.material->get_shader() : 0);
+		bool can_instance = (instancing && shader && shader->get_instanced_variant());
+
+		if(!item.object)
+			;
+		else if(can_instance && indirect)
+		{
+			// Take every item with the same state, and make a command for each submesh
+			for(; (batch.end<n_items && is_same_state(item, draw_items[batch.end])); ++batch.end) ;
+			batch.instanced = true;
+			batch.first_draw = draw_commands.size();
+			unsigned index_size = (item.index_type==GL_UNSIGNED_SHORT ? 2 : 4);
+			for(unsigned j=batch.begin; j<batch.end; )
+			{
+				unsigned copies = 1;
+				for(; (j+copies<batch.end && is_same_draw(draw_items[j], draw_items[j+copies])); ++copies) ;
+
+				DrawCommand command;
+				command.count = draw_items[j].count;
+				command.instance_count = copies;
+				command.first_index = draw_items[j].first/index_size;
+				command.base_vertex = draw_items[j].base_vertex;
+				command.base_instance = batch.first_instance+j-batch.begin;
+				draw_commands.push_back(command);
+
+				j += copies;
+			}
+			batch.n_draws = draw_commands.size()-batch.first_draw;
+		}
+		else if(can_instance && i+1<n_items && is_same_draw(item, draw_items[i+1]))
+		{
+			for(; (batch.end<n_items && is_same_draw(item, draw_items[batch.end])); ++batch.end) ;
+			batch.instanced = true;
+		}
+		else
+		{
+			/* Without a per-draw model matrix, only items with the same matrix
+			can be drawn with one call. */
+			for(; (batch.end<n_items && is_same_state(item, draw_items[batch.end]) && !memcmp(draw_items[batch.end].model_matrix.m, item.model_matrix.m, sizeof(item.model_matrix.m))); ++batch.end) ;
+			batch.first_draw = multi_draw_counts.size();
+			for(unsigned j=batch.begin; j<batch.end; ++j)
+			{
+				multi_draw_counts.push_back(draw_items[j].count);
+				multi_draw_offsets.push_back(reinterpret_cast<const void *>(draw_items[j].first));
+				multi_draw_base_vertices.push_back(draw_items[j].base_vertex);
+			}
+			batch.n_draws = batch.end-batch.begin;
+
+			/* Each Draw block starts at a multiple of the offset alignment.  The
+			padding in between is never read. */
+			batch.draw_block_offset = draw_block_data.size();
+			const char *matrix_data = reinterpret_cast<const char *>(item.model_matrix.m);
+			draw_block_data.insert(draw_block_data.end(), matrix_data, matrix_data+sizeof(item.model_matrix.m));
+			draw_block_data.resize(batch.draw_block_offset+draw_block_stride);
+		}
+
+		if(batch.instanced)
+			for(unsigned j=batch.begin; j<batch.end; ++j)
+				instance_data.insert(instance_data.end(), draw_items[j].model_matrix.m, draw_items[j].model_matrix.m+16);
+
+		batches.push_back(batch);
+		i = batch.end;
+	}
+}
+
+void RenderQueue::set_instance_attributes(unsigned offset)
+{
+	/* Attribute pointers are part of the vertex array, which belongs to a
+	GeometryArena.  Shaders without instancing don't read these attributes. */
+	glBindBuffer(GL_ARRAY_BUFFER, stream_buffer->get_id());
+	for(unsigned i=0; i<4; ++i)
+	{
+		unsigned index = Object::MODEL+i;
+		glVertexAttribPointer(index, 4, GL_FLOAT, false, 16*sizeof(float), reinterpret_cast<void *>(offset+i*4*sizeof(float)));
+		glEnableVertexAttribArray(index);
+		glVertexAttribDivisor(index, 1);
+	}
+}
+
+bool RenderQueue::instancing_supported()
+{
+	return GLEW_VERSION_3_3 || GLEW_ARB_instanced_arrays;
+}
+
+bool RenderQueue::multi_draw_indirect_supported()
+{
+	// Base instances in indirect commands came with 4.2
+	return GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && (GLEW_VERSION_4_2 || GLEW_ARB_base_instance));
+}
+
+
+RenderQueue::DrawItem::DrawItem():
+	depth(0),
+	object(0),
+	renderable(0),
+	material(0),
+	vertex_array(0),
+	primitive_type(0),
+	index_type(0),
+	first(0),
+	count(0),
+	base_vertex(0),
+	sort_key(0)
+{ }
+
+
+unsigned RenderQueue::SortIds::get(const void *ptr, unsigned bits)
+{
+	/* Zero is reserved for null.  If there are more things than fit in the
+	bits, ids wrap around, which only makes the order less efficient. */
+	if(!ptr)
+		return 0;
+
+	// Keep at least half of the slots empty so that probe sequences stay short
+	if((count+1)*2>keys.size())
+		rehash(max<unsigned>(keys.size()*2, min_sort_id_slots));
+
+	unsigned mask = keys.size()-1;
+	unsigned slot = hash_pointer(ptr)&mask;
+	for(; (keys[slot] && keys[slot]!=ptr); slot=(slot+1)&mask) ;
+	if(!keys[slot])
+	{
+		keys[slot] = ptr;
+		ids[slot] = ++count;
+	}
+
+	return ids[slot]&((1<<bits)-1);
+}
+
+void RenderQueue::SortIds::clear()
+{
+	if(count)
+		fill(keys.begin(), keys.end(), static_cast<const void *>(0));
+	count = 0;
+}
+
+void RenderQueue::SortIds::rehash(unsigned size)
+{
+	vector<const void *> old_keys(size, 0);
+	vector<unsigned> old_ids(size, 0);
+	old_keys.swap(keys);
+	old_ids.swap(ids);
+
+	unsigned mask = size-1;
+	for(unsigned i=0; i<old_keys.size(); ++i)
+		if(old_keys[i])
+		{
+			unsigned slot = hash_pointer(old_keys[i])&mask;
+			for(; keys[slot]; slot=(slot+1)&mask) ;
+			keys[slot] = old_keys[i];
+			ids[slot] = old_ids[i];
+		}
+}
+
+
+RenderQueue::CollectJob::CollectJob(RenderQueue &q):
+	queue(q),
+	frustum(Matrix()),
+	cull(false)
+{ }
+
+void RenderQueue::CollectJob::run()
+{
+	for(vector<const Renderable *>::const_iterator i=contents.begin(); i!=contents.end(); ++i)
+		if(!cull || queue.is_visible(frustum, (*i)->get_bounds()))
+			(*i)->collect(queue, world);
+}
+
+
+unsigned hash_pointer(const void *ptr)
+{
+	// Heap blocks are aligned to 16 bytes, so the lowest bits carry nothing
+	unsigned hash = static_cast<unsigned>(reinterpret_cast<size_t>(ptr)>>4)*2654435761U;
+	return hash^(hash>>16);
+}
+
+bool is_same_draw(const RenderQueue::DrawItem &item1, const RenderQueue::DrawItem &item2)
+{
+	// The vertex array, index type and base vertex come from the Object
+	return (item1.object==item2.object && item1.material==item2.material && item1.primitive_type==item2.primitive_type && item1.first==item2.first && item1.count==item2.count);
+}
+
+bool is_same_state(const RenderQueue::DrawItem &item1, const RenderQueue::DrawItem &item2)
+{
+	// Custom items never share a draw call
+	return (item1.object && item2.object && item1.material==item2.material && item1.vertex_array==item2.vertex_array && item1.primitive_type==item2.primitive_type && item1.index_type==item2.index_type);
+}
+
+bool has_depth_variant(const RenderQueue::DrawItem &item)
+{
+	const Shader *shader = (item.material ? item.material->get_shader() : 0);
+	return (shader && shader->get_depth_variant());
+}
+
+unsigned get_uniform_alignment()
+{
+	// There is only one GL context, so the alignment never changes
+	static int alignment = 0;
+	if(!alignment)
+	{
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		alignment = max(alignment, 1);
+	}
+	return alignment;
+}
+
+unsigned depth_to_bits(float depth)
+{
+	/* The bit patterns of non-negative floats sort in the same order as their
+	values.  Keep the exponent and as much of the mantissa as fits. */
+	if(!(depth>0))
+		return 0;
+
+	unsigned bits;
+	memcpy(&bits, &depth, sizeof(bits));
+	return bits>>(32-depth_bits);
+}
+
+} // namespace SkrolliGL
@@ -0,0 +1,410 @@
+#ifndef SKROLLIGL_RENDERQUEUE_H_
+#define SKROLLIGL_RENDERQUEUE_H_
+
+#include <deque>
+#include <vector>
+#include "mathutils.h"
+#include "renderable.h"
+
+namespace SkrolliGL {
+
+class JobPool;
+class Material;
+class Object;
+class OcclusionBuffer;
+class StreamBuffer;
+
+/*
+A flat list of draw calls for a frame.  Rendering happens in two phases: first
+the scene is walked once with Renderable::collect, which culls invisible parts
+and adds an item for each submesh to be drawn.  Then render() submits the items
+in a single loop, only changing GL state when it differs from the previous
+item.
+
+To make state changes rare, every item gets a 64-bit sort key when it's added.
+From the most significant bits down, the key holds the pass, the shader, the
+texture, the material, the Object and the depth of the item.  Sorting the queue
+by key groups items which share a shader and texture together, and draws opaque
+items front to back within each Object.
+
+Objects with the same vertex layout share a vertex array through their
+GeometryArena, so after sorting, long runs of items only differ in their index
+ranges and model matrices.  If the shader has an instanced variant and the
+GL implementation supports indirect multi-draws, each run with the same
+material is submitted with a single glMultiDrawElementsIndirect call.  Copies of
+the same submesh become one command with several instances.  The model
+matrices of all items are uploaded into a per-instance attribute buffer once per
+frame, and each command finds its matrices through its base instance.
+
+Without indirect multi-draws, copies of the same submesh are drawn with a single
+instanced call, and items with the same material and model matrix are combined
+with glMultiDrawElementsBaseVertex.
+
+Shaders get their uniforms from uniform blocks instead of setting each value
+separately.  The values of the RenderState and the view matrix go into the
+Frame block, which is uploaded once per render.  Items carry the world
+matrices of their Renderables as model matrices, so collecting doesn't
+multiply matrices, and the shaders apply the view matrix.  Draws which aren't
+instanced take their model matrix from the Draw block.  The blocks of all such draws are packed together,
+and each draw binds its own range of them.
+
+Uniform blocks, instance matrices and indirect commands are all written into a
+StreamBuffer, so uploading them never waits for the GPU to finish earlier
+frames.
+
+With an OcclusionBuffer, the queue also does occlusion culling.  Objects add
+their occluder meshes and the bounds of their items while collecting.  After
+collecting, cull_occluded draws the occluders and removes the items of Objects
+which are hidden behind them.
+
+With a JobPool, collecting can be spread over several threads.  Renderables
+with many contents, such as large Groups, split them into jobs which collect
+into subqueues of their own.  After collecting, join waits for the jobs and
+merges the subqueues back in the places they were added at.  The result is the
+same as collecting on a single thread, including the order of items with equal
+keys.  Only collecting happens on the workers; the queue is sorted and
+rendered on the thread which owns the GL context.
+
+With a depth pre-pass, items whose shader has a depth-only variant are first
+drawn with that variant and color writes disabled, front to back so that hidden
+fragments are rejected early.  The color pass then draws in key order with an
+equal depth test, so fragments hidden by something else in the pre-pass are not
+shaded at all.  Shading cost becomes nearly independent of how many surfaces
+overlap, at the price of transforming the geometry twice.
+*/
+class RenderQueue
+{
+public:
+	/* Everything needed to draw one submesh.  The model matrix goes from
+	object space to world space.  It's the one given to the shader, so it
+	includes any position transform of the Object.  Items for Renderables which
+	don't support queueing have a null Object and are drawn by calling
+	render().  The depth is the distance of the item from
+	the viewer and is only used for ordering.  The first index is a byte offset
+	into the index buffer of the vertex array, and the base vertex is added to
+	every index. */
+	struct DrawItem
+	{
+		Matrix model_matrix;
+		float depth;
+		const Object *object;
+		const Renderable *renderable;
+		const Material *material;
+		unsigned vertex_array;
+		unsigned primitive_type;
+		unsigned index_type;
+		unsigned first;
+		unsigned count;
+		unsigned base_vertex;
+		unsigned long long sort_key;
+
+		DrawItem();
+	};
+
+	/* Binding points of the uniform blocks shaders may declare.  Both use the
+	std140 layout.  Frame holds, in order, mat4 projection, mat4 view, vec3
+	light_direction, float light_intensity, vec3 sky_direction and float
+	ambient_intensity.  The directions are in view space.  Draw holds mat4
+	model. */
+	enum UniformBlock
+	{
+		FRAME_BLOCK,
+		DRAW_BLOCK
+	};
+
+	/* Items are drawn in order of passes.  Custom items come last, since they
+	may change any state.  They aren't part of the depth pre-pass. */
+	enum Pass
+	{
+		OPAQUE_PASS,
+		CUSTOM_PASS
+	};
+
+private:
+	struct SortEntry
+	{
+		unsigned long long key;
+		unsigned index;
+	};
+
+	/* A run of items which is submitted with a single draw call.  Instanced
+	batches take their model matrices from instance_data, starting at
+	first_instance.  Other batches find theirs in draw_block_data at
+	draw_block_offset, which is relative to draw_blocks_offset.  Multi-draw
+	batches use n_draws entries starting at first_draw, either in
+	draw_commands or in the multi_draw arrays. */
+	struct Batch
+	{
+		unsigned begin;
+		unsigned end;
+		bool instanced;
+		unsigned first_instance;
+		unsigned draw_block_offset;
+		unsigned first_draw;
+		unsigned n_draws;
+	};
+
+	/* The contents of the Frame uniform block.  The floats fill the padding
+	std140 puts after each vec3. */
+	struct FrameBlock
+	{
+		float projection_matrix[16];
+		float view_matrix[16];
+		float light_direction[3];
+		float light_intensity;
+		float sky_direction[3];
+		float ambient_intensity;
+	};
+
+	/* An Object whose occluder mesh is drawn into the occlusion buffer.  The
+	depth is used to draw near occluders first. */
+	struct Occluder
+	{
+		const Object *object;
+		Matrix model_matrix;
+		float depth;
+
+		bool operator<(const Occluder &o) const { return depth<o.depth; }
+	};
+
+	/* A range of items which are removed if the bounds of an Object are
+	hidden. */
+	struct OcclusionTest
+	{
+		const Object *object;
+		Matrix model_matrix;
+		unsigned begin;
+		unsigned end;
+	};
+
+	/* A queue filled by a job.  Its contents go between the items before and
+	after the position. */
+	struct SubQueue
+	{
+		unsigned position;
+		RenderQueue *queue;
+	};
+
+	/* Collects a range of Renderables into a subqueue.  Every subqueue has its
+	own, which is reused along with it. */
+	struct CollectJob;
+
+	/* Ids for the sort keys, handed out in the order things are first seen
+	after clearing the queue.  They're kept in an open addressing hash table,
+	which keeps its memory when cleared. */
+	struct SortIds
+	{
+		std::vector<const void *> keys;
+		std::vector<unsigned> ids;
+		unsigned count;
+
+		SortIds(): count(0) { }
+
+		unsigned get(const void *, unsigned);
+		void clear();
+	private:
+		void rehash(unsigned);
+	};
+
+	/* How render_batches draws opaque items.  After a depth pre-pass, items
+	drawn in it are tested for equal depth. */
+	enum DrawMode
+	{
+		COLOR,
+		DEPTH_ONLY,
+		COLOR_AFTER_DEPTH
+	};
+
+	/* The layout glMultiDrawElementsIndirect expects in the indirect buffer. */
+	struct DrawCommand
+	{
+		unsigned count;
+		unsigned instance_count;
+		unsigned first_index;
+		int base_vertex;
+		unsigned base_instance;
+	};
+
+	Matrix projection_matrix;
+	Matrix view_matrix;
+	Matrix view_projection_matrix;
+	std::vector<DrawItem> items;
+	CullingStats culling_stats;
+	OcclusionBuffer *occlusion_buffer;
+	std::vector<Occluder> occluders;
+	std::vector<OcclusionTest> occlusion_tests;
+	JobPool *job_pool;
+	std::vector<SubQueue> subqueues;
+	std::vector<RenderQueue *> spare_subqueues;
+	std::vector<OcclusionTest> joined_tests;
+	std::vector<SubQueue> joined_subqueues;
+	CollectJob *collect_job;
+	std::deque<std::vector<const Renderable *> > renderable_lists;
+	unsigned n_acquired_lists;
+	SortIds shader_ids;
+	SortIds texture_ids;
+	SortIds material_ids;
+	SortIds object_ids;
+	std::vector<SortEntry> sort_entries;
+	std::vector<SortEntry> sort_temp;
+	std::vector<DrawItem> sorted_items;
+	bool depth_prepass;
+	std::vector<DrawItem> depth_items;
+	std::vector<Batch> batches;
+	StreamBuffer *stream_buffer;
+	unsigned frame_block_offset;
+	std::vector<char> draw_block_data;
+	unsigned draw_blocks_offset;
+	std::vector<float> instance_data;
+	unsigned instance_data_offset;
+	std::vector<DrawCommand> draw_commands;
+	unsigned draw_commands_offset;
+	std::vector<int> multi_draw_counts;
+	std::vector<const void *> multi_draw_offsets;
+	std::vector<int> multi_draw_base_vertices;
+
+	RenderQueue(const RenderQueue &);
+	RenderQueue &operator=(const RenderQueue &);
+public:
+	RenderQueue();
+	~RenderQueue();
+
+	/* Removes all items and resets the culling statistics.  The memory of the
+	queue, including its subqueues, is kept for the next frame.  Any jobs
+	collecting into the queue must have been joined. */
+	void clear();
+
+	/* Sets the projection matrix used for culling and choosing detail levels.
+	This should be set before collecting. */
+	void set_projection_matrix(const Matrix &);
+	const Matrix &get_projection_matrix() const { return projection_matrix; }
+
+	/* Sets the matrix from world space to view space.  Renderables collect
+	with world matrices, and the shaders apply the view matrix.  This should be
+	set before collecting. */
+	void set_view_matrix(const Matrix &);
+	const Matrix &get_view_matrix() const { return view_matrix; }
+
+	/* Returns the product of the projection and view matrices. */
+	const Matrix &get_view_projection_matrix() const { return view_projection_matrix; }
+
+	/* Adds an item and computes its sort key.  With a JobPool, the key is
+	computed when joining. */
+	void add(const DrawItem &);
+
+	/* Adds an item which renders a Renderable with its own render function.
+	It's given the product of the view matrix and the world matrix as its
+	modelview matrix. */
+	void add(const Renderable &, const Matrix &);
+private:
+	unsigned long long make_sort_key(const DrawItem &);
+
+public:
+	/* Tests bounds against a frustum and records the result in the culling
+	statistics.  Returns true if the bounds may be visible. */
+	bool is_visible(const Frustum &, const Bounds &);
+
+	/* Adds the results of culling done elsewhere, such as in a BoundsTree, to
+	the culling statistics. */
+	void add_culling_stats(const CullingStats &);
+
+	/* Sets a buffer to use for occlusion culling.  Null disables occlusion
+	culling, which is the default. */
+	void set_occlusion_buffer(OcclusionBuffer *);
+	OcclusionBuffer *get_occlusion_buffer() const { return occlusion_buffer; }
+
+	/* Adds an Object whose occluder mesh is drawn into the occlusion buffer,
+	with its world matrix and the depth of its center in view space. */
+	void add_occluder(const Object &, const Matrix &, float);
+
+	/* Makes the items from the given index to the end of the queue subject to
+	occlusion culling with the bounds of an Object and its world matrix. */
+	void add_occlusion_test(const Object &, const Matrix &, unsigned);
+
+	/* Sets a pool for collecting on several threads.  Null collects everything
+	on the calling thread, which is the default.  Renderables may be collected
+	concurrently, so the bounds of the scene must be up to date before
+	collecting; calling get_bounds on the root takes care of that. */
+	void set_job_pool(JobPool *);
+	JobPool *get_job_pool() const { return job_pool; }
+
+	/* Creates a queue for collecting part of the scene in a job.  It has the
+	matrices and occlusion buffer of this queue, and its contents are placed at
+	the current end of this queue when joined.  Only the job may use the
+	subqueue until then.  Subqueues are reused after joining or clearing. */
+	RenderQueue &add_subqueue();
+
+	/* Adds a job which collects a range of Renderables into a subqueue.  If a
+	frustum is given, Renderables whose bounds are outside it are skipped.  The
+	range is copied, but the Renderables must stay alive until joined. */
+	void add_collect_job(std::vector<const Renderable *>::const_iterator, std::vector<const Renderable *>::const_iterator, const WorldTransform &, const Frustum *);
+
+	/* Returns an empty list for Renderables which are needed while
+	collecting, such as the results of a BoundsTree query.  The lists are kept
+	from frame to frame, so using them doesn't allocate memory.  A list must be
+	released before the collect call which acquired it returns, in the reverse
+	order of acquiring. */
+	std::vector<const Renderable *> &acquire_renderable_list();
+	void release_renderable_list();
+
+	/* Waits for the jobs of the pool to finish, merges all subqueues into this
+	queue and computes the sort keys.  This must be called after collecting
+	with a JobPool, before anything else is done with the queue. */
+	void join();
+private:
+	void recycle_subqueues(std::vector<SubQueue> &);
+	void append_collected(const std::vector<DrawItem> &, const std::vector<OcclusionTest> &, const std::vector<SubQueue> &);
+
+public:
+	/* Draws the occluders into the occlusion buffer and removes the items whose
+	bounds are hidden behind them.  This should be called after collecting and
+	before sorting.  Does nothing without an occlusion buffer. */
+	void cull_occluded();
+
+	/* Orders the items by their sort keys.  Items with equal keys keep the order
+	in which they were added.  With the depth pre-pass enabled, also picks the
+	items drawn in the pre-pass and orders them front to back. */
+	void sort();
+private:
+	void radix_sort();
+
+public:
+	/* Enables or disables the depth pre-pass.  The color pass relies on the
+	depth values left by the pre-pass, so the depth buffer must be cleared
+	before rendering.  The items of the pre-pass are picked by sort, so this
+	must not be changed between sorting and rendering.  Disabled by default. */
+	void set_depth_prepass(bool);
+	bool get_depth_prepass() const { return depth_prepass; }
+
+	const std::vector<DrawItem> &get_items() const { return items; }
+
+	/* Returns the items drawn in the depth pre-pass, in the order they are
+	drawn. */
+	const std::vector<DrawItem> &get_depth_items() const { return depth_items; }
+
+	const CullingStats &get_culling_stats() const { return culling_stats; }
+
+	/* Draws all items in the queue.  The modelview matrix of the RenderState
+	is ignored; the shaders get the view matrix of the queue, and every item
+	has its own model matrix. */
+	void render(const RenderState &);
+private:
+	void build_batches(const std::vector<DrawItem> &, bool, bool);
+	void upload_frame_block(const RenderState &);
+	void upload_batch_data();
+	void bind_stream_buffer();
+	void render_batches(const std::vector<DrawItem> &, const RenderState &, DrawMode, bool);
+	void set_instance_attributes(unsigned);
+
+public:
+	/* Indicates whether the GL implementation supports instanced arrays. */
+	static bool instancing_supported();
+
+	/* Indicates whether the GL implementation supports indirect multi-draws
+	whose commands have a base instance. */
+	static bool multi_draw_indirect_supported();
+};
+
+} // namespace SkrolliGL
+
+#endif
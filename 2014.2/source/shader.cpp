@@ -1,18 +1,29 @@
+#include <cassert>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
 #include <GL/glew.h>
+#include "glstate.h"
 #include "object.h"
+#include "renderqueue.h"
 #include "shader.h"
 
 using namespace std;
 
 namespace SkrolliGL {
 
+unsigned Shader::last_link_generation = 0;
+UniformStats Shader::uniform_stats;
+
 Shader::Shader():
 	vertex_shader_id(glCreateShader(GL_VERTEX_SHADER)),
 	fragment_shader_id(glCreateShader(GL_FRAGMENT_SHADER)),
-	program_id(glCreateProgram())
+	program_id(glCreateProgram()),
+	link_generation(0),
+	instanced_variant(0),
+	depth_variant(0)
 {
 	// Attach shaders to the program.
 	glAttachShader(program_id, vertex_shader_id);
@@ -21,12 +32,56 @@ Shader::Shader():
 
 Shader::~Shader()
 {
+	delete instanced_variant;
+	delete depth_variant;
+	GLState::forget_program(program_id);
 	glDeleteProgram(program_id);
 	glDeleteShader(vertex_shader_id);
 	glDeleteShader(fragment_shader_id);
 }
 
 void Shader::set_source(const string &vertex_src, const string &fragment_src)
+{
+	link(vertex_src, fragment_src);
+	set_depth_source(vertex_src);
+
+	if(vertex_src.find("INSTANCED")!=string::npos)
+	{
+		if(!instanced_variant)
+			instanced_variant = new Shader;
+		string instanced_src = add_define(vertex_src, "INSTANCED");
+		instanced_variant->link(instanced_src, fragment_src);
+		instanced_variant->set_depth_source(instanced_src);
+	}
+	else
+	{
+		delete instanced_variant;
+		instanced_variant = 0;
+	}
+}
+
+void Shader::set_depth_source(const string &vertex_src)
+{
+	// Without invariance, depth may differ between variants and fail equal tests
+	if(vertex_src.find("invariant gl_Position")==string::npos)
+	{
+		delete depth_variant;
+		depth_variant = 0;
+		return;
+	}
+
+	// Use the same GLSL version in the fragment shader
+	string fragment_src;
+	if(!vertex_src.compare(0, 8, "#version"))
+		fragment_src = vertex_src.substr(0, vertex_src.find('\n'))+"\n";
+	fragment_src += "void main()\n{\n}\n";
+
+	if(!depth_variant)
+		depth_variant = new Shader;
+	depth_variant->link(add_define(vertex_src, "DEPTH_ONLY"), fragment_src);
+}
+
+void Shader::link(const string &vertex_src, const string &fragment_src)
 {
 	// Create and compile shaders.
 	set_shader_source(vertex_shader_id, vertex_src);
@@ -37,6 +92,7 @@ void Shader::set_source(const string &vertex_src, const string &fragment_src)
 	glBindAttribLocation(program_id, Object::POSITION, "in_position");
 	glBindAttribLocation(program_id, Object::NORMAL, "in_normal");
 	glBindAttribLocation(program_id, Object::TEXCOORD, "in_texcoord");
+	glBindAttribLocation(program_id, Object::MODEL, "in_model");
 	glBindFragDataLocation(program_id, 0, "out_color");
 
 	// Link the shader program.
@@ -52,6 +108,76 @@ void Shader::set_source(const string &vertex_src, const string &fragment_src)
 		cerr<<"Shader link error:"<<endl<<buf<<endl;
 		throw runtime_error("Failed to link shader");
 	}    
+
+	// Locations may have changed, and all values are reset
+	link_generation = ++last_link_generation;
+	reflect_uniforms();
+
+	/* Uniform blocks can't be given bindings in GLSL 1.50, so assign them
+	here.  Blocks the program doesn't use have no index. */
+	unsigned frame_index = glGetUniformBlockIndex(program_id, "Frame");
+	if(frame_index!=GL_INVALID_INDEX)
+		glUniformBlockBinding(program_id, frame_index, RenderQueue::FRAME_BLOCK);
+	unsigned draw_index = glGetUniformBlockIndex(program_id, "Draw");
+	if(draw_index!=GL_INVALID_INDEX)
+		glUniformBlockBinding(program_id, draw_index, RenderQueue::DRAW_BLOCK);
+}
+
+void Shader::reflect_uniforms()
+{
+	uniform_info.clear();
+	uniform_indices.clear();
+
+	int n_uniforms = 0;
+	glGetProgramiv(program_id, GL_ACTIVE_UNIFORMS, &n_uniforms);
+	int max_length = 0;
+	glGetProgramiv(program_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+	vector<char> name_buf(max_length+1);
+
+	for(int i=0; i<n_uniforms; ++i)
+	{
+		GLsizei length = 0;
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveUniform(program_id, i, name_buf.size(), &length, &size, &type, &name_buf[0]);
+		string name(&name_buf[0], length);
+
+		/* Arrays are reported by their first element.  The other elements may
+		have unrelated locations, so each gets an entry of its own. */
+		bool array = (size>1);
+		if(name.size()>3 && !name.compare(name.size()-3, 3, "[0]"))
+		{
+			name.erase(name.size()-3);
+			array = true;
+		}
+
+		for(int j=0; j<size; ++j)
+		{
+			string element_name = name;
+			if(array)
+			{
+				ostringstream ss;
+				ss<<name<<'['<<j<<']';
+				element_name = ss.str();
+			}
+
+			UniformInfo info;
+			info.type = type;
+			info.array_size = size;
+			info.n_values = 0;
+
+			// Members of uniform blocks have no location and are skipped
+			info.location = glGetUniformLocation(program_id, element_name.c_str());
+			if(info.location<0)
+				continue;
+
+			// The name of an array alone refers to its first element
+			uniform_indices[element_name] = uniform_info.size();
+			if(array && j==0)
+				uniform_indices[name] = uniform_info.size();
+			uniform_info.push_back(info);
+		}
+	}
 }
 
 void Shader::set_shader_source(int shader_id, const string &src)
@@ -73,6 +199,21 @@ void Shader::set_shader_source(int shader_id, const string &src)
 	}
 }
 
+string Shader::add_define(const string &src, const string &name)
+{
+	// The #version directive must come first, so put the define after it
+	string::size_type pos = 0;
+	if(!src.compare(0, 8, "#version"))
+	{
+		pos = src.find('\n');
+		pos = (pos==string::npos ? src.size() : pos+1);
+	}
+
+	string result = src;
+	result.insert(pos, "#define "+name+"\n");
+	return result;
+}
+
 void Shader::load(const ResourceManager &, const string &filename)
 {
 	ifstream input(filename.c_str());
@@ -116,63 +257,126 @@ void Shader::load(const ResourceManager &, const string &filename)
 
 void Shader::bind()
 {
-	glUseProgram(program_id);
+	GLState::use_program(program_id);
 }
 
-int Shader::get_uniform_location(const string &name)
+int Shader::get_uniform_location(const string &name) const
 {
-	// Check from the cache first
-	map<string, int>::iterator i = uniforms.find(name);
-	if(i!=uniforms.end())
-		return i->second;
+	UniformHandle handle = get_uniform(name);
+	if(!handle.is_valid())
+		return -1;
 
-	// Look up the location and put it in the cache
-	int loc = glGetUniformLocation(program_id, name.c_str());
-	uniforms[name] = loc;
+	return uniform_info[handle.get_index()].location;
+}
 
-	return loc;
+UniformHandle Shader::get_uniform(const string &name) const
+{
+	map<string, unsigned>::const_iterator i = uniform_indices.find(name);
+	if(i==uniform_indices.end())
+		return UniformHandle();
+
+	return UniformHandle(i->second, link_generation);
 }
 
-void Shader::set_uniform(const string &name, int i)
+void Shader::set_uniform(UniformHandle handle, int i)
 {
-	int loc = get_uniform_location(name);
+	int loc = update_value(handle, &i, 1);
 	if(loc>=0)
 		glUniform1i(loc, i);
 }
 
-void Shader::set_uniform(const string &name, float x)
+void Shader::set_uniform(UniformHandle handle, float x)
 {
-	int loc = get_uniform_location(name);
+	int loc = update_value(handle, &x, 1);
 	if(loc>=0)
 		glUniform1f(loc, x);
 }
 
-void Shader::set_uniform(const string &name, float x, float y)
+void Shader::set_uniform(UniformHandle handle, float x, float y)
 {
-	int loc = get_uniform_location(name);
+	float v[2] = { x, y };
+	int loc = update_value(handle, v, 2);
 	if(loc>=0)
-		glUniform2f(loc, x, y);
+		glUniform2fv(loc, 1, v);
 }
 
-void Shader::set_uniform(const string &name, float x, float y, float z)
+void Shader::set_uniform(UniformHandle handle, float x, float y, float z)
 {
-	int loc = get_uniform_location(name);
+	float v[3] = { x, y, z };
+	int loc = update_value(handle, v, 3);
 	if(loc>=0)
-		glUniform3f(loc, x, y, z);
+		glUniform3fv(loc, 1, v);
 }
 
-void Shader::set_uniform(const string &name, float x, float y, float z, float w)
+void Shader::set_uniform(UniformHandle handle, float x, float y, float z, float w)
 {
-	int loc = get_uniform_location(name);
+	float v[4] = { x, y, z, w };
+	int loc = update_value(handle, v, 4);
 	if(loc>=0)
-		glUniform4f(loc, x, y, z, w);
+		glUniform4fv(loc, 1, v);
 }
 
-void Shader::set_uniform_matrix4(const string &name, const float *m)
+void Shader::set_uniform_matrix4(UniformHandle handle, const float *m)
 {
-	int loc = get_uniform_location(name);
+	int loc = update_value(handle, m, 16);
 	if(loc>=0)
 		glUniformMatrix4fv(loc, 1, false, m);
 }
 
+void Shader::set_uniform(const string &name, int i)
+{
+	set_uniform(get_uniform(name), i);
+}
+
+void Shader::set_uniform(const string &name, float x)
+{
+	set_uniform(get_uniform(name), x);
+}
+
+void Shader::set_uniform(const string &name, float x, float y)
+{
+	set_uniform(get_uniform(name), x, y);
+}
+
+void Shader::set_uniform(const string &name, float x, float y, float z)
+{
+	set_uniform(get_uniform(name), x, y, z);
+}
+
+void Shader::set_uniform(const string &name, float x, float y, float z, float w)
+{
+	set_uniform(get_uniform(name), x, y, z, w);
+}
+
+void Shader::set_uniform_matrix4(const string &name, const float *m)
+{
+	set_uniform_matrix4(get_uniform(name), m);
+}
+
+int Shader::update_value(UniformHandle handle, const void *data, unsigned n_values)
+{
+	// Indices of other generations may refer to different uniforms or none
+	if(!handle.is_valid() || handle.get_generation()!=link_generation)
+		return -1;
+
+	assert(static_cast<unsigned>(handle.get_index())<uniform_info.size());
+	UniformInfo &info = uniform_info[handle.get_index()];
+	if(info.n_values==n_values && !memcmp(info.value, data, n_values*sizeof(unsigned)))
+	{
+		++uniform_stats.skipped;
+		return -1;
+	}
+
+	memcpy(info.value, data, n_values*sizeof(unsigned));
+	info.n_values = n_values;
+	++uniform_stats.uploaded;
+
+	return info.location;
+}
+
+void Shader::reset_uniform_stats()
+{
+	uniform_stats = UniformStats();
+}
+
 } // namespace SkrolliGL
@@ -3,11 +3,50 @@
 
 #include <map>
 #include <string>
+#include <vector>
 #include "mathutils.h"
 #include "resourcemanager.h"
 
 namespace SkrolliGL {
 
+/*
+Refers to a uniform variable of a Shader by its index among the uniforms found
+when the shader was linked.  Handles are looked up once with Shader::get_uniform
+and kept, so that setting values doesn't need to find the uniform by name.
+
+Each link of a shader program gets a generation number which no other link has,
+and handles remember the generation they were looked up in.  A handle used with
+another shader, or with the same one after it has been linked again, refers to
+no uniform.  Neither does the default handle.  Setting such a handle does
+nothing, like setting a uniform which doesn't exist.
+*/
+class UniformHandle
+{
+private:
+	int index;
+	unsigned generation;
+
+public:
+	UniformHandle(): index(-1), generation(0) { }
+	UniformHandle(int i, unsigned g): index(i), generation(g) { }
+
+	int get_index() const { return index; }
+	unsigned get_generation() const { return generation; }
+	bool is_valid() const { return index>=0; }
+};
+
+/*
+Counts values set through the set_uniform functions.  Uploaded values reached
+OpenGL, skipped ones were equal to the value the uniform already had.
+*/
+struct UniformStats
+{
+	unsigned uploaded;
+	unsigned skipped;
+
+	UniformStats(): uploaded(0), skipped(0) { }
+};
+
 /*
 Shaders are used to compute the position and color of drawn primitives.  They
 are written in GLSL.
@@ -15,14 +54,61 @@ are written in GLSL.
 The file format for shaders consists of vertex shader source, followed by a
 line consisting of dash characters ('-'), followed by fragment shader source.
 The canonical filename extension is .glsl.
+
+Shaders drawn through a RenderQueue get the values of the RenderState and the
+view matrix from a uniform block called Frame, and the model matrix from a
+block called Draw.  Their layouts are described in RenderQueue.  The model
+matrix takes vertices to world space, and the shader applies the view matrix
+after it.  Other uniforms are set through the Material or with the set_uniform
+functions.  Code which sets uniforms often, such as every frame, should look up
+handles for them first.  Handles stay valid until the source of the shader is
+changed; see get_link_generation.
+
+After linking, the shader finds the active uniforms of the program and keeps a
+copy of the value last set to each of them.  Setting a uniform to the value it
+already has is skipped without calling OpenGL, so values which rarely change
+can be set every frame without cost.  Uniforms must only be set through the
+Shader for the copies to stay correct.
+
+If the vertex shader source mentions INSTANCED, a second program is built with
+INSTANCED defined.  That variant must take the model matrix from an attribute
+called in_model instead of the Draw block, which lets the engine draw many
+copies of an Object with one call.
+
+If the vertex shader declares gl_Position invariant, a depth-only variant is
+built as well, for each of the above.  It has the same vertex shader with
+DEPTH_ONLY defined and a fragment shader which outputs nothing.  The engine uses
+it to lay down depth before the colour pass, which then only shades the visible
+fragments.  The invariance guarantees that both variants compute exactly the
+same depth, so the colour pass can test for equal depth.  The vertex shader may
+use DEPTH_ONLY to skip computing outputs which are only needed for colour.
 */
 class Shader: public Resource
 {
 private:
+	/* An active uniform of the program.  Each element of an array has an entry
+	of its own.  The value is kept as raw 32-bit words, since ints and floats
+	are both compared by their bits. */
+	struct UniformInfo
+	{
+		unsigned type;
+		unsigned array_size;
+		int location;
+		unsigned n_values;
+		unsigned value[16];
+	};
+
 	unsigned vertex_shader_id;
 	unsigned fragment_shader_id;
 	unsigned program_id;
-	std::map<std::string, int> uniforms;
+	unsigned link_generation;
+	std::vector<UniformInfo> uniform_info;
+	std::map<std::string, unsigned> uniform_indices;
+	Shader *instanced_variant;
+	Shader *depth_variant;
+
+	static unsigned last_link_generation;
+	static UniformStats uniform_stats;
 
 	Shader(const Shader &);
 	Shader &operator=(const Shader &);
@@ -33,21 +119,55 @@ public:
 	/* Sets the source code for the shader from strings. */
 	void set_source(const std::string &vertex_src, const std::string &fragment_src);
 private:
+	void link(const std::string &, const std::string &);
+	void reflect_uniforms();
+	void set_depth_source(const std::string &);
 	static void set_shader_source(int, const std::string &);
+	static std::string add_define(const std::string &, const std::string &);
 
 public:
 	/* Loads shader source code from a file.  Usually called by ResourceManager. */
 	virtual void load(const ResourceManager &, const std::string &);
 
+	/* Returns the instanced variant of the shader, or null if the shader doesn't
+	have one. */
+	Shader *get_instanced_variant() const { return instanced_variant; }
+
+	/* Returns the depth-only variant of the shader, or null if the shader
+	doesn't have one. */
+	Shader *get_depth_variant() const { return depth_variant; }
+
+	/* Returns the generation of the current link of the program.  It changes
+	whenever the source is set, and handles from earlier generations must be
+	looked up again. */
+	unsigned get_link_generation() const { return link_generation; }
+
 	/* Binds the shader to be used for rendering. */
 	void bind();
 
 	/* Returns the location of a uniform variable.  A location of -1 means that
 	the uniform does not exist.  Use the set_uniform functions to set the values
 	of uniform variables. */
-	int get_uniform_location(const std::string &);
+	int get_uniform_location(const std::string &) const;
+
+	/* Returns a handle for setting the value of a uniform variable.  The name
+	of an array refers to its first element.  The names are indexed when the
+	shader is linked, so this doesn't search through all uniforms. */
+	UniformHandle get_uniform(const std::string &) const;
 
-	/* Sets the value of a uniform variable. */
+	/* Sets the value of a uniform variable.  The shader must be bound.  Nothing
+	is uploaded if the value is unchanged. */
+	void set_uniform(UniformHandle, int);
+	void set_uniform(UniformHandle, float);
+	void set_uniform(UniformHandle, float, float);
+	void set_uniform(UniformHandle, float, float, float);
+	void set_uniform(UniformHandle, float, float, float, float);
+	void set_uniform_matrix4(UniformHandle, const float *);
+	void set_uniform(UniformHandle h, const Vector &v) { set_uniform(h, v.x, v.y, v.z); }
+	void set_uniform(UniformHandle h, const Matrix &m) { set_uniform_matrix4(h, m.m); }
+
+	/* Sets the value of a uniform variable by name.  This looks up the
+	uniform every time. */
 	void set_uniform(const std::string &, int);
 	void set_uniform(const std::string &, float);
 	void set_uniform(const std::string &, float, float);
@@ -56,6 +176,13 @@ public:
 	void set_uniform_matrix4(const std::string &, const float *);
 	void set_uniform(const std::string &n, const Vector &v) { set_uniform(n, v.x, v.y, v.z); }
 	void set_uniform(const std::string &n, const Matrix &m) { set_uniform_matrix4(n, m.m); }
+
+private:
+	int update_value(UniformHandle, const void *, unsigned);
+
+public:
+	static const UniformStats &get_uniform_stats() { return uniform_stats; }
+	static void reset_uniform_stats();
 };
 
 } // namespace SkrolliGL
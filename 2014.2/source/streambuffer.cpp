@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <cstring>
+#include <GL/glew.h>
+#include "streambuffer.h"
+
+using namespace std;
+
+namespace SkrolliGL {
+
+/* Size of the ring of fences.  Frames normally place one fence each, so a full
+ring means the GPU is this many frames behind. */
+const unsigned max_fences = 16;
+
+StreamBuffer::StreamBuffer(unsigned size):
+	id(0),
+	capacity(0),
+	persistent(persistent_mapping_supported()),
+	mapping(0),
+	head(0),
+	fences(max_fences),
+	first_fence(0),
+	n_fences(0)
+{
+	create(size);
+}
+
+StreamBuffer::~StreamBuffer()
+{
+	for(unsigned i=0; i<n_fences; ++i)
+		glDeleteSync(static_cast<GLsync>(fences[(first_fence+i)%max_fences].sync));
+	destroy();
+}
+
+unsigned StreamBuffer::write(const void *data, unsigned size, unsigned alignment)
+{
+	if(!size)
+		return 0;
+
+	retire_signaled();
+
+	unsigned offset = (head+alignment-1)/alignment*alignment;
+	if(offset+size>capacity)
+		offset = 0;
+
+	/* Data written since the last fence may still be needed by draws which
+	haven't been issued yet, so waiting for it would never end.  Make room
+	instead. */
+	bool fits = (size<=capacity);
+	for(vector<Region>::const_iterator i=unfenced.begin(); (fits && i!=unfenced.end()); ++i)
+		fits = !Region(offset, offset+size).overlaps(*i);
+	if(!fits)
+	{
+		grow(size+alignment);
+		offset = (head+alignment-1)/alignment*alignment;
+	}
+
+	// Wait until the GPU has finished with the region, oldest fences first
+	Region region(offset, offset+size);
+	for(bool busy=true; busy; )
+	{
+		busy = false;
+		for(unsigned i=0; (!busy && i<n_fences); ++i)
+		{
+			const vector<Region> &regions = fences[(first_fence+i)%max_fences].regions;
+			for(vector<Region>::const_iterator j=regions.begin(); (!busy && j!=regions.end()); ++j)
+				busy = region.overlaps(*j);
+		}
+		if(busy)
+			wait_oldest();
+	}
+
+	if(persistent)
+		memcpy(mapping+offset, data, size);
+	else
+	{
+		// Nothing is using the region, so there's no need to synchronize
+		glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+		void *ptr = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, size, GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_RANGE_BIT|GL_MAP_UNSYNCHRONIZED_BIT);
+		memcpy(ptr, data, size);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+	}
+
+	// Padding between consecutive writes can go in the same region
+	if(!unfenced.empty() && unfenced.back().end<=offset)
+		unfenced.back().end = region.end;
+	else
+		unfenced.push_back(region);
+	head = region.end;
+
+	return offset;
+}
+
+void StreamBuffer::fence()
+{
+	if(unfenced.empty())
+		return;
+
+	if(n_fences==max_fences)
+		wait_oldest();
+
+	// The slot's regions were cleared when it retired, and take turns with ours
+	Fence &fence = fences[(first_fence+n_fences)%max_fences];
+	++n_fences;
+	fence.sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	fence.regions.swap(unfenced);
+}
+
+void StreamBuffer::create(unsigned size)
+{
+	capacity = size;
+	glGenBuffers(1, &id);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+	if(persistent)
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT|GL_MAP_PERSISTENT_BIT|GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, capacity, 0, flags);
+		mapping = static_cast<char *>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, capacity, flags));
+	}
+	else
+		glBufferData(GL_COPY_WRITE_BUFFER, capacity, 0, GL_STREAM_DRAW);
+}
+
+void StreamBuffer::destroy()
+{
+	if(mapping)
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		mapping = 0;
+	}
+	glDeleteBuffers(1, &id);
+}
+
+void StreamBuffer::grow(unsigned size)
+{
+	unsigned old_id = id;
+	unsigned old_capacity = capacity;
+
+	// The old buffer must not be mapped while it's copied from
+	if(mapping)
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		mapping = 0;
+	}
+	create(max(old_capacity*2, old_capacity+size));
+
+	/* Only the data written since the last fence is still needed.  The rest
+	stays in the old buffer, which the GL deletes once the GPU is done with
+	it, so the fences no longer protect anything. */
+	glBindBuffer(GL_COPY_READ_BUFFER, old_id);
+	for(vector<Region>::const_iterator i=unfenced.begin(); i!=unfenced.end(); ++i)
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, i->begin, i->begin, i->end-i->begin);
+	glDeleteBuffers(1, &old_id);
+
+	while(n_fences)
+		pop_fence();
+
+	// Continue in the new space, which is larger than the write being made
+	head = old_capacity;
+}
+
+void StreamBuffer::retire_signaled()
+{
+	while(n_fences)
+	{
+		GLsync sync = static_cast<GLsync>(fences[first_fence].sync);
+		GLenum result = glClientWaitSync(sync, 0, 0);
+		if(result!=GL_ALREADY_SIGNALED && result!=GL_CONDITION_SATISFIED)
+			break;
+
+		pop_fence();
+	}
+}
+
+void StreamBuffer::wait_oldest()
+{
+	// Flushing makes sure the fence will be reached
+	GLsync sync = static_cast<GLsync>(fences[first_fence].sync);
+	while(glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000)==GL_TIMEOUT_EXPIRED) ;
+
+	pop_fence();
+}
+
+void StreamBuffer::pop_fence()
+{
+	Fence &fence = fences[first_fence];
+	glDeleteSync(static_cast<GLsync>(fence.sync));
+	fence.regions.clear();
+	first_fence = (first_fence+1)%max_fences;
+	--n_fences;
+}
+
+bool StreamBuffer::persistent_mapping_supported()
+{
+	return GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+}
+
+} // namespace SkrolliGL
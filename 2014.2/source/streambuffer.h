@@ -0,0 +1,98 @@
+#ifndef SKROLLIGL_STREAMBUFFER_H_
+#define SKROLLIGL_STREAMBUFFER_H_
+
+#include <vector>
+
+namespace SkrolliGL {
+
+/*
+A ring buffer for data which is written by the CPU every frame and read by the
+GPU once, such as uniform blocks, instance matrices and indirect draw commands.
+
+Data is written to the position after the previous write, wrapping around to
+the start when the end of the buffer is reached.  After the draws of a frame
+have been issued, fence() marks everything written so far with a GL fence.  A
+region is only written again once the GPU has passed the fence covering it, so
+the GPU never reads data which has been overwritten and the CPU never waits
+for the driver to synchronize a buffer implicitly.  Normally the ring is large
+enough to hold a few frames, and the fences have signaled long before their
+regions come around.
+
+With GL 4.4 or ARB_buffer_storage, the buffer is mapped once with a persistent
+and coherent mapping, and writing is a plain copy.  Otherwise each write maps
+its region with GL_MAP_UNSYNCHRONIZED_BIT, which is safe for the same reason.
+
+If the data of a single frame doesn't fit, the buffer grows.  Growing copies the
+data written since the last fence into a larger buffer on the GPU, so offsets
+stay valid but the buffer name changes.  The name should be queried after the
+data of a draw has been written.
+*/
+class StreamBuffer
+{
+private:
+	// A range of bytes in the buffer
+	struct Region
+	{
+		unsigned begin;
+		unsigned end;
+
+		Region(unsigned b, unsigned e): begin(b), end(e) { }
+
+		bool overlaps(const Region &r) const { return begin<r.end && r.begin<end; }
+	};
+
+	/* A fence and the regions which were written before it.  The sync object
+	is a GLsync, kept opaque so that this header doesn't need GL.  Fences are
+	kept in a fixed ring, and a retired fence leaves the memory of its regions
+	for the next one. */
+	struct Fence
+	{
+		void *sync;
+		std::vector<Region> regions;
+	};
+
+	unsigned id;
+	unsigned capacity;
+	bool persistent;
+	char *mapping;
+	unsigned head;
+	std::vector<Region> unfenced;
+	std::vector<Fence> fences;
+	unsigned first_fence;
+	unsigned n_fences;
+
+	StreamBuffer(const StreamBuffer &);
+	StreamBuffer &operator=(const StreamBuffer &);
+public:
+	/* Creates a buffer with the given initial size in bytes. */
+	StreamBuffer(unsigned);
+	~StreamBuffer();
+
+	unsigned get_id() const { return id; }
+	unsigned get_capacity() const { return capacity; }
+
+	/* Copies data into the buffer and returns its offset in bytes.  The offset
+	is a multiple of the alignment.  Waits for the GPU if the region is still
+	in use. */
+	unsigned write(const void *, unsigned, unsigned);
+
+	/* Places a fence after the draws issued so far.  Everything written before
+	it is considered in use by the GPU until the fence signals. */
+	void fence();
+
+private:
+	void create(unsigned);
+	void destroy();
+	void grow(unsigned);
+	void retire_signaled();
+	void wait_oldest();
+	void pop_fence();
+
+public:
+	/* Indicates whether the GL implementation supports persistent mappings. */
+	static bool persistent_mapping_supported();
+};
+
+} // namespace SkrolliGL
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdexcept>
 #include <SDL_image.h>
 #include <GL/glew.h>
+#include "glstate.h"
 #include "texture.h"
 
 using namespace std;
@@ -15,12 +16,13 @@ Texture::Texture()
 
 Texture::~Texture()
 {
+	GLState::forget_texture(id);
 	glDeleteTextures(1, &id);
 }
 
 void Texture::create(unsigned w, unsigned h, Format f)
 {
-	glBindTexture(GL_TEXTURE_2D, id);
+	GLState::bind_texture(id);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	int ifmt;
 	if(f==RGB)
@@ -53,7 +55,7 @@ void Texture::load(const ResourceManager &, const string &filename)
 		throw runtime_error("Don't know how to handle format of "+filename);
 	}
 
-	glBindTexture(GL_TEXTURE_2D, id);
+	GLState::bind_texture(id);
 
 	// Set minification filter to something that doesn't need mipmaps
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -73,14 +75,12 @@ void Texture::set_wrap(bool w)
 
 void Texture::bind(unsigned unit)
 {
-	glActiveTexture(GL_TEXTURE0+unit);
-	glBindTexture(GL_TEXTURE_2D, id);
+	GLState::bind_texture(unit, id);
 }
 
 void Texture::unbind(unsigned unit)
 {
-	glActiveTexture(GL_TEXTURE0+unit);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	GLState::bind_texture(unit, 0);
 }
 
 } // namespace SkrolliGL
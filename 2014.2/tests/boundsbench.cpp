@@ -0,0 +1,137 @@
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include "boundstree.h"
+#include "camera.h"
+#include "stopwatch.h"
+
+using namespace std;
+using namespace SkrolliGL;
+
+/*
+Measures BoundsTree with 10k, 100k and 1M boxes scattered over a square at a
+constant density, so the camera sees about the same number of them at every
+size.  For each size it reports the time to build the tree, to refit it after
+1% of the boxes have moved, and to query a view frustum and a sphere.  Testing
+every box against the frustum is timed as well for comparison; it grows with
+the number of boxes while the tree queries should stay nearly flat.
+*/
+
+class Box: public Renderable
+{
+private:
+	Bounds bounds;
+
+public:
+	void set_bounds(const Bounds &b) { bounds = b; }
+
+	virtual void render(const RenderState &) const { }
+	virtual Bounds get_bounds() const { return bounds; }
+};
+
+static Bounds random_box(float);
+static float random_float(float);
+static void measure(unsigned);
+
+/* Boxes per square unit, and how many times each query is repeated. */
+const float density = 0.25f;
+const unsigned query_repeats = 20;
+
+int main()
+{
+	cout<<setw(8)<<"boxes"<<setw(10)<<"build ms"<<setw(10)<<"refit ms"<<setw(9)<<"visible";
+	cout<<setw(12)<<"frustum us"<<setw(11)<<"linear us"<<setw(11)<<"sphere us"<<endl;
+	cout<<fixed<<setprecision(1);
+
+	srand(1);
+	for(unsigned n=10000; n<=1000000; n*=10)
+		measure(n);
+
+	return 0;
+}
+
+Bounds random_box(float area_size)
+{
+	Vector corner(random_float(area_size), random_float(area_size), random_float(2));
+	Vector size(0.5f+random_float(1.5f), 0.5f+random_float(1.5f), 0.5f+random_float(3));
+	return Bounds(corner, Vector(corner.x+size.x, corner.y+size.y, corner.z+size.z));
+}
+
+float random_float(float range)
+{
+	return rand()*range/RAND_MAX;
+}
+
+void measure(unsigned n_boxes)
+{
+	float area_size = sqrt(n_boxes/density);
+	vector<Box> boxes(n_boxes);
+	vector<const Renderable *> renderables(n_boxes);
+	for(unsigned i=0; i<n_boxes; ++i)
+	{
+		boxes[i].set_bounds(random_box(area_size));
+		renderables[i] = &boxes[i];
+	}
+
+	BoundsTree tree;
+	Stopwatch timer;
+	tree.build(renderables);
+	double build_time = timer.get_seconds();
+
+	for(unsigned i=0; i<n_boxes; i+=100)
+	{
+		Bounds b = boxes[i].get_bounds();
+		Vector offset(random_float(2)-1, random_float(2)-1, 0);
+		Vector minimum = b.get_minimum();
+		Vector maximum = b.get_maximum();
+		boxes[i].set_bounds(Bounds(Vector(minimum.x+offset.x, minimum.y+offset.y, minimum.z),
+			Vector(maximum.x+offset.x, maximum.y+offset.y, maximum.z)));
+	}
+	timer.restart();
+	for(unsigned i=0; i<n_boxes; i+=100)
+		tree.mark_changed(boxes[i]);
+	tree.update();
+	double refit_time = timer.get_seconds();
+
+	Camera camera;
+	camera.set_aspect_ratio(16./9.);
+	camera.set_position(Vector(area_size/2, area_size/2, 1.7));
+	camera.set_heading(30);
+	camera.set_depth_range(0.1, 100);
+	Frustum frustum(camera.get_projection_matrix()*camera.get_view_matrix());
+
+	vector<const Renderable *> found;
+	CullingStats stats;
+	timer.restart();
+	for(unsigned i=0; i<query_repeats; ++i)
+	{
+		found.clear();
+		tree.query(frustum, found, stats);
+	}
+	double frustum_time = timer.get_seconds()/query_repeats;
+	unsigned n_visible = found.size();
+
+	unsigned n_linear = 0;
+	timer.restart();
+	for(unsigned i=0; i<query_repeats; ++i)
+	{
+		n_linear = 0;
+		for(unsigned j=0; j<n_boxes; ++j)
+			n_linear += frustum.intersects(boxes[j].get_bounds());
+	}
+	double linear_time = timer.get_seconds()/query_repeats;
+
+	timer.restart();
+	for(unsigned i=0; i<query_repeats; ++i)
+	{
+		found.clear();
+		tree.query(Vector(area_size/2, area_size/2, 0), 20, found);
+	}
+	double sphere_time = timer.get_seconds()/query_repeats;
+
+	cout<<setw(8)<<n_boxes<<setw(10)<<build_time*1e3<<setw(10)<<refit_time*1e3<<setw(9)<<n_visible;
+	cout<<setw(12)<<frustum_time*1e6<<setw(11)<<linear_time*1e6<<setw(11)<<sphere_time*1e6<<endl;
+	if(n_linear>n_visible)
+		cout<<"  the tree missed "<<n_linear-n_visible<<" boxes seen by the linear test"<<endl;
+}
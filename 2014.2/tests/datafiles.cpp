@@ -0,0 +1,25 @@
+#include <algorithm>
+#include <stdexcept>
+#include <dirent.h>
+#include "datafiles.h"
+
+using namespace std;
+
+vector<string> list_data_files(const string &path, const string &suffix)
+{
+	DIR *dir = opendir(path.c_str());
+	if(!dir)
+		throw runtime_error("Couldn't open directory "+path);
+
+	vector<string> filenames;
+	while(dirent *de = readdir(dir))
+	{
+		string name = de->d_name;
+		if(name.size()>suffix.size() && !name.compare(name.size()-suffix.size(), suffix.size(), suffix))
+			filenames.push_back(path+"/"+name);
+	}
+	closedir(dir);
+
+	sort(filenames.begin(), filenames.end());
+	return filenames;
+}
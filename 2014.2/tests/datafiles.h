@@ -0,0 +1,12 @@
+#ifndef SKROLLIGL_DATAFILES_H_
+#define SKROLLIGL_DATAFILES_H_
+
+#include <string>
+#include <vector>
+
+/* Returns the paths of the files in a directory whose names end with a
+suffix, sorted by name.  Tests use this to run on every model in the data
+directory when no files are named on the command line. */
+std::vector<std::string> list_data_files(const std::string &, const std::string &);
+
+#endif
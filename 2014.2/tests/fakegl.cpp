@@ -0,0 +1,534 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+#include "fakegl.h"
+
+using namespace std;
+
+struct FakeUniform
+{
+	string name;
+	GLenum type;
+	GLint size;
+	GLint location;
+};
+
+struct FakeProgram
+{
+	vector<GLuint> shaders;
+	vector<FakeUniform> uniforms;
+};
+
+static GLuint APIENTRY create_shader(GLenum);
+static GLuint APIENTRY create_program();
+static void APIENTRY delete_shader(GLuint);
+static void APIENTRY delete_program(GLuint);
+static void APIENTRY attach_shader(GLuint, GLuint);
+static void APIENTRY shader_source(GLuint, GLsizei, const GLchar *const *, const GLint *);
+static void APIENTRY compile_shader(GLuint);
+static void APIENTRY get_shader(GLuint, GLenum, GLint *);
+static void APIENTRY get_info_log(GLuint, GLsizei, GLsizei *, GLchar *);
+static void APIENTRY bind_location(GLuint, GLuint, const GLchar *);
+static void APIENTRY link_program(GLuint);
+static void APIENTRY get_program(GLuint, GLenum, GLint *);
+static GLuint APIENTRY get_uniform_block_index(GLuint, const GLchar *);
+static void APIENTRY uniform_block_binding(GLuint, GLuint, GLuint);
+static void APIENTRY get_active_uniform(GLuint, GLuint, GLsizei, GLsizei *, GLint *, GLenum *, GLchar *);
+static GLint APIENTRY get_uniform_location(GLuint, const GLchar *);
+static void APIENTRY use_program(GLuint);
+static void APIENTRY active_texture(GLenum);
+static void APIENTRY uniform_1i(GLint, GLint);
+static void APIENTRY uniform_1f(GLint, GLfloat);
+static void APIENTRY uniform_2fv(GLint, GLsizei, const GLfloat *);
+static void APIENTRY uniform_3fv(GLint, GLsizei, const GLfloat *);
+static void APIENTRY uniform_4fv(GLint, GLsizei, const GLfloat *);
+static void APIENTRY uniform_matrix_4fv(GLint, GLsizei, GLboolean, const GLfloat *);
+static void add_uniforms(GLuint, const string &);
+static GLenum get_uniform_type(const string &);
+static void forget_locations(GLuint);
+static void record_upload(GLint, const GLfloat *, unsigned);
+static void APIENTRY gen_buffers(GLsizei, GLuint *);
+static void APIENTRY delete_buffers(GLsizei, const GLuint *);
+static void APIENTRY bind_buffer(GLenum, GLuint);
+static void APIENTRY buffer_storage(GLenum, GLsizeiptr, const void *, GLbitfield);
+static void APIENTRY buffer_data(GLenum, GLsizeiptr, const void *, GLenum);
+static void *APIENTRY map_buffer_range(GLenum, GLintptr, GLsizeiptr, GLbitfield);
+static GLboolean APIENTRY unmap_buffer(GLenum);
+static void APIENTRY copy_buffer_sub_data(GLenum, GLenum, GLintptr, GLintptr, GLsizeiptr);
+static GLsync APIENTRY fence_sync(GLenum, GLbitfield);
+static GLenum APIENTRY client_wait_sync(GLsync, GLbitfield, GLuint64);
+static void APIENTRY delete_sync(GLsync);
+static vector<char> *get_bound_buffer(GLenum);
+static void update_gpu();
+
+// Shaders, programs and buffers share one sequence of names
+static GLuint last_name = 0;
+
+static map<GLuint, string> shader_sources;
+static map<GLuint, FakeProgram> programs;
+static GLuint current_program = 0;
+
+// Locations are never reused, so stale ones can be told apart
+static GLint next_location = 0;
+static map<GLint, GLuint> location_programs;
+static map<GLint, vector<float> > uniform_values;
+static unsigned n_uploads = 0;
+static unsigned n_misdirected_uploads = 0;
+
+static map<GLuint, vector<char> > buffers;
+static map<GLenum, GLuint> bound_buffers;
+
+static unsigned gpu_lag = 0;
+static unsigned n_fences = 0;
+static unsigned n_signaled = 0;
+static unsigned n_waits = 0;
+
+void install_fake_gl()
+{
+	glCreateShader = create_shader;
+	glCreateProgram = create_program;
+	glDeleteShader = delete_shader;
+	glDeleteProgram = delete_program;
+	glAttachShader = attach_shader;
+	glShaderSource = shader_source;
+	glCompileShader = compile_shader;
+	glGetShaderiv = get_shader;
+	glGetShaderInfoLog = get_info_log;
+	glBindAttribLocation = bind_location;
+	glBindFragDataLocation = bind_location;
+	glLinkProgram = link_program;
+	glGetProgramiv = get_program;
+	glGetProgramInfoLog = get_info_log;
+	glGetUniformBlockIndex = get_uniform_block_index;
+	glUniformBlockBinding = uniform_block_binding;
+	glGetActiveUniform = get_active_uniform;
+	glGetUniformLocation = get_uniform_location;
+	glUseProgram = use_program;
+	glActiveTexture = active_texture;
+	glUniform1i = uniform_1i;
+	glUniform1f = uniform_1f;
+	glUniform2fv = uniform_2fv;
+	glUniform3fv = uniform_3fv;
+	glUniform4fv = uniform_4fv;
+	glUniformMatrix4fv = uniform_matrix_4fv;
+	glGenBuffers = gen_buffers;
+	glDeleteBuffers = delete_buffers;
+	glBindBuffer = bind_buffer;
+	glBufferStorage = buffer_storage;
+	glBufferData = buffer_data;
+	glMapBufferRange = map_buffer_range;
+	glUnmapBuffer = unmap_buffer;
+	glCopyBufferSubData = copy_buffer_sub_data;
+	glFenceSync = fence_sync;
+	glClientWaitSync = client_wait_sync;
+	glDeleteSync = delete_sync;
+}
+
+unsigned get_fake_upload_count()
+{
+	return n_uploads;
+}
+
+unsigned get_fake_misdirected_upload_count()
+{
+	return n_misdirected_uploads;
+}
+
+const float *get_fake_uniform_values(int location)
+{
+	map<GLint, vector<float> >::const_iterator i = uniform_values.find(location);
+	return (i==uniform_values.end() ? 0 : &i->second[0]);
+}
+
+void set_fake_gpu_lag(unsigned lag)
+{
+	gpu_lag = lag;
+	update_gpu();
+}
+
+void set_fake_buffer_storage(bool supported)
+{
+	__GLEW_ARB_buffer_storage = supported;
+}
+
+unsigned get_fake_fence_count()
+{
+	return n_fences;
+}
+
+bool is_fake_fence_signaled(unsigned fence)
+{
+	return fence<=n_signaled;
+}
+
+unsigned get_fake_wait_count()
+{
+	return n_waits;
+}
+
+const char *get_fake_buffer_data(unsigned id)
+{
+	map<GLuint, vector<char> >::const_iterator i = buffers.find(id);
+	if(i==buffers.end())
+		return 0;
+	return (i->second.empty() ? 0 : &i->second[0]);
+}
+
+unsigned get_fake_buffer_size(unsigned id)
+{
+	map<GLuint, vector<char> >::const_iterator i = buffers.find(id);
+	return (i==buffers.end() ? 0 : i->second.size());
+}
+
+GLuint APIENTRY create_shader(GLenum)
+{
+	++last_name;
+	shader_sources[last_name];
+	return last_name;
+}
+
+GLuint APIENTRY create_program()
+{
+	++last_name;
+	programs[last_name];
+	return last_name;
+}
+
+void APIENTRY delete_shader(GLuint id)
+{
+	shader_sources.erase(id);
+}
+
+void APIENTRY delete_program(GLuint id)
+{
+	forget_locations(id);
+	programs.erase(id);
+}
+
+void APIENTRY attach_shader(GLuint program, GLuint shader)
+{
+	programs[program].shaders.push_back(shader);
+}
+
+void APIENTRY shader_source(GLuint id, GLsizei count, const GLchar *const *strings, const GLint *lengths)
+{
+	string &source = shader_sources[id];
+	source.clear();
+	for(GLsizei i=0; i<count; ++i)
+	{
+		if(lengths && lengths[i]>=0)
+			source.append(strings[i], lengths[i]);
+		else
+			source += strings[i];
+	}
+}
+
+void APIENTRY compile_shader(GLuint)
+{ }
+
+void APIENTRY get_shader(GLuint, GLenum pname, GLint *params)
+{
+	*params = (pname==GL_COMPILE_STATUS);
+}
+
+void APIENTRY get_info_log(GLuint, GLsizei size, GLsizei *length, GLchar *log)
+{
+	if(length)
+		*length = 0;
+	if(size>0)
+		*log = 0;
+}
+
+void APIENTRY bind_location(GLuint, GLuint, const GLchar *)
+{ }
+
+void APIENTRY link_program(GLuint id)
+{
+	FakeProgram &program = programs[id];
+	forget_locations(id);
+	program.uniforms.clear();
+	for(vector<GLuint>::const_iterator i=program.shaders.begin(); i!=program.shaders.end(); ++i)
+		add_uniforms(id, shader_sources[*i]);
+}
+
+void APIENTRY get_program(GLuint id, GLenum pname, GLint *params)
+{
+	const vector<FakeUniform> &uniforms = programs[id].uniforms;
+	if(pname==GL_LINK_STATUS)
+		*params = GL_TRUE;
+	else if(pname==GL_ACTIVE_UNIFORMS)
+		*params = uniforms.size();
+	else if(pname==GL_ACTIVE_UNIFORM_MAX_LENGTH)
+	{
+		// Includes the terminating null and the [0] of arrays
+		*params = 0;
+		for(vector<FakeUniform>::const_iterator i=uniforms.begin(); i!=uniforms.end(); ++i)
+			*params = max<GLint>(*params, i->name.size()+4);
+	}
+	else
+		*params = 0;
+}
+
+GLuint APIENTRY get_uniform_block_index(GLuint, const GLchar *)
+{
+	return GL_INVALID_INDEX;
+}
+
+void APIENTRY uniform_block_binding(GLuint, GLuint, GLuint)
+{ }
+
+void APIENTRY get_active_uniform(GLuint id, GLuint index, GLsizei buf_size, GLsizei *length, GLint *size, GLenum *type, GLchar *name)
+{
+	const FakeUniform &uniform = programs[id].uniforms.at(index);
+	string full_name = uniform.name;
+	if(uniform.size>1)
+		full_name += "[0]";
+
+	GLsizei n_chars = min<GLsizei>(full_name.size(), buf_size-1);
+	copy(full_name.begin(), full_name.begin()+n_chars, name);
+	name[n_chars] = 0;
+	if(length)
+		*length = n_chars;
+	*size = uniform.size;
+	*type = uniform.type;
+}
+
+GLint APIENTRY get_uniform_location(GLuint id, const GLchar *name)
+{
+	string base = name;
+	GLint element = 0;
+	string::size_type bracket = base.find('[');
+	if(bracket!=string::npos)
+	{
+		element = atoi(base.c_str()+bracket+1);
+		base.erase(bracket);
+	}
+
+	const vector<FakeUniform> &uniforms = programs[id].uniforms;
+	for(vector<FakeUniform>::const_iterator i=uniforms.begin(); i!=uniforms.end(); ++i)
+		if(i->name==base)
+			return (element>=0 && element<i->size ? i->location+element : -1);
+
+	return -1;
+}
+
+void APIENTRY use_program(GLuint id)
+{
+	current_program = id;
+}
+
+void APIENTRY active_texture(GLenum)
+{ }
+
+void APIENTRY uniform_1i(GLint location, GLint value)
+{
+	GLfloat converted = value;
+	record_upload(location, &converted, 1);
+}
+
+void APIENTRY uniform_1f(GLint location, GLfloat value)
+{
+	record_upload(location, &value, 1);
+}
+
+void APIENTRY uniform_2fv(GLint location, GLsizei count, const GLfloat *values)
+{
+	record_upload(location, values, 2*count);
+}
+
+void APIENTRY uniform_3fv(GLint location, GLsizei count, const GLfloat *values)
+{
+	record_upload(location, values, 3*count);
+}
+
+void APIENTRY uniform_4fv(GLint location, GLsizei count, const GLfloat *values)
+{
+	record_upload(location, values, 4*count);
+}
+
+void APIENTRY uniform_matrix_4fv(GLint location, GLsizei count, GLboolean, const GLfloat *values)
+{
+	record_upload(location, values, 16*count);
+}
+
+void add_uniforms(GLuint id, const string &source)
+{
+	vector<FakeUniform> &uniforms = programs[id].uniforms;
+	istringstream lines(source);
+	string line;
+	while(getline(lines, line))
+	{
+		// Blocks have nothing after their name on the line, and are skipped
+		istringstream parse(line);
+		string keyword;
+		string type;
+		string declarator;
+		parse>>keyword>>type>>declarator;
+		if(keyword!="uniform" || declarator.empty() || declarator[declarator.size()-1]!=';')
+			continue;
+		declarator.erase(declarator.size()-1);
+
+		FakeUniform uniform;
+		uniform.type = get_uniform_type(type);
+		uniform.size = 1;
+		string::size_type bracket = declarator.find('[');
+		if(bracket!=string::npos)
+		{
+			uniform.size = atoi(declarator.c_str()+bracket+1);
+			declarator.erase(bracket);
+		}
+		uniform.name = declarator;
+
+		// Both stages may declare the same uniform
+		bool known = false;
+		for(vector<FakeUniform>::const_iterator i=uniforms.begin(); i!=uniforms.end(); ++i)
+			known |= (i->name==uniform.name);
+		if(known)
+			continue;
+
+		uniform.location = next_location;
+		next_location += uniform.size;
+		for(GLint i=0; i<uniform.size; ++i)
+			location_programs[uniform.location+i] = id;
+		uniforms.push_back(uniform);
+	}
+}
+
+GLenum get_uniform_type(const string &name)
+{
+	if(name=="int")
+		return GL_INT;
+	else if(name=="vec2")
+		return GL_FLOAT_VEC2;
+	else if(name=="vec3")
+		return GL_FLOAT_VEC3;
+	else if(name=="vec4")
+		return GL_FLOAT_VEC4;
+	else if(name=="mat4")
+		return GL_FLOAT_MAT4;
+	else if(name=="sampler2D")
+		return GL_SAMPLER_2D;
+	else
+		return GL_FLOAT;
+}
+
+void forget_locations(GLuint id)
+{
+	for(map<GLint, GLuint>::iterator i=location_programs.begin(); i!=location_programs.end(); )
+	{
+		if(i->second==id)
+			location_programs.erase(i++);
+		else
+			++i;
+	}
+}
+
+void record_upload(GLint location, const GLfloat *values, unsigned n_values)
+{
+	++n_uploads;
+	map<GLint, GLuint>::const_iterator i = location_programs.find(location);
+	if(i==location_programs.end() || i->second!=current_program)
+		++n_misdirected_uploads;
+	uniform_values[location].assign(values, values+n_values);
+}
+
+void APIENTRY gen_buffers(GLsizei n, GLuint *ids)
+{
+	for(GLsizei i=0; i<n; ++i)
+	{
+		ids[i] = ++last_name;
+		buffers[ids[i]];
+	}
+}
+
+void APIENTRY delete_buffers(GLsizei n, const GLuint *ids)
+{
+	for(GLsizei i=0; i<n; ++i)
+	{
+		buffers.erase(ids[i]);
+		for(map<GLenum, GLuint>::iterator j=bound_buffers.begin(); j!=bound_buffers.end(); ++j)
+			if(j->second==ids[i])
+				j->second = 0;
+	}
+}
+
+void APIENTRY bind_buffer(GLenum target, GLuint id)
+{
+	bound_buffers[target] = id;
+}
+
+void APIENTRY buffer_storage(GLenum target, GLsizeiptr size, const void *, GLbitfield)
+{
+	if(vector<char> *buffer = get_bound_buffer(target))
+		buffer->assign(size, 0);
+}
+
+void APIENTRY buffer_data(GLenum target, GLsizeiptr size, const void *, GLenum)
+{
+	if(vector<char> *buffer = get_bound_buffer(target))
+		buffer->assign(size, 0);
+}
+
+void *APIENTRY map_buffer_range(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield)
+{
+	// Out of range mappings fail like they would in OpenGL
+	vector<char> *buffer = get_bound_buffer(target);
+	if(!buffer || offset<0 || length<=0 || static_cast<size_t>(offset+length)>buffer->size())
+		return 0;
+	return &(*buffer)[offset];
+}
+
+GLboolean APIENTRY unmap_buffer(GLenum target)
+{
+	return get_bound_buffer(target)!=0;
+}
+
+void APIENTRY copy_buffer_sub_data(GLenum read_target, GLenum write_target, GLintptr read_offset, GLintptr write_offset, GLsizeiptr size)
+{
+	vector<char> *source = get_bound_buffer(read_target);
+	vector<char> *target = get_bound_buffer(write_target);
+	if(!source || !target || size<=0 || static_cast<size_t>(read_offset+size)>source->size()
+		|| static_cast<size_t>(write_offset+size)>target->size())
+		return;
+	copy(source->begin()+read_offset, source->begin()+read_offset+size, target->begin()+write_offset);
+}
+
+GLsync APIENTRY fence_sync(GLenum, GLbitfield)
+{
+	++n_fences;
+	update_gpu();
+	return reinterpret_cast<GLsync>(static_cast<size_t>(n_fences));
+}
+
+GLenum APIENTRY client_wait_sync(GLsync sync, GLbitfield, GLuint64 timeout)
+{
+	unsigned fence = reinterpret_cast<size_t>(sync);
+	if(fence<=n_signaled)
+		return GL_ALREADY_SIGNALED;
+	if(!timeout)
+		return GL_TIMEOUT_EXPIRED;
+
+	++n_waits;
+	n_signaled = fence;
+	return GL_CONDITION_SATISFIED;
+}
+
+void APIENTRY delete_sync(GLsync)
+{ }
+
+vector<char> *get_bound_buffer(GLenum target)
+{
+	map<GLuint, vector<char> >::iterator i = buffers.find(bound_buffers[target]);
+	return (i==buffers.end() ? 0 : &i->second);
+}
+
+void update_gpu()
+{
+	if(n_fences>gpu_lag+n_signaled)
+		n_signaled = n_fences-gpu_lag;
+}
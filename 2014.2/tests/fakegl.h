@@ -0,0 +1,51 @@
+#ifndef SKROLLIGL_FAKEGL_H_
+#define SKROLLIGL_FAKEGL_H_
+
+/*
+Stands in for OpenGL in tests which create engine objects without a context.
+GLEW calls every function added after OpenGL 1.1 through a pointer, and
+install_fake_gl points the ones the engine uses at fakes.  Functions of
+OpenGL 1.1 itself are not replaced; without a context, the GL library ignores
+them.
+
+Shaders always compile and link.  Linking finds the uniforms declared on lines
+of the form "uniform type name;" or "uniform type name[size];" in either
+stage.  Uniform blocks are not reported.  Locations are never reused, not even
+when a program is linked again, so uploads through stale locations can be
+detected.
+
+Buffers keep their contents in memory, and mappings point straight into it.
+Fences are numbered from one in the order they are created, and signal in that
+order.  The fake GPU stays a given number of fences behind the newest one,
+except that waiting on a fence with a timeout lets it catch up to that fence.
+*/
+void install_fake_gl();
+
+/* Counts the values set with the glUniform functions.  Uploads to a location
+which doesn't belong to the program in use are also counted as misdirected. */
+unsigned get_fake_upload_count();
+unsigned get_fake_misdirected_upload_count();
+
+/* Returns the values last uploaded to a uniform location, or null if nothing
+has been.  Integers are converted to floats. */
+const float *get_fake_uniform_values(int);
+
+/* Sets how many of the newest fences are left unsignaled.  Zero signals fences
+as soon as they are created. */
+void set_fake_gpu_lag(unsigned);
+
+/* Makes GLEW report ARB_buffer_storage, so that buffers can be mapped
+persistently. */
+void set_fake_buffer_storage(bool);
+
+unsigned get_fake_fence_count();
+bool is_fake_fence_signaled(unsigned);
+
+/* Returns the number of waits which had to let the GPU catch up. */
+unsigned get_fake_wait_count();
+
+/* Returns the contents of a buffer, or null if there is no such buffer. */
+const char *get_fake_buffer_data(unsigned);
+unsigned get_fake_buffer_size(unsigned);
+
+#endif
@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include "camera.h"
+#include "occlusionbuffer.h"
+
+using namespace std;
+using namespace SkrolliGL;
+
+/*
+Tests OcclusionBuffer without a GPU.  Random triangles are drawn both into the
+buffer and with a straightforward per-pixel rasterizer, and the depths must
+agree.  Random boxes are then tested for occlusion, and the buffer must find a
+box occluded exactly when every pixel it touches is nearer than the box.  This
+is checked pixel by pixel, so it also covers the shortcuts taken with the
+farthest depths of the tiles.  Finally a ground plane seen through a perspective
+camera checks clipping at the near plane.
+
+Triangles and boxes in the first two tests are given in normalized device
+coordinates with an identity matrix, so the reference doesn't need to clip.
+*/
+
+struct ReferenceBuffer
+{
+	unsigned width;
+	unsigned height;
+	vector<float> depth;
+
+	ReferenceBuffer(unsigned, unsigned);
+
+	void draw_triangle(const Vector &, const Vector &, const Vector &);
+	bool is_visible(const Vector &, const Vector &) const;
+};
+
+static bool test_rasterization(OcclusionBuffer &, ReferenceBuffer &);
+static bool test_occlusion(const OcclusionBuffer &, const ReferenceBuffer &);
+static bool test_near_plane();
+static Vector random_vector(float, float);
+static float random_float(float, float);
+
+const unsigned n_triangles = 300;
+const unsigned n_boxes = 5000;
+
+int main()
+{
+	srand(1);
+
+	// A size which isn't a multiple of the tile size, to cover the rounding
+	OcclusionBuffer buffer(250, 140);
+	ReferenceBuffer reference(buffer.get_width(), buffer.get_height());
+
+	bool ok = test_rasterization(buffer, reference);
+	ok &= test_occlusion(buffer, reference);
+	ok &= test_near_plane();
+
+	return ok ? 0 : 1;
+}
+
+ReferenceBuffer::ReferenceBuffer(unsigned w, unsigned h):
+	width(w),
+	height(h),
+	depth(w*h, 1.0f)
+{ }
+
+void ReferenceBuffer::draw_triangle(const Vector &v1, const Vector &v2, const Vector &v3)
+{
+	Vector screen[3] = { v1, v2, v3 };
+	for(unsigned i=0; i<3; ++i)
+	{
+		screen[i].x = (screen[i].x*0.5f+0.5f)*width;
+		screen[i].y = (screen[i].y*0.5f+0.5f)*height;
+	}
+
+	const Vector &a = screen[0];
+	const Vector &b = screen[1];
+	const Vector &c = screen[2];
+	double area = (b.x-a.x)*(c.y-a.y)-(b.y-a.y)*(c.x-a.x);
+	if(!area)
+		return;
+
+	// Dividing by the signed area makes both windings come out positive
+	for(unsigned y=0; y<height; ++y)
+		for(unsigned x=0; x<width; ++x)
+		{
+			double px = x+0.5;
+			double py = y+0.5;
+			double wa = ((b.x-px)*(c.y-py)-(b.y-py)*(c.x-px))/area;
+			double wb = ((c.x-px)*(a.y-py)-(c.y-py)*(a.x-px))/area;
+			double wc = 1-wa-wb;
+			if(wa<0 || wb<0 || wc<0)
+				continue;
+
+			float z = wa*a.z+wb*b.z+wc*c.z;
+			float &pixel = depth[y*width+x];
+			pixel = min(pixel, z);
+		}
+}
+
+bool ReferenceBuffer::is_visible(const Vector &low, const Vector &high) const
+{
+	unsigned x_begin = static_cast<unsigned>(max((low.x*0.5f+0.5f)*width, 0.0f));
+	unsigned x_end = static_cast<unsigned>(min((high.x*0.5f+0.5f)*width, width-1.0f))+1;
+	unsigned y_begin = static_cast<unsigned>(max((low.y*0.5f+0.5f)*height, 0.0f));
+	unsigned y_end = static_cast<unsigned>(min((high.y*0.5f+0.5f)*height, height-1.0f))+1;
+	for(unsigned y=y_begin; y<y_end; ++y)
+		for(unsigned x=x_begin; x<x_end; ++x)
+			if(depth[y*width+x]>=low.z)
+				return true;
+	return false;
+}
+
+bool test_rasterization(OcclusionBuffer &buffer, ReferenceBuffer &reference)
+{
+	/* Triangles reach past the edges of the view to exercise the side planes.
+	They are drawn one call at a time, so the farthest depths of the tiles get
+	updated between draws as well. */
+	vector<Vector> vertices(3);
+	vector<unsigned> indices;
+	indices.push_back(0);
+	indices.push_back(1);
+	indices.push_back(2);
+	for(unsigned i=0; i<n_triangles; ++i)
+	{
+		Vector center = random_vector(1.2f, 0.9f);
+		float size = random_float(0.05f, 0.6f);
+		for(unsigned j=0; j<3; ++j)
+		{
+			Vector offset = random_vector(size, 0.1f);
+			vertices[j] = Vector(center.x+offset.x, center.y+offset.y, center.z+offset.z);
+		}
+		buffer.draw(Matrix(), vertices, indices);
+		reference.draw_triangle(vertices[0], vertices[1], vertices[2]);
+	}
+
+	/* Pixel centers which fall exactly on an edge may go either way, so a few
+	differences are tolerated. */
+	unsigned n_different = 0;
+	for(unsigned y=0; y<reference.height; ++y)
+		for(unsigned x=0; x<reference.width; ++x)
+			if(fabs(buffer.get_depth(x, y)-reference.depth[y*reference.width+x])>1e-4f)
+				++n_different;
+
+	unsigned n_pixels = reference.width*reference.height;
+	bool ok = (n_different*1000<=n_pixels);
+	cout<<"rasterization: "<<n_different<<" of "<<n_pixels<<" pixels differ"<<(ok ? "" : ", too many")<<endl;
+
+	// Make those pixels agree too, so that they don't affect the occlusion test
+	for(unsigned y=0; y<reference.height; ++y)
+		for(unsigned x=0; x<reference.width; ++x)
+			reference.depth[y*reference.width+x] = buffer.get_depth(x, y);
+
+	return ok;
+}
+
+bool test_occlusion(const OcclusionBuffer &buffer, const ReferenceBuffer &reference)
+{
+	unsigned n_occluded = 0;
+	unsigned n_hidden = 0;
+	unsigned n_wrong = 0;
+	for(unsigned i=0; i<n_boxes; ++i)
+	{
+		Vector corner = random_vector(1.1f, 1.0f);
+		Vector size = random_vector(0.2f, 0.2f);
+		Vector low(corner.x, corner.y, corner.z);
+		Vector high(corner.x+fabs(size.x), corner.y+fabs(size.y), corner.z+fabs(size.z));
+		// Boxes outside the view are left to frustum culling and never occluded
+		if(low.z<-0.9f || high.x<-1 || low.x>1 || high.y<-1 || low.y>1)
+			continue;
+
+		bool hidden = !reference.is_visible(low, high);
+		bool occluded = buffer.is_occluded(Matrix(), Bounds(low, high));
+		n_hidden += hidden;
+		n_occluded += occluded;
+		if(occluded && !hidden)
+			++n_wrong;
+	}
+
+	bool ok = (!n_wrong && n_occluded==n_hidden);
+	cout<<"occlusion: "<<n_occluded<<" occluded of "<<n_hidden<<" hidden, "<<n_wrong<<" visible boxes occluded"<<endl;
+	return ok;
+}
+
+bool test_near_plane()
+{
+	Camera camera;
+	camera.set_aspect_ratio(16./9.);
+	camera.set_position(Vector(0, 0, 1.7));
+	// Looking towards X+
+	camera.set_heading(0);
+	camera.set_depth_range(0.1, 100);
+	Matrix view_projection = camera.get_projection_matrix()*camera.get_view_matrix();
+
+	// The ground extends behind the camera, so it has to be clipped
+	vector<Vector> vertices;
+	vertices.push_back(Vector(-50, -50, 0));
+	vertices.push_back(Vector(50, -50, 0));
+	vertices.push_back(Vector(50, 50, 0));
+	vertices.push_back(Vector(-50, 50, 0));
+	unsigned quad[6] = { 0, 1, 2, 0, 2, 3 };
+	vector<unsigned> indices(quad, quad+6);
+
+	OcclusionBuffer buffer(128, 72);
+	buffer.draw(view_projection, vertices, indices);
+
+	struct Case
+	{
+		const char *description;
+		Bounds bounds;
+		bool occluded;
+	};
+
+	Case cases[] =
+	{
+		{ "below the ground", Bounds(Vector(9, -1, -3), Vector(11, 1, -1)), true },
+		{ "above the ground", Bounds(Vector(9, -1, 0.5), Vector(11, 1, 2)), false },
+		{ "around the camera", Bounds(Vector(-1, -1, -3), Vector(1, 1, 3)), false },
+		{ "empty", Bounds(), false },
+		{ "infinite", Bounds::infinity(), false }
+	};
+
+	bool ok = (buffer.get_triangle_count()>0);
+	for(unsigned i=0; i<sizeof(cases)/sizeof(Case); ++i)
+		if(buffer.is_occluded(view_projection, cases[i].bounds)!=cases[i].occluded)
+		{
+			cout<<"near plane: box "<<cases[i].description<<(cases[i].occluded ? " not" : "")<<" occluded"<<endl;
+			ok = false;
+		}
+
+	if(ok)
+		cout<<"near plane: ok"<<endl;
+	return ok;
+}
+
+Vector random_vector(float xy_range, float z_range)
+{
+	return Vector(random_float(-xy_range, xy_range), random_float(-xy_range, xy_range), random_float(-z_range, z_range));
+}
+
+float random_float(float low, float high)
+{
+	return low+rand()*(high-low)/RAND_MAX;
+}
@@ -0,0 +1,125 @@
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include "datafiles.h"
+#include "mappedfile.h"
+#include "objparser.h"
+#include "stopwatch.h"
+
+using namespace std;
+using namespace SkrolliGL;
+
+/*
+Measures the throughput of ObjParser on a single thread.  Files named on the
+command line are parsed from a mapping, like Object::load_obj does.  Without
+arguments, every .obj file in the data directory is used.  Those files are at
+most a few hundred kilobytes, so a generated grid of a few tens of megabytes is
+always measured as well to show the speed on large inputs.
+
+The grid is then parsed with increasing numbers of threads.  The parser gives
+each thread at least a megabyte, so the small files would not be split at all
+and aren't part of this.
+*/
+
+static string generate_grid(unsigned);
+static void report(const string &, const char *, const char *);
+static double measure(ObjParser &, const char *, const char *);
+
+/* Each input is parsed repeatedly until both limits are reached, and the
+fastest run is reported. */
+const unsigned min_runs = 3;
+const double min_total_time = 0.5;
+
+int main(int argc, char **argv)
+{
+	cout<<left<<setw(24)<<"input"<<right<<setw(10)<<"KiB"<<setw(10)<<"MB/s"<<setw(12)<<"Mverts/s"<<endl;
+	cout<<fixed<<setprecision(1);
+
+	try
+	{
+		vector<string> filenames(argv+1, argv+argc);
+		if(filenames.empty())
+			filenames = list_data_files("data", ".obj");
+
+		for(vector<string>::const_iterator i=filenames.begin(); i!=filenames.end(); ++i)
+		{
+			MappedFile file(*i);
+			report(*i, file.begin(), file.end());
+		}
+	}
+	catch(const exception &e)
+	{
+		cerr<<e.what()<<endl;
+		return 1;
+	}
+
+	string grid = generate_grid(512);
+	const char *grid_end = grid.data()+grid.size();
+	report("grid 512x512", grid.data(), grid_end);
+
+	cout<<endl<<setw(8)<<"threads"<<setw(10)<<"MB/s"<<setw(10)<<"speedup"<<endl;
+	double single_time = 0;
+	for(unsigned threads=1; threads<=8; threads*=2)
+	{
+		ObjParser parser(threads);
+		double time = measure(parser, grid.data(), grid_end);
+		if(threads==1)
+			single_time = time;
+		cout<<setw(8)<<threads<<setw(10)<<grid.size()/time/1e6<<setw(10)<<single_time/time<<endl;
+	}
+
+	return 0;
+}
+
+string generate_grid(unsigned size)
+{
+	ostringstream out;
+	for(unsigned y=0; y<=size; ++y)
+		for(unsigned x=0; x<=size; ++x)
+			out<<"v "<<x*0.25f<<' '<<y*0.25f<<" 0\n";
+	for(unsigned y=0; y<=size; ++y)
+		for(unsigned x=0; x<=size; ++x)
+			out<<"vt "<<static_cast<float>(x)/size<<' '<<static_cast<float>(y)/size<<'\n';
+	out<<"vn 0 0 1\n";
+	out<<"usemtl grid\n";
+	for(unsigned y=0; y<size; ++y)
+		for(unsigned x=0; x<size; ++x)
+		{
+			// OBJ indices start from one
+			unsigned i = y*(size+1)+x+1;
+			unsigned corners[4] = { i, i+1, i+size+2, i+size+1 };
+			out<<'f';
+			for(unsigned j=0; j<4; ++j)
+				out<<' '<<corners[j]<<'/'<<corners[j]<<"/1";
+			out<<'\n';
+		}
+	return out.str();
+}
+
+void report(const string &name, const char *begin, const char *end)
+{
+	ObjParser parser(1);
+	double best = measure(parser, begin, end);
+
+	unsigned long size = end-begin;
+	cout<<left<<setw(24)<<name<<right<<setw(10)<<size/1024.0;
+	cout<<setw(10)<<size/best/1e6<<setw(12)<<parser.get_vertices().size()/best/1e6<<endl;
+}
+
+double measure(ObjParser &parser, const char *begin, const char *end)
+{
+	double best = 0;
+	double total = 0;
+	for(unsigned i=0; (i<min_runs || total<min_total_time); ++i)
+	{
+		Stopwatch timer;
+		parser.parse(begin, end);
+		double elapsed = timer.get_seconds();
+		if(!i || elapsed<best)
+			best = elapsed;
+		total += elapsed;
+	}
+
+	return best;
+}
@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include "fakegl.h"
+#include "material.h"
+#include "object.h"
+#include "renderqueue.h"
+#include "shader.h"
+
+using namespace std;
+using namespace SkrolliGL;
+
+/*
+Checks the order in which RenderQueue draws items, without a GPU.  Items are
+added with random depths over several objects and materials, some of which
+have a shader with a depth-only variant, and custom items are mixed in.  After
+sorting, the custom items must come last in the order they were added, and the
+items of each object and material front to back.  With the depth pre-pass
+enabled, the pre-pass must get exactly the items whose shader has a depth
+variant, front to back regardless of object or material.  Without it the
+pre-pass must be empty.
+*/
+
+typedef RenderQueue::DrawItem DrawItem;
+
+static void add_items(RenderQueue &, const vector<const Object *> &, const vector<const Material *> &, const Object &);
+static bool check_items(const vector<DrawItem> &);
+static bool check_depth_items(const vector<DrawItem> &, const vector<DrawItem> &);
+static float clamped_depth(const DrawItem &);
+
+const unsigned n_items = 2000;
+const unsigned n_custom_items = 50;
+
+/* The sort key keeps only the top bits of the depth, so items whose depths are
+this close may go in either order. */
+const float key_precision = 1-1.0f/128;
+
+int main()
+{
+	install_fake_gl();
+	srand(1);
+
+	Shader plain_shader;
+	plain_shader.set_source("#version 150\nvoid main()\n{\n}\n", "#version 150\nvoid main()\n{\n}\n");
+	Shader invariant_shader;
+	invariant_shader.set_source("#version 150\ninvariant gl_Position;\nvoid main()\n{\n}\n", "#version 150\nvoid main()\n{\n}\n");
+	if(plain_shader.get_depth_variant() || !invariant_shader.get_depth_variant())
+	{
+		cout<<"depth variants were not created as expected"<<endl;
+		return 1;
+	}
+
+	vector<Material> materials(4);
+	materials[0].set_shader(&plain_shader);
+	materials[1].set_shader(&invariant_shader);
+	materials[2].set_shader(&invariant_shader);
+	vector<const Material *> material_ptrs;
+	for(unsigned i=0; i<materials.size(); ++i)
+		material_ptrs.push_back(&materials[i]);
+	// Items without a material are drawn too
+	material_ptrs.push_back(0);
+
+	vector<Object> objects(5);
+	vector<const Object *> object_ptrs;
+	for(unsigned i=0; i<objects.size(); ++i)
+		object_ptrs.push_back(&objects[i]);
+
+	RenderQueue queue;
+	bool ok = true;
+	for(unsigned pass=0; pass<2; ++pass)
+	{
+		bool prepass = (pass==1);
+		queue.clear();
+		queue.set_depth_prepass(prepass);
+		add_items(queue, object_ptrs, material_ptrs, objects[0]);
+		queue.sort();
+
+		cout<<"pre-pass "<<(prepass ? "enabled" : "disabled")<<": "<<queue.get_items().size()<<" items, ";
+		cout<<queue.get_depth_items().size()<<" in the pre-pass"<<endl;
+
+		ok &= check_items(queue.get_items());
+		if(prepass)
+			ok &= check_depth_items(queue.get_items(), queue.get_depth_items());
+		else if(!queue.get_depth_items().empty())
+		{
+			cout<<"  pre-pass has items while disabled"<<endl;
+			ok = false;
+		}
+	}
+
+	queue.clear();
+	if(!queue.get_depth_items().empty())
+	{
+		cout<<"pre-pass items survived clear"<<endl;
+		ok = false;
+	}
+
+	return ok ? 0 : 1;
+}
+
+void add_items(RenderQueue &queue, const vector<const Object *> &objects, const vector<const Material *> &materials, const Object &custom)
+{
+	/* The index of each item goes in its matrix, so the order of addition can
+	be recovered after sorting.  A few items are behind the eye. */
+	for(unsigned i=0; i<n_items+n_custom_items; ++i)
+	{
+		Matrix matrix;
+		matrix.m[12] = i;
+		if(rand()%(n_items+n_custom_items)<n_custom_items)
+		{
+			queue.add(custom, matrix);
+			continue;
+		}
+
+		DrawItem item;
+		item.model_matrix = matrix;
+		item.depth = rand()*110.0f/RAND_MAX-10.0f;
+		item.object = objects[rand()%objects.size()];
+		item.material = materials[rand()%materials.size()];
+		queue.add(item);
+	}
+}
+
+bool check_items(const vector<DrawItem> &items)
+{
+	bool custom = false;
+	for(unsigned i=0; i<items.size(); ++i)
+	{
+		const DrawItem &item = items[i];
+		if(!item.object)
+		{
+			if(custom && item.model_matrix.m[12]<items[i-1].model_matrix.m[12])
+			{
+				cout<<"  custom items are not in the order they were added"<<endl;
+				return false;
+			}
+			custom = true;
+		}
+		else if(custom)
+		{
+			cout<<"  opaque item after custom items"<<endl;
+			return false;
+		}
+		else if(i>0 && item.object==items[i-1].object && item.material==items[i-1].material
+			&& clamped_depth(item)<clamped_depth(items[i-1])*key_precision)
+		{
+			cout<<"  items of an object are not front to back"<<endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool check_depth_items(const vector<DrawItem> &items, const vector<DrawItem> &depth_items)
+{
+	// The items are told apart by their index in the matrix
+	vector<float> expected;
+	for(unsigned i=0; i<items.size(); ++i)
+	{
+		const Material *material = items[i].material;
+		const Shader *shader = (material ? material->get_shader() : 0);
+		if(items[i].object && shader && shader->get_depth_variant())
+			expected.push_back(items[i].model_matrix.m[12]);
+	}
+
+	vector<float> found;
+	bool ordered = true;
+	for(unsigned i=0; i<depth_items.size(); ++i)
+	{
+		found.push_back(depth_items[i].model_matrix.m[12]);
+		if(i>0 && clamped_depth(depth_items[i])<clamped_depth(depth_items[i-1]))
+			ordered = false;
+	}
+
+	sort(expected.begin(), expected.end());
+	sort(found.begin(), found.end());
+	bool ok = true;
+	if(found!=expected)
+	{
+		cout<<"  pre-pass has "<<found.size()<<" items, expected "<<expected.size()<<" with a depth variant"<<endl;
+		ok = false;
+	}
+	if(!ordered)
+	{
+		cout<<"  pre-pass is not front to back"<<endl;
+		ok = false;
+	}
+
+	return ok;
+}
+
+float clamped_depth(const DrawItem &item)
+{
+	// Everything behind the eye sorts as zero
+	return max(item.depth, 0.0f);
+}
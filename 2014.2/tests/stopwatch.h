@@ -0,0 +1,24 @@
+#ifndef SKROLLIGL_STOPWATCH_H_
+#define SKROLLIGL_STOPWATCH_H_
+
+#include <SDL.h>
+
+/*
+Measures elapsed wall clock time with the high resolution counter.
+*/
+class Stopwatch
+{
+private:
+	Uint64 start;
+
+public:
+	Stopwatch(): start(SDL_GetPerformanceCounter()) { }
+
+	void restart() { start = SDL_GetPerformanceCounter(); }
+
+	/* Returns the time since construction or the last restart in seconds. */
+	double get_seconds() const
+	{ return static_cast<double>(SDL_GetPerformanceCounter()-start)/SDL_GetPerformanceFrequency(); }
+};
+
+#endif
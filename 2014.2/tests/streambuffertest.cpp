@@ -0,0 +1,171 @@
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include "fakegl.h"
+#include "streambuffer.h"
+
+using namespace std;
+using namespace SkrolliGL;
+
+/*
+Stress tests StreamBuffer against fake fences.  Each frame makes a few writes
+of random sizes and alignments and then places a fence, while the fake GPU
+stays some fences behind.  Every write must be aligned and inside the buffer,
+and must not overlap a write of the same frame or of an earlier frame whose
+fence hasn't signaled.  The data of a frame must stay intact until its fence
+signals, which is what the GPU would read.
+
+The initial sizes are small compared to the writes, so the buffer also grows
+and wraps around often.  Both the persistent mapping and the mapping of each
+write are tested.
+*/
+
+struct Write
+{
+	unsigned buffer;
+	unsigned offset;
+	unsigned size;
+	unsigned fence;
+	vector<char> data;
+
+	bool overlaps(unsigned, unsigned) const;
+	bool is_intact() const;
+};
+
+static unsigned run(bool, unsigned);
+static void report_error(unsigned &, const char *);
+
+const unsigned n_seeds = 8;
+const unsigned n_frames = 3000;
+const unsigned max_writes_per_frame = 5;
+
+int main()
+{
+	install_fake_gl();
+
+	cout<<setw(12)<<"mapping"<<setw(6)<<"seed"<<setw(5)<<"lag"<<setw(16)<<"capacity";
+	cout<<setw(8)<<"writes"<<setw(7)<<"grows"<<setw(7)<<"waits"<<setw(8)<<"errors"<<endl;
+
+	bool ok = true;
+	for(unsigned i=0; i<2; ++i)
+	{
+		bool persistent = (i==1);
+		set_fake_buffer_storage(persistent);
+		if(StreamBuffer::persistent_mapping_supported()!=persistent)
+		{
+			cout<<"persistent mapping support not detected as set"<<endl;
+			return 1;
+		}
+
+		for(unsigned seed=1; seed<=n_seeds; ++seed)
+			ok &= !run(persistent, seed);
+	}
+
+	return ok ? 0 : 1;
+}
+
+bool Write::overlaps(unsigned o, unsigned s) const
+{
+	return offset<o+s && o<offset+size;
+}
+
+bool Write::is_intact() const
+{
+	const char *contents = get_fake_buffer_data(buffer);
+	return contents && offset+size<=get_fake_buffer_size(buffer) && !memcmp(contents+offset, &data[0], size);
+}
+
+unsigned run(bool persistent, unsigned seed)
+{
+	srand(seed);
+	unsigned lag = rand()%5;
+	set_fake_gpu_lag(lag);
+	unsigned initial_capacity = 256+rand()%4096;
+	unsigned max_size = 64+rand()%2000;
+	unsigned first_wait_count = get_fake_wait_count();
+
+	StreamBuffer buffer(initial_capacity);
+	vector<Write> in_flight;
+	unsigned n_writes = 0;
+	unsigned n_grows = 0;
+	unsigned n_errors = 0;
+	for(unsigned i=0; i<n_frames; ++i)
+	{
+		vector<Write> frame;
+		unsigned n_frame_writes = rand()%(max_writes_per_frame+1);
+		for(unsigned j=0; j<n_frame_writes; ++j)
+		{
+			Write write;
+			write.size = 1+rand()%max_size;
+			write.data.resize(write.size);
+			for(unsigned k=0; k<write.size; ++k)
+				write.data[k] = rand();
+			unsigned alignment = 1<<(rand()%9);
+
+			unsigned old_id = buffer.get_id();
+			write.offset = buffer.write(&write.data[0], write.size, alignment);
+			write.buffer = buffer.get_id();
+			write.fence = 0;
+			++n_writes;
+			n_grows += (write.buffer!=old_id);
+
+			if(write.offset%alignment || write.offset+write.size>buffer.get_capacity())
+				report_error(n_errors, "write is misaligned or out of range");
+
+			// Growing keeps the offsets of the frame, so its writes are checked in any buffer
+			for(vector<Write>::const_iterator k=frame.begin(); k!=frame.end(); ++k)
+				if(k->overlaps(write.offset, write.size))
+					report_error(n_errors, "write overlaps an earlier write of the same frame");
+
+			// The old buffer is kept by the GL until the GPU is done with it
+			for(vector<Write>::const_iterator k=in_flight.begin(); k!=in_flight.end(); ++k)
+				if(k->buffer==write.buffer && !is_fake_fence_signaled(k->fence) && k->overlaps(write.offset, write.size))
+					report_error(n_errors, "write overlaps a region still in flight");
+
+			frame.push_back(write);
+		}
+
+		// The draws of the frame read from the current buffer
+		for(vector<Write>::iterator j=frame.begin(); j!=frame.end(); ++j)
+		{
+			j->buffer = buffer.get_id();
+			if(!j->is_intact())
+				report_error(n_errors, "data of the frame changed before its draws");
+		}
+
+		// A frame with no writes places no fence
+		unsigned last_fence = get_fake_fence_count();
+		buffer.fence();
+		if(get_fake_fence_count()!=last_fence)
+			for(vector<Write>::iterator j=frame.begin(); j!=frame.end(); ++j)
+			{
+				j->fence = get_fake_fence_count();
+				in_flight.push_back(*j);
+			}
+
+		vector<Write> still_in_flight;
+		for(vector<Write>::const_iterator j=in_flight.begin(); j!=in_flight.end(); ++j)
+		{
+			if(is_fake_fence_signaled(j->fence))
+				continue;
+			if(j->buffer==buffer.get_id() && !j->is_intact())
+				report_error(n_errors, "data changed before its fence signaled");
+			still_in_flight.push_back(*j);
+		}
+		in_flight.swap(still_in_flight);
+	}
+
+	cout<<setw(12)<<(persistent ? "persistent" : "per write")<<setw(6)<<seed<<setw(5)<<lag<<setw(7)<<initial_capacity<<" -> "<<setw(5)<<buffer.get_capacity();
+	cout<<setw(8)<<n_writes<<setw(7)<<n_grows<<setw(7)<<get_fake_wait_count()-first_wait_count<<setw(8)<<n_errors<<endl;
+
+	return n_errors;
+}
+
+void report_error(unsigned &n_errors, const char *message)
+{
+	// Errors tend to repeat, so only the first one of a run is shown
+	if(!n_errors)
+		cout<<"  "<<message<<endl;
+	++n_errors;
+}
@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include "datafiles.h"
+#include "mappedfile.h"
+#include "objparser.h"
+#include "primitivebuilder.h"
+#include "stopwatch.h"
+
+using namespace std;
+using namespace SkrolliGL;
+
+/*
+Checks build_triangle_strips against the quadratic search it replaced, copied
+here as it was.  That search knew nothing of submeshes, so it's run on the
+faces of each submesh separately.  Each submesh must get the same triangles,
+with the same winding, from both searches and from build_triangle_list.  Both
+searches continue a strip with the lowest unused face that fits, so the index
+arrays must also be identical.
+
+The inputs are the OBJ files named on the command line, or every one in the
+data directory, and a generated mesh with mixed triangles and quads spread over
+several submeshes in random order.
+*/
+
+typedef ObjParser::Face Face;
+
+struct Triangle
+{
+	unsigned v[3];
+
+	Triangle(unsigned, unsigned, unsigned);
+
+	bool operator<(const Triangle &) const;
+	bool operator==(const Triangle &) const;
+};
+
+static vector<Face> generate_faces(unsigned, unsigned, unsigned &);
+static bool check(const string &, vector<Face>, unsigned, unsigned);
+static void build_reference_strips(const vector<Face> &, vector<unsigned> &, vector<Object::SubMesh> &);
+static void build_original_strips(const vector<Face> &, vector<unsigned> &);
+static void strip_triangles(const vector<unsigned> &, const Object::SubMesh &, vector<Triangle> &);
+static void list_triangles(const vector<unsigned> &, const Object::SubMesh &, vector<Triangle> &);
+
+int main(int argc, char **argv)
+{
+	cout<<left<<setw(24)<<"input"<<right<<setw(8)<<"faces"<<setw(8)<<"strips"<<setw(12)<<"linear ms"<<setw(14)<<"quadratic ms"<<endl;
+	cout<<fixed<<setprecision(2);
+
+	bool ok = true;
+	try
+	{
+		vector<string> filenames(argv+1, argv+argc);
+		if(filenames.empty())
+			filenames = list_data_files("data", ".obj");
+
+		for(vector<string>::const_iterator i=filenames.begin(); i!=filenames.end(); ++i)
+		{
+			MappedFile file(*i);
+			ObjParser parser;
+			parser.parse(file.begin(), file.end());
+			ok &= check(*i, parser.get_faces(), parser.get_vertices().size(), parser.get_material_names().size());
+		}
+	}
+	catch(const exception &e)
+	{
+		cerr<<e.what()<<endl;
+		return 1;
+	}
+
+	srand(1);
+	unsigned n_vertices;
+	vector<Face> faces = generate_faces(64, 3, n_vertices);
+	ok &= check("generated 64x64", faces, n_vertices, 3);
+
+	return ok ? 0 : 1;
+}
+
+Triangle::Triangle(unsigned a, unsigned b, unsigned c)
+{
+	// Rotate the smallest index first, which keeps the winding
+	unsigned first = (a<b ? (a<c ? 0 : 2) : (b<c ? 1 : 2));
+	unsigned in[3] = { a, b, c };
+	for(unsigned i=0; i<3; ++i)
+		v[i] = in[(first+i)%3];
+}
+
+bool Triangle::operator<(const Triangle &other) const
+{
+	return lexicographical_compare(v, v+3, other.v, other.v+3);
+}
+
+bool Triangle::operator==(const Triangle &other) const
+{
+	return equal(v, v+3, other.v);
+}
+
+vector<Face> generate_faces(unsigned size, unsigned n_submeshes, unsigned &n_vertices)
+{
+	vector<Face> faces;
+	for(unsigned y=0; y<size; ++y)
+		for(unsigned x=0; x<size; ++x)
+		{
+			unsigned i = y*(size+1)+x;
+			unsigned corners[4] = { i, i+1, i+size+2, i+size+1 };
+			Face face;
+			face.submesh = rand()%n_submeshes;
+			if(rand()%2)
+			{
+				face.nverts = 4;
+				copy(corners, corners+4, face.indices);
+				faces.push_back(face);
+			}
+			else
+			{
+				// Alternate the diagonal so that some triangles only fit at odd positions
+				unsigned split = rand()%2;
+				face.nverts = 3;
+				for(unsigned j=0; j<3; ++j)
+					face.indices[j] = corners[(split+j)%4];
+				faces.push_back(face);
+				for(unsigned j=0; j<3; ++j)
+					face.indices[j] = corners[(split+2+j)%4];
+				faces.push_back(face);
+			}
+		}
+
+	random_shuffle(faces.begin(), faces.end());
+	n_vertices = (size+1)*(size+1);
+	return faces;
+}
+
+bool check(const string &name, vector<Face> faces, unsigned n_vertices, unsigned n_submeshes)
+{
+	sort_faces(faces, n_submeshes);
+
+	Stopwatch timer;
+	vector<unsigned> strips;
+	vector<Object::SubMesh> strip_ranges(n_submeshes);
+	build_triangle_strips(faces, n_vertices, strips, strip_ranges);
+	double linear_time = timer.get_seconds();
+
+	timer.restart();
+	vector<unsigned> reference;
+	vector<Object::SubMesh> reference_ranges(n_submeshes);
+	build_reference_strips(faces, reference, reference_ranges);
+	double quadratic_time = timer.get_seconds();
+
+	vector<unsigned> list;
+	vector<Object::SubMesh> list_ranges(n_submeshes);
+	build_triangle_list(strips, strip_ranges, list, list_ranges);
+
+	unsigned n_strips = count(strips.begin(), strips.end(), 0xFFFFFFFF)+!strips.empty();
+	cout<<left<<setw(24)<<name<<right<<setw(8)<<faces.size()<<setw(8)<<n_strips;
+	cout<<setw(12)<<linear_time*1000<<setw(14)<<quadratic_time*1000<<endl;
+
+	bool ok = true;
+	for(unsigned i=0; i<n_submeshes; ++i)
+	{
+		vector<Triangle> from_strips;
+		strip_triangles(strips, strip_ranges[i], from_strips);
+		vector<Triangle> from_reference;
+		strip_triangles(reference, reference_ranges[i], from_reference);
+		vector<Triangle> from_list;
+		list_triangles(list, list_ranges[i], from_list);
+
+		if(from_strips!=from_reference)
+		{
+			cout<<"  submesh "<<i<<" has other triangles than from the quadratic search"<<endl;
+			ok = false;
+		}
+		if(from_list!=from_strips)
+		{
+			cout<<"  submesh "<<i<<" has other triangles in the list than in the strips"<<endl;
+			ok = false;
+		}
+	}
+
+	if(ok && strips!=reference)
+	{
+		cout<<"  strips are in a different order than from the quadratic search"<<endl;
+		ok = false;
+	}
+
+	return ok;
+}
+
+void build_reference_strips(const vector<Face> &faces, vector<unsigned> &indices, vector<Object::SubMesh> &ranges)
+{
+	// Faces are sorted, so each submesh is a contiguous run
+	vector<Face>::const_iterator begin = faces.begin();
+	while(begin!=faces.end())
+	{
+		vector<Face>::const_iterator end = begin;
+		for(; (end!=faces.end() && end->submesh==begin->submesh); ++end) ;
+
+		if(!indices.empty())
+			indices.push_back(0xFFFFFFFF);
+
+		Object::SubMesh &range = ranges[begin->submesh];
+		range.first = indices.size();
+		build_original_strips(vector<Face>(begin, end), indices);
+		range.count = indices.size()-range.first;
+
+		begin = end;
+	}
+}
+
+void build_original_strips(const vector<Face> &faces, vector<unsigned> &indices)
+{
+	// This is the loop from Object::load_obj before it was replaced
+	vector<bool> used(faces.size(), false);
+	unsigned first_index = indices.size();
+	while(1)
+	{
+		// Search for an unused face
+		unsigned face;
+		for(face=0; face<faces.size(); ++face)
+			if(!used[face])
+				break;
+
+		// Have all faces been processed?
+		if(face==faces.size())
+			break;
+
+		// Inject restart index if this is not the first strip
+		if(indices.size()>first_index)
+			indices.push_back(0xFFFFFFFF);
+
+		// Add the initial face's indices to the strip
+		used[face] = true;
+		indices.push_back(faces[face].indices[0]);
+		indices.push_back(faces[face].indices[1]);
+		if(faces[face].nverts==4)
+			indices.push_back(faces[face].indices[3]);
+		indices.push_back(faces[face].indices[2]);
+
+		unsigned triangle_count = faces[face].nverts-2;
+		while(1)
+		{
+			unsigned last_index = indices.back();
+			unsigned prev_index = indices[indices.size()-2];
+			if(triangle_count%2)
+				swap(last_index, prev_index);
+
+			// Try to find a face that uses the last two indices in the correct order
+			unsigned next;
+			unsigned i = 0;
+			for(next=0; next<faces.size(); ++next)
+				if(!used[next])
+				{
+					for(i=0; i<faces[next].nverts; ++i)
+						if(faces[next].indices[i]==prev_index)
+							break;
+
+					if(i>=faces[next].nverts)
+						continue;
+
+					if(faces[next].indices[(i+1)%faces[next].nverts]==last_index)
+						break;
+				}
+
+			// If there was no suitable face to continue this strip, break out
+			if(next==faces.size())
+				break;
+
+			face = next;
+			used[face] = true;
+			// For quadrilateral faces we have to emit two triangles
+			if(faces[face].nverts==4 && !(triangle_count%2))
+				indices.push_back(faces[face].indices[(i+3)%faces[face].nverts]);
+			indices.push_back(faces[face].indices[(i+2)%faces[face].nverts]);
+			if(faces[face].nverts==4 && (triangle_count%2))
+				indices.push_back(faces[face].indices[(i+3)%faces[face].nverts]);
+
+			triangle_count += faces[face].nverts-2;
+		}
+	}
+}
+
+void strip_triangles(const vector<unsigned> &indices, const Object::SubMesh &range, vector<Triangle> &triangles)
+{
+	vector<unsigned>::const_iterator strip = indices.begin()+range.first;
+	unsigned start = 0;
+	for(unsigned i=0; i<range.count; ++i)
+	{
+		if(strip[i]==0xFFFFFFFF)
+			start = i+1;
+		else if(i>=start+2 && strip[i-2]!=strip[i-1] && strip[i-1]!=strip[i] && strip[i-2]!=strip[i])
+		{
+			// Every other triangle of a strip has its first two vertices swapped
+			if((i-start)%2)
+				triangles.push_back(Triangle(strip[i-1], strip[i-2], strip[i]));
+			else
+				triangles.push_back(Triangle(strip[i-2], strip[i-1], strip[i]));
+		}
+	}
+	sort(triangles.begin(), triangles.end());
+}
+
+void list_triangles(const vector<unsigned> &indices, const Object::SubMesh &range, vector<Triangle> &triangles)
+{
+	for(unsigned i=range.first; i+2<range.first+range.count; i+=3)
+		triangles.push_back(Triangle(indices[i], indices[i+1], indices[i+2]));
+	sort(triangles.begin(), triangles.end());
+}
@@ -0,0 +1,245 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include "fakegl.h"
+#include "material.h"
+#include "resourcemanager.h"
+#include "shader.h"
+
+using namespace std;
+using namespace SkrolliGL;
+
+/*
+Checks the uniform handling of Shader and Material against a fake GL which
+reflects the uniforms declared in the source.  All active uniforms must be found
+when the shader is linked, including each element of an array, and values must
+reach the right locations.  Setting a uniform to the value it already has must
+not call GL and must be counted as skipped.
+
+Linking the shader again with other uniforms must make handles looked up
+before it refer to nothing, even where their index now belongs to another
+uniform or to none.  A Material must then look up its uniforms again by
+itself.
+*/
+
+static bool check(bool, const char *);
+static bool check_values(const Shader &, const string &, const float *, unsigned);
+static unsigned count_uploads();
+static bool test_reflection(Shader &);
+static bool test_uploads(Shader &);
+static bool test_relink(Shader &);
+static bool test_material(Shader &);
+
+static const char vertex_src[] =
+	"#version 150\n"
+	"uniform Draw\n"
+	"{\n"
+	"	mat4 model;\n"
+	"};\n"
+	"uniform mat4 projection;\n"
+	"uniform vec3 lights[4];\n"
+	"uniform float scale;\n"
+	"void main()\n"
+	"{\n"
+	"}\n";
+
+static const char fragment_src[] =
+	"#version 150\n"
+	"uniform sampler2D texture;\n"
+	"uniform vec4 color;\n"
+	"uniform float scale;\n"
+	"void main()\n"
+	"{\n"
+	"}\n";
+
+// Fewer uniforms in another order, so that old indices point elsewhere or nowhere
+static const char relinked_vertex_src[] =
+	"#version 150\n"
+	"uniform vec4 color;\n"
+	"uniform float scale;\n"
+	"uniform vec3 offset;\n"
+	"void main()\n"
+	"{\n"
+	"}\n";
+
+static const char relinked_fragment_src[] =
+	"#version 150\n"
+	"void main()\n"
+	"{\n"
+	"}\n";
+
+static unsigned last_upload_count = 0;
+
+int main()
+{
+	install_fake_gl();
+
+	Shader shader;
+	shader.set_source(vertex_src, fragment_src);
+	shader.bind();
+
+	bool ok = test_reflection(shader);
+	ok &= test_uploads(shader);
+	ok &= test_relink(shader);
+	ok &= test_material(shader);
+	ok &= check(!get_fake_misdirected_upload_count(), "no uploads went to a program not in use");
+
+	return ok ? 0 : 1;
+}
+
+bool check(bool result, const char *description)
+{
+	cout<<(result ? "ok      " : "FAILED  ")<<description<<endl;
+	return result;
+}
+
+bool check_values(const Shader &shader, const string &name, const float *expected, unsigned n_values)
+{
+	const float *values = get_fake_uniform_values(shader.get_uniform_location(name));
+	if(!values)
+		return false;
+
+	for(unsigned i=0; i<n_values; ++i)
+		if(values[i]!=expected[i])
+			return false;
+	return true;
+}
+
+unsigned count_uploads()
+{
+	// Returns the number of uploads since the previous call
+	unsigned count = get_fake_upload_count();
+	unsigned uploads = count-last_upload_count;
+	last_upload_count = count;
+	return uploads;
+}
+
+bool test_reflection(Shader &shader)
+{
+	const char *names[] = { "projection", "lights", "lights[1]", "lights[3]", "scale", "texture", "color" };
+	bool all_found = true;
+	for(unsigned i=0; i<sizeof(names)/sizeof(names[0]); ++i)
+		all_found &= shader.get_uniform(names[i]).is_valid();
+
+	bool ok = check(all_found, "all declared uniforms are found");
+	ok &= check(!shader.get_uniform("model").is_valid() && !shader.get_uniform("missing").is_valid(),
+		"members of blocks and undeclared names are not found");
+	ok &= check(!shader.get_uniform("lights[4]").is_valid(), "elements past the end of an array are not found");
+	ok &= check(shader.get_uniform_location("lights")==shader.get_uniform_location("lights[0]")
+		&& shader.get_uniform_location("lights[1]")!=shader.get_uniform_location("lights[0]"),
+		"the name of an array refers to its first element");
+
+	return ok;
+}
+
+bool test_uploads(Shader &shader)
+{
+	float identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+	float light[3] = { 0.5f, 1, 2 };
+	float color[4] = { 1, 0.5f, 0.25f, 1 };
+	float scale = 2;
+	float unit = 0;
+
+	count_uploads();
+	Shader::reset_uniform_stats();
+	UniformHandle light_handle = shader.get_uniform("lights[2]");
+	for(unsigned i=0; i<2; ++i)
+	{
+		shader.set_uniform_matrix4("projection", identity);
+		shader.set_uniform(light_handle, light[0], light[1], light[2]);
+		shader.set_uniform("color", color[0], color[1], color[2], color[3]);
+		shader.set_uniform("scale", scale);
+		shader.set_uniform("texture", 0);
+	}
+
+	bool ok = check(count_uploads()==5, "each value is uploaded once");
+	const UniformStats &stats = Shader::get_uniform_stats();
+	ok &= check(stats.uploaded==5 && stats.skipped==5, "repeated values are counted as skipped");
+	ok &= check(check_values(shader, "projection", identity, 16) && check_values(shader, "lights[2]", light, 3)
+		&& check_values(shader, "color", color, 4) && check_values(shader, "scale", &scale, 1)
+		&& check_values(shader, "texture", &unit, 1), "values reach their locations");
+
+	scale = 3;
+	shader.set_uniform("scale", scale);
+	shader.set_uniform("lights[1]", light[0], light[1], light[2]);
+	ok &= check(count_uploads()==2 && check_values(shader, "scale", &scale, 1), "changed values are uploaded");
+
+	// Integers and floats are compared by their bits
+	shader.set_uniform("scale", 0.0f);
+	shader.set_uniform("scale", -0.0f);
+	ok &= check(count_uploads()==2, "negative zero is a different value");
+
+	return ok;
+}
+
+bool test_relink(Shader &shader)
+{
+	unsigned generation = shader.get_link_generation();
+	UniformHandle projection_handle = shader.get_uniform("projection");
+	UniformHandle light1_handle = shader.get_uniform("lights[1]");
+	UniformHandle light3_handle = shader.get_uniform("lights[3]");
+	UniformHandle scale_handle = shader.get_uniform("scale");
+	UniformHandle color_handle = shader.get_uniform("color");
+	float identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+	float scale = 3;
+	shader.set_uniform(scale_handle, scale);
+
+	shader.set_source(relinked_vertex_src, relinked_fragment_src);
+	shader.bind();
+	bool ok = check(shader.get_link_generation()!=generation, "linking again changes the generation");
+
+	count_uploads();
+	shader.set_uniform_matrix4(projection_handle, identity);
+	shader.set_uniform(light1_handle, 1.0f, 2.0f, 3.0f);
+	shader.set_uniform(light3_handle, 1.0f, 2.0f, 3.0f);
+	shader.set_uniform(scale_handle, 4.0f);
+	shader.set_uniform(color_handle, 1.0f, 1.0f, 1.0f, 1.0f);
+	ok &= check(!count_uploads(), "handles from before linking set nothing");
+
+	Shader other;
+	other.set_source(vertex_src, fragment_src);
+	shader.set_uniform(other.get_uniform("scale"), 5.0f);
+	ok &= check(!count_uploads(), "handles of another shader set nothing");
+
+	ok &= check(!shader.get_uniform("lights").is_valid() && shader.get_uniform("scale").is_valid(),
+		"uniforms are looked up in the new program");
+
+	// The values from before linking are gone, so setting the same one uploads it
+	shader.set_uniform(shader.get_uniform("scale"), scale);
+	ok &= check(count_uploads()==1 && check_values(shader, "scale", &scale, 1), "values are uploaded again after linking");
+
+	return ok;
+}
+
+bool test_material(Shader &shader)
+{
+	const char *filename = "uniformtest.mat";
+	{
+		ofstream out(filename);
+		out<<"uniform color 0.25 0.5 0.75 1\n";
+		out<<"uniform scale 6\n";
+	}
+
+	ResourceManager manager;
+	Material material;
+	material.load(manager, filename);
+	remove(filename);
+	material.set_shader(&shader);
+
+	float color[4] = { 0.25f, 0.5f, 0.75f, 1 };
+	float scale = 6;
+	count_uploads();
+	material.apply();
+	bool ok = check(count_uploads()==2 && check_values(shader, "color", color, 4) && check_values(shader, "scale", &scale, 1),
+		"material sets its uniforms");
+	material.apply();
+	ok &= check(!count_uploads(), "applying the material again uploads nothing");
+
+	// Swap the uniforms around, so the old handles would point at the wrong one
+	shader.set_source("#version 150\nuniform float scale;\nuniform vec4 color;\nvoid main()\n{\n}\n", relinked_fragment_src);
+	material.apply();
+	ok &= check(count_uploads()==2 && check_values(shader, "color", color, 4) && check_values(shader, "scale", &scale, 1),
+		"material looks up its uniforms again after linking");
+
+	return ok;
+}